@@ -64,6 +64,7 @@ namespace sh
 	void Editor::update()
 	{
 		sh::Factory::getInstance().doMonitorShaderFiles();
+		sh::Factory::getInstance().doMonitorScriptFiles();
 
 		if (!mMainWindow)
 			return;
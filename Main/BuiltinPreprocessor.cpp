@@ -0,0 +1,1359 @@
+#include "BuiltinPreprocessor.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+
+/*
+	The output has to match what boost::wave produces with the emit_custom_line_directives_hooks, i.e.:
+	- directive lines and lines in disabled blocks are removed
+	- after the directives that wave runs through its grammar (#if, #elif, #define) and when entering or leaving
+	  an included file, the next token that is not whitespace is preceded by a newline (this is where wave would
+	  emit a #line directive). #ifdef, #ifndef, #else, #endif, #undef and disabled lines do not have this effect.
+	- C++ comments and C comments spanning multiple lines are replaced by a newline, other C comments are kept
+	- whitespace in macro arguments is collapsed to a single space, and the result of a macro expansion is trimmed
+	- a space is inserted between two adjacent tokens that would otherwise form a different token
+
+	Whenever we are not sure to produce the same output, an Unsupported exception is thrown.
+*/
+
+namespace
+{
+	struct Unsupported
+	{
+	};
+
+	enum TokenKind
+	{
+		// whitespace
+		TK_Space,
+		TK_Newline,
+		TK_CommentNewline, ///< C comment spanning multiple lines, output as newline but does not end the line
+		TK_Comment,
+
+		TK_Identifier,
+		TK_Keyword,
+		TK_AltOperator, ///< and, or, not etc.
+		TK_Integer,
+		TK_Float,
+		TK_String,
+		TK_Char,
+		TK_Unknown,
+
+		TK_LeftParen,
+		TK_RightParen,
+		TK_LeftBracket,
+		TK_RightBracket,
+		TK_LeftBrace,
+		TK_RightBrace,
+		TK_Semicolon,
+		TK_Comma,
+		TK_Colon,
+		TK_Dot,
+		TK_Question,
+		TK_Backslash,
+		TK_Minus,
+		TK_MinusMinus,
+		TK_MinusAssign,
+		TK_Plus,
+		TK_PlusPlus,
+		TK_PlusAssign,
+		TK_Divide,
+		TK_DivideAssign,
+		TK_Equal,
+		TK_Assign,
+		TK_Star,
+		TK_StarAssign,
+		TK_Percent,
+		TK_PercentAssign,
+		TK_ShiftLeft,
+		TK_ShiftRight,
+		TK_ShiftLeftAssign,
+		TK_ShiftRightAssign,
+		TK_NotEqual,
+		TK_LessEqual,
+		TK_GreaterEqual,
+		TK_Less,
+		TK_Greater,
+		TK_Or,
+		TK_And,
+		TK_Xor,
+		TK_OrAssign,
+		TK_AndAssign,
+		TK_XorAssign,
+		TK_OrOr,
+		TK_AndAnd,
+		TK_Not,
+		TK_Tilde,
+		TK_Pound,
+		TK_PoundPound,
+		TK_OtherPunctuator
+	};
+
+	struct Punctuator
+	{
+		const char* mText;
+		TokenKind mKind;
+	};
+
+	// longest first
+	const Punctuator sPunctuators[] = {
+		{ ">>=", TK_ShiftRightAssign }, { "<<=", TK_ShiftLeftAssign }, { "->*", TK_OtherPunctuator }, { "...", TK_OtherPunctuator },
+		{ "##", TK_PoundPound }, { "++", TK_PlusPlus }, { "--", TK_MinusMinus }, { "+=", TK_PlusAssign }, { "-=", TK_MinusAssign },
+		{ "*=", TK_StarAssign }, { "/=", TK_DivideAssign }, { "%=", TK_PercentAssign }, { "&=", TK_AndAssign }, { "|=", TK_OrAssign },
+		{ "^=", TK_XorAssign }, { "==", TK_Equal }, { "!=", TK_NotEqual }, { "<=", TK_LessEqual }, { ">=", TK_GreaterEqual },
+		{ "&&", TK_AndAnd }, { "||", TK_OrOr }, { "<<", TK_ShiftLeft }, { ">>", TK_ShiftRight }, { "->", TK_OtherPunctuator },
+		{ "::", TK_OtherPunctuator }, { ".*", TK_OtherPunctuator },
+		{ "(", TK_LeftParen }, { ")", TK_RightParen }, { "[", TK_LeftBracket }, { "]", TK_RightBracket }, { "{", TK_LeftBrace },
+		{ "}", TK_RightBrace }, { ";", TK_Semicolon }, { ",", TK_Comma }, { ":", TK_Colon }, { ".", TK_Dot }, { "?", TK_Question },
+		{ "-", TK_Minus }, { "+", TK_Plus }, { "/", TK_Divide }, { "=", TK_Assign }, { "*", TK_Star }, { "%", TK_Percent },
+		{ "<", TK_Less }, { ">", TK_Greater }, { "|", TK_Or }, { "&", TK_And }, { "^", TK_Xor }, { "!", TK_Not }, { "~", TK_Tilde },
+		{ "#", TK_Pound }, { "\\", TK_Backslash }, { "@", TK_Unknown }, { "`", TK_Unknown },
+		{ NULL, TK_Unknown }
+	};
+
+	const char* sKeywords[] = {
+		"asm", "auto", "bool", "break", "case", "catch", "char", "class", "const", "const_cast", "continue", "default",
+		"delete", "do", "double", "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false", "float", "for",
+		"friend", "goto", "if", "inline", "int", "long", "mutable", "namespace", "new", "operator", "private", "protected",
+		"public", "register", "reinterpret_cast", "return", "short", "signed", "sizeof", "static", "static_cast", "struct",
+		"switch", "template", "this", "throw", "true", "try", "typedef", "typeid", "typename", "union", "unsigned", "using",
+		"virtual", "void", "volatile", "wchar_t", "while"
+	};
+
+	const char* sAltOperators[] = {
+		"and", "and_eq", "bitand", "bitor", "compl", "not", "not_eq", "or", "or_eq", "xor", "xor_eq"
+	};
+
+	/// @param list sorted alphabetically
+	template <size_t N>
+	bool isInList (const char* (&list)[N], const std::string& str)
+	{
+		size_t first = 0, last = N;
+		while (first < last)
+		{
+			size_t middle = (first + last) / 2;
+			int result = std::strcmp(list[middle], str.c_str());
+			if (result == 0)
+				return true;
+			if (result < 0)
+				first = middle+1;
+			else
+				last = middle;
+		}
+		return false;
+	}
+
+	bool isIdentifierStart (char c)
+	{
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+	}
+
+	bool isDigit (char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	bool isIdentifierChar (char c)
+	{
+		return isIdentifierStart(c) || isDigit(c);
+	}
+
+	bool isHorizontalSpace (char c)
+	{
+		return c == ' ' || c == '\t' || c == '\v' || c == '\f';
+	}
+
+	bool isWhitespace (TokenKind kind)
+	{
+		return kind == TK_Space || kind == TK_Newline || kind == TK_CommentNewline || kind == TK_Comment;
+	}
+
+	/// @return the kind of a pp-number, if it is an integer or floating point literal that wave leaves untouched
+	TokenKind classifyNumber (const std::string& str)
+	{
+		size_t i = 0, n = str.size();
+		if (n > 1 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+		{
+			i = 2;
+			size_t start = i;
+			while (i < n && (isDigit(str[i]) || (str[i] >= 'a' && str[i] <= 'f') || (str[i] >= 'A' && str[i] <= 'F')))
+				++i;
+			if (i == start)
+				throw Unsupported();
+		}
+		else
+		{
+			size_t digits = 0;
+			while (i < n && isDigit(str[i]))
+				++i, ++digits;
+			bool isFloat = false;
+			if (i < n && str[i] == '.')
+			{
+				isFloat = true;
+				++i;
+				while (i < n && isDigit(str[i]))
+					++i, ++digits;
+			}
+			if (digits == 0)
+				throw Unsupported();
+			if (i < n && (str[i] == 'e' || str[i] == 'E'))
+			{
+				isFloat = true;
+				++i;
+				if (i < n && (str[i] == '+' || str[i] == '-'))
+					++i;
+				size_t start = i;
+				while (i < n && isDigit(str[i]))
+					++i;
+				if (i == start)
+					throw Unsupported();
+			}
+			if (isFloat)
+			{
+				if (i < n && (str[i] == 'f' || str[i] == 'F' || str[i] == 'l' || str[i] == 'L'))
+					++i;
+				if (i != n)
+					throw Unsupported();
+				return TK_Float;
+			}
+		}
+		while (i < n && (str[i] == 'u' || str[i] == 'U' || str[i] == 'l' || str[i] == 'L'))
+			++i;
+		if (i != n)
+			throw Unsupported();
+		return TK_Integer;
+	}
+
+	typedef boost::shared_ptr<const std::set<std::string> > HideSet;
+
+	struct Token
+	{
+		TokenKind mKind;
+		std::string mText;
+		HideSet mHideSet; ///< macros that may not be expanded anymore in this token
+
+		Token (TokenKind kind, const std::string& text)
+			: mKind(kind), mText(text)
+		{
+		}
+
+		bool isHidden () const
+		{
+			return mHideSet && mHideSet->find(mText) != mHideSet->end();
+		}
+	};
+
+	typedef std::vector<Token> TokenList;
+
+	/// @note line splicing (backslash-newline) is only supported in directives
+	void tokenize (const std::string& text, TokenList& tokens)
+	{
+		size_t i = 0, n = text.size();
+		bool lineStart = true; ///< only whitespace seen on this line so far
+		bool commentOnLine = false;
+		bool directive = false;
+		while (i < n)
+		{
+			char c = text[i];
+			if (c == '\n')
+			{
+				tokens.push_back(Token(TK_Newline, "\n"));
+				++i;
+				lineStart = true;
+				commentOnLine = false;
+				directive = false;
+				continue;
+			}
+			if (c == '\\' && i+1 < n && text[i+1] == '\n')
+			{
+				if (!directive)
+					throw Unsupported();
+				i += 2;
+				// splicing in the middle of a token
+				if (!tokens.empty() && !isWhitespace(tokens.back().mKind) && i < n && !isHorizontalSpace(text[i]) && text[i] != '\n')
+					throw Unsupported();
+				continue;
+			}
+			if (isHorizontalSpace(c))
+			{
+				std::string space;
+				while (i < n)
+				{
+					if (isHorizontalSpace(text[i]))
+						space += text[i++];
+					else if (directive && text[i] == '\\' && i+1 < n && text[i+1] == '\n')
+						i += 2;
+					else
+						break;
+				}
+				tokens.push_back(Token(TK_Space, space));
+				continue;
+			}
+			if (c == '/' && i+1 < n && text[i+1] == '/')
+			{
+				size_t end = text.find('\n', i);
+				if (end == std::string::npos || text[end-1] == '\\')
+					throw Unsupported();
+				i = end;
+				continue;
+			}
+			if (c == '/' && i+1 < n && text[i+1] == '*')
+			{
+				size_t end = text.find("*/", i+2);
+				if (end == std::string::npos)
+					throw Unsupported();
+				std::string comment = text.substr(i, end+2-i);
+				if (comment.find('\n') != std::string::npos)
+				{
+					if (directive)
+						throw Unsupported();
+					tokens.push_back(Token(TK_CommentNewline, "\n"));
+				}
+				else
+					tokens.push_back(Token(TK_Comment, comment));
+				i = end+2;
+				commentOnLine = true;
+				continue;
+			}
+
+			bool wasLineStart = lineStart;
+			lineStart = false;
+
+			if (isIdentifierStart(c))
+			{
+				size_t start = i;
+				while (i < n && isIdentifierChar(text[i]))
+					++i;
+				if (i < n && (text[i] == '"' || text[i] == '\'' || text[i] == '$' || static_cast<unsigned char>(text[i]) >= 0x80))
+					throw Unsupported(); // string prefixes, $ or non-ASCII identifiers
+				std::string identifier = text.substr(start, i-start);
+				TokenKind kind = TK_Identifier;
+				if (isInList(sKeywords, identifier))
+					kind = TK_Keyword;
+				else if (isInList(sAltOperators, identifier))
+					kind = TK_AltOperator;
+				tokens.push_back(Token(kind, identifier));
+				continue;
+			}
+			if (isDigit(c) || (c == '.' && i+1 < n && isDigit(text[i+1])))
+			{
+				// pp-number
+				size_t start = i;
+				while (i < n)
+				{
+					if ((text[i] == '+' || text[i] == '-') && (text[i-1] == 'e' || text[i-1] == 'E' || text[i-1] == 'p' || text[i-1] == 'P'))
+						++i;
+					else if (isIdentifierChar(text[i]) || text[i] == '.')
+						++i;
+					else
+						break;
+				}
+				std::string number = text.substr(start, i-start);
+				tokens.push_back(Token(classifyNumber(number), number));
+				continue;
+			}
+			if (c == '"' || c == '\'')
+			{
+				size_t start = i++;
+				while (i < n && text[i] != c)
+				{
+					if (text[i] == '\n')
+						throw Unsupported();
+					if (text[i] == '\\')
+						++i;
+					++i;
+				}
+				if (i >= n)
+					throw Unsupported();
+				++i;
+				tokens.push_back(Token(c == '"' ? TK_String : TK_Char, text.substr(start, i-start)));
+				continue;
+			}
+
+			// digraphs and trigraphs
+			if (i+1 < n)
+			{
+				char d = text[i+1];
+				if ((c == '<' && (d == '%' || d == ':')) || (c == '%' && (d == '>' || d == ':')) || (c == ':' && d == '>') || (c == '?' && d == '?'))
+					throw Unsupported();
+			}
+
+			const Punctuator* punctuator = sPunctuators;
+			for (; punctuator->mText; ++punctuator)
+			{
+				if (punctuator->mText[0] == c && text.compare(i, std::strlen(punctuator->mText), punctuator->mText) == 0)
+					break;
+			}
+			if (!punctuator->mText)
+				throw Unsupported(); // '$', '\r', non-ASCII characters etc.
+
+			if (punctuator->mKind == TK_Pound && wasLineStart)
+			{
+				if (commentOnLine)
+					throw Unsupported();
+				directive = true;
+			}
+			tokens.push_back(Token(punctuator->mKind, punctuator->mText));
+			i += std::strlen(punctuator->mText);
+		}
+
+		if (!tokens.empty() && tokens.back().mKind != TK_Newline)
+			throw Unsupported(); // wave reports an error if the last line is not terminated
+	}
+
+	/// @return single token that \a text consists of
+	Token lexSingleToken (const std::string& text)
+	{
+		TokenList tokens;
+		tokenize(text + "\n", tokens);
+		if (tokens.size() != 2 || isWhitespace(tokens[0].mKind) || tokens[0].mKind == TK_Pound)
+			throw Unsupported();
+		return tokens[0];
+	}
+
+	/// collects the output and inserts whitespace where wave does
+	class Output
+	{
+	public:
+		Output ()
+			: mPrev(TK_Newline)
+			, mBeforePrev(TK_Newline)
+			, mMustResync(false)
+		{
+		}
+
+		void emit (const Token& token)
+		{
+			if (mMustResync && !isWhitespace(token.mKind))
+			{
+				// wave would emit a #line directive here
+				append(TK_Newline, "\n");
+				mMustResync = false;
+			}
+			if (mustInsertSpace(token))
+				append(TK_Space, " ");
+			append(token.mKind == TK_CommentNewline ? TK_Newline : token.mKind, token.mText);
+		}
+
+		/// lines were removed, so that the line numbers are not in sync anymore
+		void setMustResync ()
+		{
+			mMustResync = true;
+		}
+
+		std::string mText;
+
+	private:
+		TokenKind mPrev;
+		TokenKind mBeforePrev;
+		bool mMustResync;
+
+		void append (TokenKind kind, const std::string& text)
+		{
+			mText += text;
+			mBeforePrev = mPrev;
+			mPrev = kind;
+		}
+
+		bool isParenthesis (TokenKind kind) const
+		{
+			return kind == TK_LeftParen || kind == TK_RightParen || kind == TK_LeftBracket || kind == TK_RightBracket
+				|| kind == TK_LeftBrace || kind == TK_RightBrace || kind == TK_Semicolon || kind == TK_Comma || kind == TK_Colon;
+		}
+
+		bool afterTrigraph () const
+		{
+			return mPrev == TK_Question && mBeforePrev == TK_Question;
+		}
+
+		/// mirrors boost::wave::util::insert_whitespace_detection
+		bool mustInsertSpace (const Token& token) const
+		{
+			switch (token.mKind)
+			{
+			case TK_Identifier:
+				if (mPrev == TK_Identifier || mPrev == TK_AltOperator)
+					return true;
+				if (mPrev == TK_Integer || mPrev == TK_Float)
+					return token.mText.size() > 1 || (token.mText[0] != 'e' && token.mText[0] != 'E');
+				return false;
+			case TK_Integer:
+			case TK_Float:
+				return mPrev == TK_Identifier || mPrev == TK_Integer || mPrev == TK_Float;
+			case TK_Dot:
+				return mPrev == TK_Dot && mBeforePrev == TK_Dot;
+			case TK_Question:
+				return mPrev == TK_Question;
+			case TK_Newline:
+			case TK_CommentNewline:
+				return (mPrev == TK_Backslash || mPrev == TK_Divide) && mBeforePrev == TK_Question;
+			case TK_LeftBrace:
+			case TK_RightBrace:
+				return afterTrigraph();
+			case TK_Minus:
+			case TK_MinusMinus:
+			case TK_MinusAssign:
+				if (mPrev == TK_Minus || mPrev == TK_MinusMinus)
+					return true;
+				return !isParenthesis(mPrev) && afterTrigraph();
+			case TK_Plus:
+			case TK_PlusPlus:
+			case TK_PlusAssign:
+				if (mPrev == TK_Plus || mPrev == TK_PlusPlus)
+					return true;
+				return !isParenthesis(mPrev) && afterTrigraph();
+			case TK_Divide:
+			case TK_DivideAssign:
+				if (mPrev == TK_Divide)
+					return true;
+				return !isParenthesis(mPrev) && afterTrigraph();
+			case TK_Equal:
+			case TK_Assign:
+				switch (mPrev)
+				{
+				case TK_PlusAssign: case TK_MinusAssign: case TK_DivideAssign: case TK_StarAssign:
+				case TK_ShiftRightAssign: case TK_ShiftLeftAssign: case TK_Equal: case TK_NotEqual:
+				case TK_LessEqual: case TK_GreaterEqual: case TK_Less: case TK_Greater: case TK_Plus:
+				case TK_Minus: case TK_Star: case TK_Divide: case TK_OrAssign: case TK_AndAssign:
+				case TK_XorAssign: case TK_Or: case TK_And: case TK_Xor: case TK_OrOr: case TK_AndAnd:
+					return true;
+				case TK_Question:
+					return mBeforePrev == TK_Question;
+				default:
+					return false;
+				}
+			case TK_Greater:
+				if (mPrev == TK_Minus || mPrev == TK_Greater)
+					return true;
+				return !isParenthesis(mPrev) && afterTrigraph();
+			case TK_Less:
+				if (mPrev == TK_Less)
+					return true;
+				return !isParenthesis(mPrev) && afterTrigraph();
+			case TK_Char:
+			case TK_Not:
+			case TK_NotEqual:
+				return !isParenthesis(mPrev) && afterTrigraph();
+			case TK_And:
+			case TK_AndAnd:
+				return !isParenthesis(mPrev) && (mPrev == TK_And || mPrev == TK_AndAnd);
+			case TK_Or:
+				return !isParenthesis(mPrev) && mPrev == TK_Or;
+			case TK_Xor:
+				return !isParenthesis(mPrev) && mPrev == TK_Xor;
+			case TK_Star:
+				return mPrev == TK_Greater && (mBeforePrev == TK_Minus || mBeforePrev == TK_MinusMinus);
+			case TK_Pound:
+				return mPrev == TK_Pound;
+			default:
+				return false;
+			}
+		}
+	};
+
+	struct Macro
+	{
+		bool mPredefined; ///< defined through the definitions passed to the preprocessor
+		bool mFunctionLike;
+		std::vector<std::string> mParameters;
+		TokenList mBody;
+
+		int findParameter (const std::string& name) const
+		{
+			for (size_t i=0; i<mParameters.size(); ++i)
+				if (mParameters[i] == name)
+					return static_cast<int>(i);
+			return -1;
+		}
+	};
+
+	struct Conditional
+	{
+		bool mActive; ///< is the current branch active?
+		bool mTaken; ///< was any branch taken yet? (or must not be taken, if the enclosing block is inactive)
+		bool mElseSeen;
+	};
+
+	/// evaluates the expression of an \#if or \#elif directive
+	class ExpressionParser
+	{
+	public:
+		ExpressionParser (const TokenList& tokens)
+			: mTokens(tokens)
+			, mPos(0)
+		{
+		}
+
+		boost::int64_t evaluate ()
+		{
+			if (mTokens.empty())
+				throw Unsupported();
+			boost::int64_t value = parseConditional();
+			if (mPos != mTokens.size())
+				throw Unsupported();
+			return value;
+		}
+
+	private:
+		const TokenList& mTokens;
+		size_t mPos;
+
+		TokenKind peek () const
+		{
+			return mPos < mTokens.size() ? mTokens[mPos].mKind : TK_Newline;
+		}
+
+		void expect (TokenKind kind)
+		{
+			if (peek() != kind)
+				throw Unsupported();
+			++mPos;
+		}
+
+		boost::int64_t parseConditional ()
+		{
+			boost::int64_t condition = parseBinary(0);
+			if (peek() != TK_Question)
+				return condition;
+			++mPos;
+			boost::int64_t a = parseConditional();
+			expect(TK_Colon);
+			boost::int64_t b = parseConditional();
+			return condition ? a : b;
+		}
+
+		static int getPrecedence (TokenKind kind)
+		{
+			switch (kind)
+			{
+			case TK_OrOr: return 1;
+			case TK_AndAnd: return 2;
+			case TK_Or: return 3;
+			case TK_Xor: return 4;
+			case TK_And: return 5;
+			case TK_Equal: case TK_NotEqual: return 6;
+			case TK_Less: case TK_Greater: case TK_LessEqual: case TK_GreaterEqual: return 7;
+			case TK_ShiftLeft: case TK_ShiftRight: return 8;
+			case TK_Plus: case TK_Minus: return 9;
+			case TK_Star: case TK_Divide: case TK_Percent: return 10;
+			default: return -1;
+			}
+		}
+
+		boost::int64_t parseBinary (int minPrecedence)
+		{
+			boost::int64_t lhs = parseUnary();
+			while (true)
+			{
+				TokenKind op = peek();
+				int precedence = getPrecedence(op);
+				if (precedence < 0 || precedence < minPrecedence)
+					return lhs;
+				++mPos;
+				boost::int64_t rhs = parseBinary(precedence+1);
+				switch (op)
+				{
+				case TK_OrOr: lhs = (lhs || rhs); break;
+				case TK_AndAnd: lhs = (lhs && rhs); break;
+				case TK_Or: lhs = lhs | rhs; break;
+				case TK_Xor: lhs = lhs ^ rhs; break;
+				case TK_And: lhs = lhs & rhs; break;
+				case TK_Equal: lhs = (lhs == rhs); break;
+				case TK_NotEqual: lhs = (lhs != rhs); break;
+				case TK_Less: lhs = (lhs < rhs); break;
+				case TK_Greater: lhs = (lhs > rhs); break;
+				case TK_LessEqual: lhs = (lhs <= rhs); break;
+				case TK_GreaterEqual: lhs = (lhs >= rhs); break;
+				case TK_ShiftLeft:
+				case TK_ShiftRight:
+					if (rhs < 0 || rhs > 63)
+						throw Unsupported();
+					lhs = (op == TK_ShiftLeft) ? (lhs << rhs) : (lhs >> rhs);
+					break;
+				case TK_Plus: lhs = lhs + rhs; break;
+				case TK_Minus: lhs = lhs - rhs; break;
+				case TK_Star: lhs = lhs * rhs; break;
+				case TK_Divide:
+				case TK_Percent:
+					if (rhs == 0)
+						throw Unsupported();
+					lhs = (op == TK_Divide) ? (lhs / rhs) : (lhs % rhs);
+					break;
+				default:
+					throw Unsupported();
+				}
+			}
+		}
+
+		boost::int64_t parseUnary ()
+		{
+			switch (peek())
+			{
+			case TK_Not: ++mPos; return !parseUnary();
+			case TK_Tilde: ++mPos; return ~parseUnary();
+			case TK_Minus: ++mPos; return -parseUnary();
+			case TK_Plus: ++mPos; return parseUnary();
+			case TK_LeftParen:
+				{
+					++mPos;
+					boost::int64_t value = parseConditional();
+					expect(TK_RightParen);
+					return value;
+				}
+			case TK_Integer:
+				return parseInteger(mTokens[mPos++].mText);
+			case TK_Identifier:
+				// identifiers that are left after macro expansion evaluate to 0
+				if (mTokens[mPos].mText == "defined")
+					throw Unsupported();
+				++mPos;
+				return 0;
+			default:
+				throw Unsupported();
+			}
+		}
+
+		static boost::int64_t parseInteger (std::string text)
+		{
+			// only 'l' suffixes, unsigned arithmetic is not supported
+			while (!text.empty() && (text[text.size()-1] == 'l' || text[text.size()-1] == 'L'))
+				text.erase(text.size()-1);
+			if (text.find_first_of("uU") != std::string::npos)
+				throw Unsupported();
+			errno = 0;
+			char* end;
+			boost::int64_t value = std::strtoll(text.c_str(), &end, 0);
+			if (errno != 0 || *end != '\0')
+				throw Unsupported();
+			return value;
+		}
+	};
+
+	class Engine
+	{
+	public:
+		Engine (const std::string& includePath, const sh::BuiltinPreprocessor::FileLoader& loader)
+			: mIncludePath(includePath)
+			, mLoader(loader)
+			, mIncludeDepth(0)
+		{
+		}
+
+		void define (const std::string& definition)
+		{
+			size_t equals = definition.find('=');
+			std::string name = definition.substr(0, equals);
+			std::string value = (equals == std::string::npos) ? "1" : definition.substr(equals+1);
+
+			TokenList tokens;
+			tokenize("#define " + name + " " + value + "\n", tokens);
+			handleDefine(tokens, 2, tokens.size()-1, true);
+		}
+
+		void processFile (const std::string& text, const std::string& directory)
+		{
+			TokenList tokens;
+			tokenize(text, tokens);
+
+			size_t conditionalDepth = mConditionals.size();
+			size_t lineStart = 0;
+			for (size_t i=0; i<tokens.size(); ++i)
+			{
+				if (tokens[i].mKind == TK_Newline)
+				{
+					handleLine(tokens, lineStart, i, directory);
+					lineStart = i+1;
+				}
+			}
+
+			// wave reports unbalanced #if/#endif per file
+			if (mConditionals.size() != conditionalDepth)
+				throw Unsupported();
+		}
+
+		std::string& getResult ()
+		{
+			return mOutput.mText;
+		}
+
+	private:
+		typedef std::map<std::string, Macro> MacroMap;
+		MacroMap mMacros;
+		std::vector<Conditional> mConditionals;
+		Output mOutput;
+
+		std::string mIncludePath;
+		const sh::BuiltinPreprocessor::FileLoader& mLoader;
+		int mIncludeDepth;
+
+		bool isActive () const
+		{
+			return mConditionals.empty() || mConditionals.back().mActive;
+		}
+
+		/// @param end index of the newline token
+		void handleLine (const TokenList& tokens, size_t start, size_t end, const std::string& directory)
+		{
+			size_t i = start;
+			while (i < end && isWhitespace(tokens[i].mKind))
+				++i;
+
+			if (i < end && tokens[i].mKind == TK_Pound)
+			{
+				handleDirective(tokens, i+1, end, directory);
+				return;
+			}
+
+			if (!isActive())
+				return;
+
+			bool hasMacros = false;
+			for (size_t j=i; j<end && !hasMacros; ++j)
+			{
+				hasMacros = tokens[j].mKind == TK_Identifier
+					&& (mMacros.find(tokens[j].mText) != mMacros.end() || tokens[j].mText.compare(0, 2, "__") == 0);
+			}
+			if (!hasMacros)
+			{
+				for (size_t j=start; j<=end; ++j)
+					mOutput.emit(tokens[j]);
+				return;
+			}
+
+			// macro expansion works on a reversed list, so that tokens can be taken from and pushed to the back
+			TokenList input (tokens.rbegin() + (tokens.size()-end), tokens.rbegin() + (tokens.size()-start));
+			// wave looks for the arguments of a macro invocation at the end of the line on the next lines
+			size_t next = end+1;
+			while (next < tokens.size() && isWhitespace(tokens[next].mKind))
+				++next;
+			bool parenFollows = (next < tokens.size() && tokens[next].mKind == TK_LeftParen);
+
+			TokenList output;
+			expand(input, output, parenFollows);
+			for (TokenList::const_iterator it = output.begin(); it != output.end(); ++it)
+				mOutput.emit(*it);
+			mOutput.emit(tokens[end]);
+		}
+
+		/// @return tokens from \a start to \a end without whitespace
+		static TokenList getSignificantTokens (const TokenList& tokens, size_t start, size_t end)
+		{
+			TokenList result;
+			for (size_t i=start; i<end; ++i)
+			{
+				if (!isWhitespace(tokens[i].mKind))
+					result.push_back(tokens[i]);
+			}
+			return result;
+		}
+
+		void handleDirective (const TokenList& tokens, size_t start, size_t end, const std::string& directory)
+		{
+			while (start < end && tokens[start].mKind == TK_Space)
+				++start;
+			if (start == end || (tokens[start].mKind != TK_Identifier && tokens[start].mKind != TK_Keyword))
+				throw Unsupported(); // null directive, line markers etc.
+
+			const std::string& directive = tokens[start].mText;
+			++start;
+
+			if (directive == "if" || directive == "ifdef" || directive == "ifndef")
+			{
+				Conditional conditional;
+				conditional.mElseSeen = false;
+				if (!isActive())
+				{
+					if (directive != "if")
+						getMacroName(tokens, start, end);
+					conditional.mActive = false;
+					conditional.mTaken = true;
+				}
+				else
+				{
+					if (directive == "if")
+					{
+						conditional.mActive = evaluate(tokens, start, end);
+						mOutput.setMustResync();
+					}
+					else
+						conditional.mActive = (mMacros.find(getMacroName(tokens, start, end)) != mMacros.end()) == (directive == "ifdef");
+					conditional.mTaken = conditional.mActive;
+				}
+				mConditionals.push_back(conditional);
+			}
+			else if (directive == "elif")
+			{
+				if (mConditionals.empty() || mConditionals.back().mElseSeen)
+					throw Unsupported();
+				// wave only parses the directive if the enclosing block is active
+				if (mConditionals.size() < 2 || mConditionals[mConditionals.size()-2].mActive)
+					mOutput.setMustResync();
+
+				Conditional& conditional = mConditionals.back();
+				if (conditional.mTaken)
+					conditional.mActive = false;
+				else
+				{
+					conditional.mActive = evaluate(tokens, start, end);
+					conditional.mTaken = conditional.mActive;
+				}
+			}
+			else if (directive == "else")
+			{
+				if (mConditionals.empty() || mConditionals.back().mElseSeen || !getSignificantTokens(tokens, start, end).empty())
+					throw Unsupported();
+				Conditional& conditional = mConditionals.back();
+				conditional.mActive = !conditional.mTaken;
+				conditional.mTaken = true;
+				conditional.mElseSeen = true;
+			}
+			else if (directive == "endif")
+			{
+				if (mConditionals.empty() || !getSignificantTokens(tokens, start, end).empty())
+					throw Unsupported();
+				mConditionals.pop_back();
+			}
+			else if (!isActive())
+			{
+				// other directives in disabled blocks are ignored
+			}
+			else if (directive == "define")
+			{
+				handleDefine(tokens, start, end);
+				mOutput.setMustResync();
+			}
+			else if (directive == "undef")
+				mMacros.erase(getMacroName(tokens, start, end));
+			else if (directive == "include")
+				handleInclude(tokens, start, end, directory);
+			else
+				throw Unsupported();
+		}
+
+		static void checkMacroName (const Token& token)
+		{
+			if (token.mKind != TK_Identifier || token.mText == "defined" || token.mText.compare(0, 2, "__") == 0)
+				throw Unsupported();
+		}
+
+		/// @return the only token between \a start and \a end, which must be a macro name
+		static std::string getMacroName (const TokenList& tokens, size_t start, size_t end)
+		{
+			TokenList significant = getSignificantTokens(tokens, start, end);
+			if (significant.size() != 1)
+				throw Unsupported();
+			checkMacroName(significant[0]);
+			return significant[0].mText;
+		}
+
+		void handleDefine (const TokenList& tokens, size_t start, size_t end, bool predefined = false)
+		{
+			size_t i = start;
+			while (i < end && tokens[i].mKind == TK_Space)
+				++i;
+			if (i == end)
+				throw Unsupported();
+			checkMacroName(tokens[i]);
+			std::string name = tokens[i].mText;
+			++i;
+
+			Macro macro;
+			macro.mPredefined = predefined;
+			macro.mFunctionLike = (i < end && tokens[i].mKind == TK_LeftParen);
+			if (macro.mFunctionLike)
+			{
+				++i;
+				bool expectParameter = true;
+				while (true)
+				{
+					while (i < end && tokens[i].mKind == TK_Space)
+						++i;
+					if (i == end)
+						throw Unsupported();
+					if (tokens[i].mKind == TK_RightParen && (expectParameter == macro.mParameters.empty()))
+					{
+						++i;
+						break;
+					}
+					if (expectParameter)
+					{
+						checkMacroName(tokens[i]);
+						if (macro.findParameter(tokens[i].mText) != -1)
+							throw Unsupported();
+						macro.mParameters.push_back(tokens[i].mText);
+					}
+					else if (tokens[i].mKind != TK_Comma)
+						throw Unsupported(); // also variadic macros
+					expectParameter = !expectParameter;
+					++i;
+				}
+			}
+			else if (i < end && tokens[i].mKind != TK_Space)
+				throw Unsupported();
+
+			while (i < end && tokens[i].mKind == TK_Space)
+				++i;
+			size_t bodyEnd = end;
+			while (bodyEnd > i && tokens[bodyEnd-1].mKind == TK_Space)
+				--bodyEnd;
+			macro.mBody.assign(tokens.begin()+i, tokens.begin()+bodyEnd);
+
+			for (TokenList::const_iterator it = macro.mBody.begin(); it != macro.mBody.end(); ++it)
+			{
+				if (it->mKind == TK_Comment || it->mKind == TK_Pound)
+					throw Unsupported(); // comments are kept in macro bodies, stringizing is not supported
+			}
+			if (!macro.mBody.empty() && (macro.mBody.front().mKind == TK_PoundPound || macro.mBody.back().mKind == TK_PoundPound))
+				throw Unsupported();
+
+			MacroMap::iterator existing = mMacros.find(name);
+			if (existing != mMacros.end() && (existing->second.mPredefined || !isSameDefinition(existing->second, macro)))
+				throw Unsupported(); // wave reports an error
+			mMacros[name] = macro;
+		}
+
+		static bool isSameDefinition (const Macro& a, const Macro& b)
+		{
+			if (a.mFunctionLike != b.mFunctionLike || a.mParameters != b.mParameters || a.mBody.size() != b.mBody.size())
+				return false;
+			for (size_t i=0; i<a.mBody.size(); ++i)
+			{
+				if (a.mBody[i].mKind != b.mBody[i].mKind
+						|| (a.mBody[i].mKind != TK_Space && a.mBody[i].mText != b.mBody[i].mText))
+					return false;
+			}
+			return true;
+		}
+
+		void handleInclude (const TokenList& tokens, size_t start, size_t end, const std::string& directory)
+		{
+			TokenList significant = getSignificantTokens(tokens, start, end);
+			if (significant.size() != 1 || significant[0].mKind != TK_String)
+				throw Unsupported(); // <> includes, computed includes
+			std::string filename = significant[0].mText.substr(1, significant[0].mText.size()-2);
+			if (filename.find('\\') != std::string::npos)
+				throw Unsupported();
+
+			if (++mIncludeDepth > 64)
+				throw Unsupported();
+
+			namespace bfs = boost::filesystem;
+
+			// like wave, look in the directory of the current file first
+			bfs::path currentDirectory (directory);
+			if (directory.empty())
+				currentDirectory = bfs::current_path();
+
+			std::string contents;
+			bfs::path path = currentDirectory / filename;
+			if (!mLoader(path.string(), contents))
+			{
+				path = bfs::path(mIncludePath) / filename;
+				if (!mLoader(path.string(), contents))
+					throw Unsupported();
+			}
+
+			mOutput.setMustResync();
+			processFile(contents, path.parent_path().string());
+			mOutput.setMustResync();
+			--mIncludeDepth;
+		}
+
+		bool evaluate (const TokenList& tokens, size_t start, size_t end)
+		{
+			// resolve 'defined' before macro expansion
+			TokenList input;
+			for (size_t i=start; i<end; ++i)
+			{
+				if (tokens[i].mKind == TK_Identifier && tokens[i].mText == "defined")
+				{
+					size_t j = i+1;
+					while (j < end && isWhitespace(tokens[j].mKind))
+						++j;
+					bool parenthesis = (j < end && tokens[j].mKind == TK_LeftParen);
+					if (parenthesis)
+					{
+						++j;
+						while (j < end && isWhitespace(tokens[j].mKind))
+							++j;
+					}
+					if (j == end)
+						throw Unsupported();
+					checkMacroName(tokens[j]);
+					bool defined = mMacros.find(tokens[j].mText) != mMacros.end();
+					if (parenthesis)
+					{
+						++j;
+						while (j < end && isWhitespace(tokens[j].mKind))
+							++j;
+						if (j == end || tokens[j].mKind != TK_RightParen)
+							throw Unsupported();
+					}
+					input.push_back(Token(TK_Integer, defined ? "1" : "0"));
+					i = j;
+				}
+				else if (tokens[i].mKind == TK_Keyword || tokens[i].mKind == TK_AltOperator)
+					throw Unsupported(); // e.g. true, false, and, or
+				else
+					input.push_back(tokens[i]);
+			}
+
+			std::reverse(input.begin(), input.end());
+			TokenList expanded;
+			expand(input, expanded, false);
+
+			TokenList significant = getSignificantTokens(expanded, 0, expanded.size());
+			return ExpressionParser(significant).evaluate() != 0;
+		}
+
+		static HideSet addToHideSet (const HideSet& hideSet, const std::string& name)
+		{
+			boost::shared_ptr<std::set<std::string> > result (hideSet ? new std::set<std::string>(*hideSet) : new std::set<std::string>());
+			result->insert(name);
+			return result;
+		}
+
+		static HideSet mergeHideSets (const HideSet& a, const HideSet& b)
+		{
+			if (!a)
+				return b;
+			if (!b || a == b)
+				return a;
+			boost::shared_ptr<std::set<std::string> > result (new std::set<std::string>(*a));
+			result->insert(b->begin(), b->end());
+			return result;
+		}
+
+		static void trimSpace (TokenList& tokens)
+		{
+			size_t start = 0, end = tokens.size();
+			while (start < end && tokens[start].mKind == TK_Space)
+				++start;
+			while (end > start && tokens[end-1].mKind == TK_Space)
+				--end;
+			if (start != 0 || end != tokens.size())
+				tokens = TokenList(tokens.begin()+start, tokens.begin()+end);
+		}
+
+		/**
+		 * Expands all macros
+		 * @param input reversed list of tokens to expand, will be empty afterwards
+		 * @param output expanded tokens
+		 * @param parenFollows the first token after the input (apart from whitespace and newlines) is a left parenthesis
+		 */
+		void expand (TokenList& input, TokenList& output, bool parenFollows)
+		{
+			while (!input.empty())
+			{
+				Token token = input.back();
+				input.pop_back();
+
+				if (token.mKind != TK_Identifier)
+				{
+					output.push_back(token);
+					continue;
+				}
+				if (token.mText.compare(0, 2, "__") == 0)
+					throw Unsupported(); // predefined macros
+				if (token.isHidden())
+				{
+					output.push_back(token);
+					continue;
+				}
+				MacroMap::const_iterator it = mMacros.find(token.mText);
+				if (it == mMacros.end())
+				{
+					output.push_back(token);
+					continue;
+				}
+				const Macro& macro = it->second;
+
+				// like wave, look for an argument list even for object-like macros
+				size_t i = input.size();
+				while (i > 0 && input[i-1].mKind == TK_Space)
+					--i;
+				if (i > 0 && (input[i-1].mKind == TK_Comment || input[i-1].mKind == TK_CommentNewline))
+					throw Unsupported();
+				if (i == 0 && parenFollows)
+					throw Unsupported(); // the arguments might start on one of the next lines
+				bool hasArguments = (i > 0 && input[i-1].mKind == TK_LeftParen);
+
+				std::vector<TokenList> arguments;
+				if (macro.mFunctionLike)
+				{
+					if (!hasArguments)
+					{
+						output.push_back(token);
+						continue;
+					}
+					input.erase(input.begin()+(i-1), input.end());
+					collectArguments(input, macro, arguments);
+				}
+				else if (hasArguments)
+				{
+					// the whitespace before the parenthesis is lost
+					input.erase(input.begin()+i, input.end());
+				}
+
+				TokenList replacement;
+				substitute(macro, arguments, addToHideSet(token.mHideSet, token.mText), replacement);
+				input.insert(input.end(), replacement.rbegin(), replacement.rend());
+			}
+		}
+
+		/// takes the arguments of a function-like macro invocation from \a input, up to and including the closing parenthesis
+		void collectArguments (TokenList& input, const Macro& macro, std::vector<TokenList>& arguments)
+		{
+			arguments.push_back(TokenList());
+			int depth = 1;
+			while (true)
+			{
+				if (input.empty())
+					throw Unsupported(); // invocation spanning multiple lines
+				Token token = input.back();
+				input.pop_back();
+
+				if (token.mKind == TK_Comment || token.mKind == TK_CommentNewline || token.mKind == TK_PoundPound)
+					throw Unsupported();
+				else if (token.mKind == TK_LeftParen)
+					++depth;
+				else if (token.mKind == TK_RightParen)
+				{
+					if (--depth == 0)
+						break;
+				}
+				else if (token.mKind == TK_Comma && depth == 1)
+				{
+					arguments.push_back(TokenList());
+					continue;
+				}
+
+				// collapse whitespace
+				if (token.mKind == TK_Space)
+				{
+					if (!arguments.back().empty() && arguments.back().back().mKind == TK_Space)
+						continue;
+					token.mText = " ";
+				}
+				arguments.back().push_back(token);
+			}
+
+			if (macro.mParameters.empty() && arguments.size() == 1 && getSignificantTokens(arguments[0], 0, arguments[0].size()).empty())
+			{
+				arguments.clear();
+				return;
+			}
+			if (arguments.size() != macro.mParameters.size())
+				throw Unsupported();
+			for (std::vector<TokenList>::const_iterator it = arguments.begin(); it != arguments.end(); ++it)
+			{
+				if (getSignificantTokens(*it, 0, it->size()).empty())
+					throw Unsupported(); // wave does not support empty arguments in C++ mode
+			}
+		}
+
+		void substitute (const Macro& macro, const std::vector<TokenList>& arguments, const HideSet& hideSet, TokenList& result)
+		{
+			std::vector<TokenList> expandedArguments (arguments.size());
+			std::vector<bool> isExpanded (arguments.size(), false);
+
+			TokenList substituted;
+			const TokenList& body = macro.mBody;
+			for (size_t i=0; i<body.size(); ++i)
+			{
+				int parameter = (body[i].mKind == TK_Identifier) ? macro.findParameter(body[i].mText) : -1;
+				if (parameter == -1)
+				{
+					substituted.push_back(body[i]);
+					continue;
+				}
+
+				size_t previous = i, next = i+1;
+				while (previous > 0 && body[previous-1].mKind == TK_Space)
+					--previous;
+				while (next < body.size() && body[next].mKind == TK_Space)
+					++next;
+				bool paste = (previous > 0 && body[previous-1].mKind == TK_PoundPound) || (next < body.size() && body[next].mKind == TK_PoundPound);
+
+				if (paste)
+				{
+					TokenList argument = arguments[parameter];
+					trimSpace(argument);
+					substituted.insert(substituted.end(), argument.begin(), argument.end());
+				}
+				else
+				{
+					if (!isExpanded[parameter])
+					{
+						TokenList input (arguments[parameter].rbegin(), arguments[parameter].rend());
+						expand(input, expandedArguments[parameter], false);
+						if (getSignificantTokens(expandedArguments[parameter], 0, expandedArguments[parameter].size()).empty())
+							expandedArguments[parameter].clear();
+						isExpanded[parameter] = true;
+					}
+					substituted.insert(substituted.end(), expandedArguments[parameter].begin(), expandedArguments[parameter].end());
+				}
+			}
+
+			// token pasting
+			result.clear();
+			for (size_t i=0; i<substituted.size(); ++i)
+			{
+				if (substituted[i].mKind != TK_PoundPound)
+				{
+					result.push_back(substituted[i]);
+					continue;
+				}
+				trimSpace(result);
+				size_t next = i+1;
+				while (next < substituted.size() && substituted[next].mKind == TK_Space)
+					++next;
+				if (result.empty() || next == substituted.size())
+					throw Unsupported();
+				Token pasted = lexSingleToken(result.back().mText + substituted[next].mText);
+				pasted.mHideSet = mergeHideSets(result.back().mHideSet, substituted[next].mHideSet);
+				result.back() = pasted;
+				i = next;
+			}
+
+			for (TokenList::iterator it = result.begin(); it != result.end(); ++it)
+				it->mHideSet = mergeHideSets(it->mHideSet, hideSet);
+			trimSpace(result);
+		}
+	};
+}
+
+namespace sh
+{
+	bool BuiltinPreprocessor::preprocess (const std::string& source, const std::string& includePath, const std::vector<std::string>& definitions,
+		const std::string& name, const FileLoader& loader, std::string& result)
+	{
+		try
+		{
+			Engine engine (includePath, loader);
+			for (std::vector<std::string>::const_iterator it = definitions.begin(); it != definitions.end(); ++it)
+				engine.define(*it);
+
+			std::string directory;
+			boost::filesystem::path parent = boost::filesystem::path(name).parent_path();
+			if (!parent.empty())
+				directory = boost::filesystem::absolute(parent).string();
+
+			engine.processFile(source, directory);
+			result.swap(engine.getResult());
+			return true;
+		}
+		catch (Unsupported&)
+		{
+			return false;
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef SH_BUILTINPREPROCESSOR_H
+#define SH_BUILTINPREPROCESSOR_H
+
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+
+namespace sh
+{
+	/**
+	 * @brief A lightweight preprocessor that produces the same output as \a Preprocessor (boost::wave)
+	 * for the subset of features that shaders typically use:
+	 * - conditional compilation (\#if, \#ifdef, \#ifndef, \#elif, \#else, \#endif) with integer expressions
+	 * - object-like and function-like macros, including token pasting (##)
+	 * - \#include "file"
+	 *
+	 * Anything else (e.g. stringizing, variadic macros, \#pragma, \#error, predefined macros such as __LINE__,
+	 * macro invocations spanning multiple lines) is reported as unsupported, the caller is expected to fall back
+	 * to boost::wave in this case. The same goes for erroneous input, so that the error messages are consistent.
+	 */
+	class BuiltinPreprocessor
+	{
+	public:
+		/// @return false if the file could not be read
+		typedef boost::function<bool (const std::string& filename, std::string& contents)> FileLoader;
+
+		/**
+		 * @brief Run a shader source string through the preprocessor
+		 * @param source source string
+		 * @param includePath path to search for includes (that are included with #include)
+		 * @param definitions macros to predefine (vector of strings of the format MACRO=value, or just MACRO to define it as 1)
+		 * @param name name of the source, included files are searched relative to it first
+		 * @param loader used to read included files
+		 * @param result processed string
+		 * @return false if the source uses a feature that is not supported
+		 */
+		static bool preprocess (const std::string& source, const std::string& includePath, const std::vector<std::string>& definitions,
+			const std::string& name, const FileLoader& loader, std::string& result);
+	};
+}
+
+#endif
@@ -0,0 +1,443 @@
+#include "CacheArchive.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "Hash.hpp"
+
+namespace
+{
+	const char sMagic[4] = { 'S', 'H', 'C', 'A' };
+	const boost::uint32_t sVersion = 1;
+
+	const size_t sHeaderSize = 16;
+	const size_t sIndexRecordSize = 24;
+
+	boost::uint32_t readUInt32 (const char* data)
+	{
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+		return boost::uint32_t(bytes[0]) | (boost::uint32_t(bytes[1]) << 8) | (boost::uint32_t(bytes[2]) << 16) | (boost::uint32_t(bytes[3]) << 24);
+	}
+
+	boost::uint64_t readUInt64 (const char* data)
+	{
+		return boost::uint64_t(readUInt32(data)) | (boost::uint64_t(readUInt32(data+4)) << 32);
+	}
+
+	void writeUInt32 (std::string& out, boost::uint32_t value)
+	{
+		for (int i=0; i<4; ++i)
+			out += static_cast<char>((value >> (i*8)) & 0xff);
+	}
+
+	void writeUInt64 (std::string& out, boost::uint64_t value)
+	{
+		writeUInt32(out, static_cast<boost::uint32_t>(value));
+		writeUInt32(out, static_cast<boost::uint32_t>(value >> 32));
+	}
+
+	boost::uint64_t getKey (const std::string& name)
+	{
+		sh::Hash hash;
+		hash.add(name);
+		return hash.get();
+	}
+
+	/// checksum of a journal record, to detect records that were only partially written
+	boost::uint64_t getChecksum (const std::string& name, const std::string& data)
+	{
+		sh::Hash hash;
+		hash.add(name);
+		hash.add(data);
+		return hash.get();
+	}
+
+	struct IndexRecord
+	{
+		boost::uint64_t mKey;
+		const std::string* mName;
+		const std::string* mData;
+
+		bool operator< (const IndexRecord& other) const
+		{
+			return mKey < other.mKey;
+		}
+	};
+}
+
+namespace sh
+{
+	CacheArchive::CacheArchive (const std::string& path)
+		: mPath(path)
+		, mJournalPath(path + ".journal")
+		, mData(NULL)
+		, mEntryCount(0)
+		, mJournalSize(0)
+	{
+		map();
+		readJournal();
+	}
+
+	CacheArchive::~CacheArchive ()
+	{
+		try
+		{
+			compact();
+		}
+		catch (std::exception& e)
+		{
+			std::cerr << "sh::CacheArchive: Failed to write " << mPath << ": " << e.what() << std::endl;
+		}
+	}
+
+	void CacheArchive::map ()
+	{
+		unmap();
+
+		namespace bip = boost::interprocess;
+
+		boost::system::error_code ec;
+		boost::uintmax_t fileSize = boost::filesystem::file_size(mPath, ec);
+		if (ec || fileSize == 0)
+			return;
+
+		try
+		{
+			mFile.reset(new bip::file_mapping(mPath.c_str(), bip::read_only));
+			mRegion.reset(new bip::mapped_region(*mFile, bip::read_only));
+		}
+		catch (bip::interprocess_exception& e)
+		{
+			std::cerr << "sh::CacheArchive: Failed to open " << mPath << ": " << e.what() << std::endl;
+			unmap();
+			return;
+		}
+
+		const char* data = static_cast<const char*>(mRegion->get_address());
+		size_t size = mRegion->get_size();
+
+		// validate everything up front, so that lookups don't have to
+		bool valid = size >= sHeaderSize && std::memcmp(data, sMagic, 4) == 0 && readUInt32(data+4) == sVersion;
+		boost::uint32_t count = valid ? readUInt32(data+8) : 0;
+		valid = valid && (size - sHeaderSize) / sIndexRecordSize >= count;
+		for (boost::uint32_t i=0; valid && i<count; ++i)
+		{
+			const char* record = data + sHeaderSize + i * sIndexRecordSize;
+			boost::uint64_t offset = readUInt64(record+8);
+			boost::uint64_t entrySize = boost::uint64_t(readUInt32(record+16)) + readUInt32(record+20);
+			valid = offset <= size && entrySize <= size - offset
+				&& (i == 0 || readUInt64(record - sIndexRecordSize) <= readUInt64(record));
+		}
+		if (!valid)
+		{
+			std::cerr << "sh::CacheArchive: Ignoring invalid archive " << mPath << std::endl;
+			unmap();
+			return;
+		}
+
+		mData = data;
+		mEntryCount = count;
+	}
+
+	void CacheArchive::unmap ()
+	{
+		mRegion.reset();
+		mFile.reset();
+		mData = NULL;
+		mEntryCount = 0;
+	}
+
+	boost::uint32_t CacheArchive::lowerBound (boost::uint64_t key) const
+	{
+		boost::uint32_t first = 0, last = mEntryCount;
+		while (first < last)
+		{
+			boost::uint32_t middle = first + (last - first) / 2;
+			if (readUInt64(mData + sHeaderSize + middle * sIndexRecordSize) < key)
+				first = middle+1;
+			else
+				last = middle;
+		}
+		return first;
+	}
+
+	void CacheArchive::getEntry (boost::uint32_t index, std::string& name, std::string& data) const
+	{
+		const char* record = mData + sHeaderSize + index * sIndexRecordSize;
+		const char* entry = mData + readUInt64(record+8);
+		boost::uint32_t nameSize = readUInt32(record+16);
+		name.assign(entry, nameSize);
+		data.assign(entry + nameSize, readUInt32(record+20));
+	}
+
+	void CacheArchive::getEntryName (boost::uint32_t index, std::string& name) const
+	{
+		const char* record = mData + sHeaderSize + index * sIndexRecordSize;
+		name.assign(mData + readUInt64(record+8), readUInt32(record+16));
+	}
+
+	bool CacheArchive::findInArchive (const std::string& name, std::string* data) const
+	{
+		boost::uint64_t key = getKey(name);
+		for (boost::uint32_t i = lowerBound(key); i < mEntryCount; ++i)
+		{
+			const char* record = mData + sHeaderSize + i * sIndexRecordSize;
+			if (readUInt64(record) != key)
+				break;
+
+			const char* entry = mData + readUInt64(record+8);
+			boost::uint32_t nameSize = readUInt32(record+16);
+			if (nameSize == name.size() && name.compare(0, nameSize, entry, nameSize) == 0)
+			{
+				if (data)
+					data->assign(entry + nameSize, readUInt32(record+20));
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool CacheArchive::find (const std::string& name, std::string& data)
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+
+		EntryMap::const_iterator it = mJournal.find(name);
+		if (it != mJournal.end())
+		{
+			data = it->second;
+			return true;
+		}
+		return findInArchive(name, &data);
+	}
+
+	void CacheArchive::insert (const std::string& name, const std::string& data)
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+		mJournal[name] = data;
+		appendToJournal(name, data);
+	}
+
+	void CacheArchive::clear ()
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+		unmap();
+		mJournal.clear();
+		mJournalFile.reset();
+
+		boost::system::error_code ec;
+		boost::filesystem::remove(mPath, ec);
+		boost::filesystem::remove(mJournalPath, ec);
+		mJournalSize = 0;
+	}
+
+	unsigned int CacheArchive::getEntryCount ()
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+		unsigned int count = mEntryCount;
+		for (EntryMap::const_iterator it = mJournal.begin(); it != mJournal.end(); ++it)
+		{
+			if (!findInArchive(it->first, NULL))
+				++count;
+		}
+		return count;
+	}
+
+	void CacheArchive::merge (CacheArchive& other)
+	{
+		EntryMap entries;
+		{
+			boost::mutex::scoped_lock lock(other.mMutex);
+			for (boost::uint32_t i=0; i<other.mEntryCount; ++i)
+			{
+				std::string name, data;
+				other.getEntry(i, name, data);
+				entries[name] = data;
+			}
+			for (EntryMap::const_iterator it = other.mJournal.begin(); it != other.mJournal.end(); ++it)
+				entries[it->first] = it->second;
+		}
+
+		boost::mutex::scoped_lock lock(mMutex);
+		for (EntryMap::const_iterator it = entries.begin(); it != entries.end(); ++it)
+		{
+			mJournal[it->first] = it->second;
+			appendToJournal(it->first, it->second);
+		}
+	}
+
+	void CacheArchive::compact ()
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+		if (!mJournal.empty())
+			rewrite(NULL);
+	}
+
+	void CacheArchive::removeIf (const Predicate& remove)
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+
+		bool found = false;
+		for (EntryMap::const_iterator it = mJournal.begin(); !found && it != mJournal.end(); ++it)
+			found = remove(it->first);
+		std::string name;
+		for (boost::uint32_t i=0; !found && i<mEntryCount; ++i)
+		{
+			getEntryName(i, name);
+			found = remove(name);
+		}
+
+		if (found)
+			rewrite(&remove);
+	}
+
+	void CacheArchive::rewrite (const Predicate* remove)
+	{
+		// collect the entries of the current archive that were not replaced
+		std::vector<std::string> names;
+		std::vector<std::string> datas;
+		names.reserve(mEntryCount);
+		datas.reserve(mEntryCount);
+		for (boost::uint32_t i=0; i<mEntryCount; ++i)
+		{
+			std::string name, data;
+			getEntryName(i, name);
+			if (mJournal.find(name) != mJournal.end() || (remove && (*remove)(name)))
+				continue;
+			getEntry(i, name, data);
+			names.push_back(name);
+			datas.push_back(data);
+		}
+
+		std::vector<IndexRecord> records;
+		records.reserve(names.size() + mJournal.size());
+		for (size_t i=0; i<names.size(); ++i)
+		{
+			IndexRecord record = { getKey(names[i]), &names[i], &datas[i] };
+			records.push_back(record);
+		}
+		for (EntryMap::const_iterator it = mJournal.begin(); it != mJournal.end(); ++it)
+		{
+			if (remove && (*remove)(it->first))
+				continue;
+			IndexRecord record = { getKey(it->first), &it->first, &it->second };
+			records.push_back(record);
+		}
+		std::stable_sort(records.begin(), records.end());
+
+		std::string header;
+		header.append(sMagic, 4);
+		writeUInt32(header, sVersion);
+		writeUInt32(header, static_cast<boost::uint32_t>(records.size()));
+		writeUInt32(header, 0);
+
+		std::string index;
+		boost::uint64_t offset = sHeaderSize + records.size() * sIndexRecordSize;
+		for (std::vector<IndexRecord>::const_iterator it = records.begin(); it != records.end(); ++it)
+		{
+			writeUInt64(index, it->mKey);
+			writeUInt64(index, offset);
+			writeUInt32(index, static_cast<boost::uint32_t>(it->mName->size()));
+			writeUInt32(index, static_cast<boost::uint32_t>(it->mData->size()));
+			offset += it->mName->size() + it->mData->size();
+		}
+
+		// write to a temporary file first, so that the archive is never left in a broken state
+		std::string temporaryPath = mPath + ".tmp";
+		{
+			std::ofstream file (temporaryPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+			file.write(header.data(), header.size());
+			file.write(index.data(), index.size());
+			for (std::vector<IndexRecord>::const_iterator it = records.begin(); it != records.end(); ++it)
+			{
+				file.write(it->mName->data(), it->mName->size());
+				file.write(it->mData->data(), it->mData->size());
+			}
+			if (!file)
+				throw std::runtime_error("failed to write " + temporaryPath);
+		}
+
+		// the file can't be replaced while it is mapped on some platforms
+		unmap();
+		boost::filesystem::rename(temporaryPath, mPath);
+		mJournalFile.reset();
+		boost::system::error_code ec;
+		boost::filesystem::remove(mJournalPath, ec);
+		mJournalSize = 0;
+		mJournal.clear();
+		map();
+	}
+
+	void CacheArchive::readJournal ()
+	{
+		boost::system::error_code ec;
+		boost::uintmax_t fileSize = boost::filesystem::file_size(mJournalPath, ec);
+		if (ec)
+			return;
+
+		{
+			std::ifstream file (mJournalPath.c_str(), std::ios::in | std::ios::binary);
+			if (!file.is_open())
+				return;
+
+			char header[16];
+			std::string name, data;
+			while (fileSize - mJournalSize >= sizeof(header) && file.read(header, sizeof(header)))
+			{
+				// check the sizes before allocating, a broken header may contain anything
+				boost::uintmax_t remaining = fileSize - mJournalSize - sizeof(header);
+				boost::uint32_t nameSize = readUInt32(header);
+				boost::uint32_t dataSize = readUInt32(header+4);
+				if (nameSize > remaining || dataSize > remaining - nameSize)
+					break;
+
+				name.resize(nameSize);
+				data.resize(dataSize);
+				if (!file.read(&name[0], name.size()) || !file.read(&data[0], data.size()))
+					break;
+				if (readUInt64(header+8) != getChecksum(name, data))
+					break;
+				mJournal[name] = data;
+				mJournalSize += sizeof(header) + nameSize + dataSize;
+			}
+		}
+
+		if (mJournalSize < fileSize)
+		{
+			std::cerr << "sh::CacheArchive: Discarding the incomplete end of " << mJournalPath << std::endl;
+			boost::filesystem::resize_file(mJournalPath, mJournalSize, ec);
+		}
+	}
+
+	void CacheArchive::appendToJournal (const std::string& name, const std::string& data)
+	{
+		std::string record;
+		writeUInt32(record, static_cast<boost::uint32_t>(name.size()));
+		writeUInt32(record, static_cast<boost::uint32_t>(data.size()));
+		writeUInt64(record, getChecksum(name, data));
+		record += name;
+		record += data;
+
+		if (!mJournalFile)
+			mJournalFile.reset(new std::ofstream(mJournalPath.c_str(), std::ios::out | std::ios::binary | std::ios::app));
+		mJournalFile->write(record.data(), record.size());
+		mJournalFile->flush();
+
+		if (*mJournalFile)
+			mJournalSize += record.size();
+		else
+		{
+			// remove what was written of the record, the next call opens the file again
+			mJournalFile.reset();
+			boost::system::error_code ec;
+			boost::filesystem::resize_file(mJournalPath, mJournalSize, ec);
+		}
+	}
+}
@@ -0,0 +1,110 @@
+#ifndef SH_CACHEARCHIVE_H
+#define SH_CACHEARCHIVE_H
+
+#include <string>
+#include <map>
+#include <iosfwd>
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace boost
+{
+	namespace interprocess
+	{
+		class file_mapping;
+		class mapped_region;
+	}
+}
+
+namespace sh
+{
+	/**
+	 * @brief A single file that stores named entries (e.g. generated shader sources), opened as a memory mapping.
+	 *
+	 * File layout (all integers little endian):
+	 * - header: magic "SHCA", version, entry count, reserved (4 bytes each)
+	 * - index: one record per entry, sorted by key: key (64 bit hash of the name), offset, name size, data size
+	 * - entries: name followed by data, at the offset given in the index
+	 *
+	 * A lookup is a binary search in the mapped index. New entries are appended to a journal file next to the archive,
+	 * and merged into the archive by \a compact (which the destructor calls). If the program does not shut down cleanly,
+	 * the journal is applied the next time the archive is opened.
+	 * @note All methods are thread safe.
+	 */
+	class CacheArchive
+	{
+	public:
+		typedef boost::function<bool (const std::string& name)> Predicate;
+
+		/// Open the archive at \a path, it is created once the first entry is written.
+		CacheArchive (const std::string& path);
+
+		/// @note compacts the archive
+		~CacheArchive ();
+
+		/// @return was an entry with this name found?
+		bool find (const std::string& name, std::string& data);
+
+		/// Add an entry or replace an existing one. The change is written to the journal immediately.
+		void insert (const std::string& name, const std::string& data);
+
+		/// Remove all entries, including the files.
+		void clear ();
+
+		/// Add all entries of \a other, replacing entries with the same name.
+		void merge (CacheArchive& other);
+
+		/// Rewrite the archive with all entries from the journal, then remove the journal.
+		void compact ();
+
+		/// Remove all entries for which \a remove returns true, e.g. those that are outdated. If there are any,
+		/// the archive is rewritten without them (and with the journal, like \a compact).
+		void removeIf (const Predicate& remove);
+
+		unsigned int getEntryCount ();
+
+	private:
+		typedef std::map<std::string, std::string> EntryMap;
+
+		std::string mPath;
+		std::string mJournalPath;
+
+		boost::mutex mMutex;
+
+		boost::scoped_ptr<boost::interprocess::file_mapping> mFile;
+		boost::scoped_ptr<boost::interprocess::mapped_region> mRegion;
+		const char* mData; ///< start of the mapped archive, NULL if there is none
+		boost::uint32_t mEntryCount; ///< number of entries in the mapped archive
+
+		EntryMap mJournal; ///< entries that were written since the archive was compacted
+		boost::scoped_ptr<std::ofstream> mJournalFile; ///< opened by the first appendToJournal
+		boost::uintmax_t mJournalSize; ///< size of the valid records in the journal file
+
+		void map ();
+		void unmap ();
+
+		/// @return index of the first index record with the given key or above
+		boost::uint32_t lowerBound (boost::uint64_t key) const;
+
+		/// Read the entry at the given position in the index of the mapped archive.
+		void getEntry (boost::uint32_t index, std::string& name, std::string& data) const;
+		void getEntryName (boost::uint32_t index, std::string& name) const;
+
+		/// Look up an entry in the mapped archive only, \a data may be NULL.
+		bool findInArchive (const std::string& name, std::string* data) const;
+
+		/// Write the entries of the mapped archive and the journal to the archive, except those for which \a remove
+		/// (if not NULL) returns true, then remove the journal. mMutex has to be locked.
+		void rewrite (const Predicate* remove);
+
+		/// Read all records of the journal file into mJournal, stops at the first incomplete record
+		/// and truncates the file there, so that new records are not appended after a broken one.
+		void readJournal ();
+		void appendToJournal (const std::string& name, const std::string& data);
+	};
+}
+
+#endif
@@ -2,20 +2,145 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <algorithm>
+#include <typeinfo>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
 
 #include "Platform.hpp"
 #include "ScriptLoader.hpp"
 #include "ShaderSet.hpp"
 #include "MaterialInstanceTextureUnit.hpp"
+#include "WorkQueue.hpp"
+#include "Preprocessor.hpp"
+#include "CacheArchive.hpp"
 
 namespace sh
 {
+	namespace
+	{
+		typedef std::map<std::string, std::string> ScriptProperties;
+
+		/// Collect the name & value pairs of the children of \a node, a later one with the same name wins like with setProperty
+		void readProperties (ScriptNode* node, ScriptProperties& out)
+		{
+			ScriptNodeList children = node->getChildren();
+			for (ScriptNodeList::const_iterator it = children.begin(); it != children.end(); ++it)
+				out[(*it)->getName()] = (*it)->getValue();
+		}
+
+		/// @return true if \a value is what makeProperty(text) would create, after it was converted to the type that it has now
+		bool sameValue (const PropertyValuePtr& value, const std::string& text)
+		{
+			const std::type_info& type = typeid(*value);
+			if (type == typeid(LinkedValue))
+				return text == "$" + value->_getStringValue();
+			if (type == typeid(StringValue))
+				return text == value->_getStringValue();
+
+			// the value was converted when it was retrieved, convert the text the same way
+			try
+			{
+				std::string serialized = value->serialize();
+				if (type == typeid(FloatValue))
+					return serialized == FloatValue(text).serialize();
+				if (type == typeid(IntValue))
+					return serialized == IntValue(text).serialize();
+				if (type == typeid(BooleanValue))
+					return serialized == BooleanValue(text).serialize();
+				if (type == typeid(Vector2))
+					return serialized == Vector2(text).serialize();
+				if (type == typeid(Vector3))
+					return serialized == Vector3(text).serialize();
+				if (type == typeid(Vector4))
+					return serialized == Vector4(text).serialize();
+				return serialized == text;
+			}
+			catch (std::exception&)
+			{
+				return false;
+			}
+		}
+
+		bool sameProperties (PropertySetGet& target, const ScriptProperties& properties)
+		{
+			const PropertyMap& current = target.listProperties();
+			if (current.size() != properties.size())
+				return false;
+			PropertyMap::const_iterator currentIt = current.begin();
+			for (ScriptProperties::const_iterator it = properties.begin(); it != properties.end(); ++it, ++currentIt)
+			{
+				if (it->first != currentIt->first || !sameValue(currentIt->second, it->second))
+					return false;
+			}
+			return true;
+		}
+
+		/// @return the canonical path of a file, which may not exist anymore
+		std::string canonicalPath (const std::string& file)
+		{
+			boost::system::error_code ec;
+			boost::filesystem::path path (file);
+			boost::filesystem::path canonical = boost::filesystem::canonical(path, ec);
+			if (!ec)
+				return canonical.string();
+			canonical = boost::filesystem::canonical(path.parent_path(), ec);
+			if (!ec)
+				return (canonical / path.filename()).string();
+			return file;
+		}
+
+		/// Replace all properties of \a target
+		void setProperties (PropertySetGet& target, const ScriptProperties& properties)
+		{
+			PropertyMap previous = target.listProperties();
+			for (PropertyMap::const_iterator it = previous.begin(); it != previous.end(); ++it)
+				target.deleteProperty(it->first);
+			for (ScriptProperties::const_iterator it = properties.begin(); it != properties.end(); ++it)
+				target.setProperty(it->first, makeProperty(it->second));
+		}
+
+		bool passChanged (MaterialInstancePass& pass, ScriptNode* node)
+		{
+			ScriptProperties properties;
+			ScriptProperties shaderProperties;
+			std::vector<ScriptNode*> textureUnits;
+			ScriptNodeList children = node->getChildren();
+			for (ScriptNodeList::const_iterator it = children.begin(); it != children.end(); ++it)
+			{
+				std::string name = (*it)->getName();
+				if (name == "shader_properties")
+					readProperties(*it, shaderProperties);
+				else if (name == "texture_unit")
+					textureUnits.push_back(*it);
+				else
+					properties[name] = (*it)->getValue();
+			}
+
+			if (!sameProperties(pass, properties) || !sameProperties(pass.mShaderProperties, shaderProperties)
+					|| textureUnits.size() != pass.mTexUnits.size())
+				return true;
+
+			for (size_t i=0; i<textureUnits.size(); ++i)
+			{
+				ScriptProperties unitProperties;
+				readProperties(textureUnits[i], unitProperties);
+				if (pass.mTexUnits[i].getName() != textureUnits[i]->getValue() || !sameProperties(pass.mTexUnits[i], unitProperties))
+					return true;
+			}
+			return false;
+		}
+	}
+
 	Factory* Factory::sThis = 0;
 	const std::string Factory::mBinaryCacheName = "binaryCache";
+	const std::string Factory::mContentHashesName = "contentHashes.txt";
+	const std::string Factory::mSourceCacheName = "sourceCache";
+	const std::string Factory::mFailedPermutationCacheName = "failedPermutations";
+	const std::string Factory::mScriptSnapshotName = "scriptSnapshot";
 
 	Factory& Factory::getInstance()
 	{
@@ -32,56 +157,59 @@ namespace sh
 		: mPlatform(platform)
 		, mShadersEnabled(true)
 		, mShaderDebugOutputEnabled(false)
-		, mCurrentLanguage(Language_None)
-		, mListener(NULL)
-		, mCurrentConfiguration(NULL)
-		, mCurrentLodConfiguration(NULL)
+		, mPreprocessorBackend(PreprocessorBackend_Wave)
 		, mReadMicrocodeCache(false)
 		, mWriteMicrocodeCache(false)
 		, mReadSourceCache(false)
 		, mWriteSourceCache(false)
+		, mSourceCache(NULL)
+		, mFailedPermutationCache(NULL)
+		, mReadScriptSnapshot(false)
+		, mWriteScriptSnapshot(false)
+		, mScriptSnapshot(NULL)
+		, mFileWatcherBackend(FileWatcherBackend_Native)
+		, mFileWatcher(NULL)
+		, mCheckAllShaderFiles(false)
+		, mCheckAllScriptFiles(false)
+		, mCurrentConfiguration(NULL)
+		, mCurrentLodConfiguration(NULL)
+		, mCurrentLanguage(Language_None)
+		, mListener(NULL)
+		, mHitchThreshold(0)
+		, mHitchListener(NULL)
+		, mCurrentHitchReport(NULL)
+		, mNextHitchReport(0)
+		, mHitchBufferSize(64)
+		, mAsyncMaterialCreation(false)
+		, mBackgroundQueue(NULL)
+		, mRecheckPendingMaterials(false)
+		, mLazyMaterialLoading(false)
 	{
 		assert (!sThis);
 		sThis = this;
 
+		mStatistics.setTracer(&mTracer);
 		mPlatform->setFactory(this);
 	}
 
 	void Factory::loadAllFiles()
 	{
 		assert(mCurrentLanguage != Language_None);
+		TraceScope trace (&mTracer, "loadAllFiles");
 
-		try
-		{
-			if (boost::filesystem::exists (mPlatform->getCacheFolder () + "/lastModified.txt"))
-			{
-				std::ifstream file;
-				file.open(std::string(mPlatform->getCacheFolder () + "/lastModified.txt").c_str());
-
-				std::string line;
-				while (getline(file, line))
-				{
-					std::string sourceFile = line;
+		loadContentHashes();
 
-					if (!getline(file, line))
-						assert(0);
-
-					int modified = boost::lexical_cast<int>(line);
-
-					mShadersLastModified[sourceFile] = modified;
-				}
-			}
-		}
-		catch (std::exception& e)
-		{
-			std::cerr << "Failed to load shader modification index: " << e.what() << std::endl;
-			mShadersLastModified.clear();
-		}
+		if ((mReadSourceCache || mWriteSourceCache) && !mSourceCache)
+			mSourceCache = new CacheArchive(mPlatform->getCacheFolder () + "/" + mSourceCacheName);
+		if ((mReadMicrocodeCache || mWriteMicrocodeCache) && !mFailedPermutationCache)
+			mFailedPermutationCache = new CacheArchive(mPlatform->getCacheFolder () + "/" + mFailedPermutationCacheName);
+		if ((mReadScriptSnapshot || mWriteScriptSnapshot) && !mScriptSnapshot)
+			mScriptSnapshot = new CacheArchive(mPlatform->getCacheFolder () + "/" + mScriptSnapshotName);
 
 		// load configurations
 		{
 			ScriptLoader shaderSetLoader(".configuration");
-			ScriptLoader::loadAllFiles (&shaderSetLoader, mPlatform->getBasePath());
+			loadScripts(shaderSetLoader);
 			std::map <std::string, ScriptNode*> nodes = shaderSetLoader.getAllConfigScripts();
 			for (std::map <std::string, ScriptNode*>::const_iterator it = nodes.begin();
 				it != nodes.end(); ++it)
@@ -94,10 +222,10 @@ namespace sh
 
 				Configuration newConfiguration;
 				newConfiguration.setParent(&mGlobalSettings);
-				newConfiguration.setSourceFile (it->second->mFileName);
+				newConfiguration.setSourceFile (it->second->getFileName());
 
-				std::vector<ScriptNode*> props = it->second->getChildren();
-				for (std::vector<ScriptNode*>::const_iterator propIt = props.begin(); propIt != props.end(); ++propIt)
+				ScriptNodeList props = it->second->getChildren();
+				for (ScriptNodeList::const_iterator propIt = props.begin(); propIt != props.end(); ++propIt)
 				{
 					std::string name = (*propIt)->getName();
 					std::string val = (*propIt)->getValue();
@@ -112,7 +240,7 @@ namespace sh
 		// load lod configurations
 		{
 			ScriptLoader lodLoader(".lod");
-			ScriptLoader::loadAllFiles (&lodLoader, mPlatform->getBasePath());
+			loadScripts(lodLoader);
 			std::map <std::string, ScriptNode*> nodes = lodLoader.getAllConfigScripts();
 			for (std::map <std::string, ScriptNode*>::const_iterator it = nodes.begin();
 				it != nodes.end(); ++it)
@@ -130,8 +258,8 @@ namespace sh
 
 				PropertySetGet newLod;
 
-				std::vector<ScriptNode*> props = it->second->getChildren();
-				for (std::vector<ScriptNode*>::const_iterator propIt = props.begin(); propIt != props.end(); ++propIt)
+				ScriptNodeList props = it->second->getChildren();
+				for (ScriptNodeList::const_iterator propIt = props.begin(); propIt != props.end(); ++propIt)
 				{
 					std::string name = (*propIt)->getName();
 					std::string val = (*propIt)->getValue();
@@ -139,7 +267,9 @@ namespace sh
 					newLod.setProperty (name, makeProperty(val));
 				}
 
-				mLodConfigurations[boost::lexical_cast<int>(it->first)] = newLod;
+				int index = boost::lexical_cast<int>(it->first);
+				mLodConfigurations[index] = newLod;
+				mLodSourceFiles[index] = it->second->getFileName();
 			}
 		}
 
@@ -149,7 +279,9 @@ namespace sh
 		// load materials
 		{
 			ScriptLoader materialLoader(".mat");
-			ScriptLoader::loadAllFiles (&materialLoader, mPlatform->getBasePath());
+			loadScripts(materialLoader);
+			mMaterialIndex.clear();
+			mMaterialFiles.clear();
 
 			std::map <std::string, ScriptNode*> nodes = materialLoader.getAllConfigScripts();
 			for (std::map <std::string, ScriptNode*>::const_iterator it = nodes.begin();
@@ -161,109 +293,286 @@ namespace sh
 					break;
 				}
 
-				MaterialInstance newInstance(it->first, this);
-				newInstance.create(mPlatform);
-				if (!mShadersEnabled)
-					newInstance.setShadersEnabled (false);
+				// with lazy loading, only the location is remembered
+				if (mLazyMaterialLoading && !it->second->findChild("create_configuration"))
+				{
+					MaterialLocation location;
+					location.mFile = &*mMaterialFiles.insert(it->second->getFileName()).first;
+					location.mOffset = it->second->getOffset();
+					mMaterialIndex.insert (std::make_pair(it->first, location));
+				}
+				else
+					addMaterial (it->first, it->second);
+			}
+
+			// now that all materials are loaded, replace the parent names with the actual pointers to parent
+			for (MaterialMap::iterator it = mMaterials.begin(); it != mMaterials.end(); ++it)
+				resolveParent (&it->second);
+		}
+
+		if (mPlatform->supportsShaderSerialization () && mReadMicrocodeCache && !removeBinaryCache)
+		{
+			std::string file = mPlatform->getCacheFolder () + "/" + mBinaryCacheName;
+			if (boost::filesystem::exists(file))
+			{
+				mPlatform->deserializeShaders (file);
+			}
+		}
+	}
 
-				newInstance.setSourceFile (it->second->mFileName);
+	MaterialInstance* Factory::addMaterial (const std::string& materialName, ScriptNode* node)
+	{
+		MaterialInstance newInstance(materialName, this);
+		newInstance.create(mPlatform);
+		if (!mShadersEnabled)
+			newInstance.setShadersEnabled (false);
 
-				std::vector<ScriptNode*> props = it->second->getChildren();
-				for (std::vector<ScriptNode*>::const_iterator propIt = props.begin(); propIt != props.end(); ++propIt)
-				{
-					std::string name = (*propIt)->getName();
+		newInstance.setSourceFile (node->getFileName());
 
-					std::string val = (*propIt)->getValue();
+		readMaterial (&newInstance, node);
+
+		if (newInstance.hasProperty("create_configuration"))
+		{
+			std::string config = retrieveValue<StringValue>(newInstance.getProperty("create_configuration"), NULL).get();
+			newInstance.createForConfiguration (config, 0);
+		}
 
-					if (name == "pass")
+		return &mMaterials.insert (std::make_pair(materialName, newInstance)).first->second;
+	}
+
+	void Factory::readMaterial (MaterialInstance* m, ScriptNode* node)
+	{
+		ScriptNodeList props = node->getChildren();
+		for (ScriptNodeList::const_iterator propIt = props.begin(); propIt != props.end(); ++propIt)
+		{
+			std::string name = (*propIt)->getName();
+
+			std::string val = (*propIt)->getValue();
+
+			if (name == "pass")
+			{
+				MaterialInstancePass* newPass = m->createPass();
+				ScriptNodeList props2 = (*propIt)->getChildren();
+				for (ScriptNodeList::const_iterator propIt2 = props2.begin(); propIt2 != props2.end(); ++propIt2)
+				{
+					std::string name2 = (*propIt2)->getName();
+					std::string val2 = (*propIt2)->getValue();
+
+					if (name2 == "shader_properties")
+					{
+						ScriptNodeList shaderProps = (*propIt2)->getChildren();
+						for (ScriptNodeList::const_iterator shaderPropIt = shaderProps.begin(); shaderPropIt != shaderProps.end(); ++shaderPropIt)
+						{
+							std::string val = (*shaderPropIt)->getValue();
+							newPass->mShaderProperties.setProperty((*shaderPropIt)->getName(), makeProperty(val));
+						}
+					}
+					else if (name2 == "texture_unit")
 					{
-						MaterialInstancePass* newPass = newInstance.createPass();
-						std::vector<ScriptNode*> props2 = (*propIt)->getChildren();
-						for (std::vector<ScriptNode*>::const_iterator propIt2 = props2.begin(); propIt2 != props2.end(); ++propIt2)
+						MaterialInstanceTextureUnit* newTex = newPass->createTextureUnit(val2);
+						ScriptNodeList texProps = (*propIt2)->getChildren();
+						for (ScriptNodeList::const_iterator texPropIt = texProps.begin(); texPropIt != texProps.end(); ++texPropIt)
 						{
-							std::string name2 = (*propIt2)->getName();
-							std::string val2 = (*propIt2)->getValue();
-
-							if (name2 == "shader_properties")
-							{
-								std::vector<ScriptNode*> shaderProps = (*propIt2)->getChildren();
-								for (std::vector<ScriptNode*>::const_iterator shaderPropIt = shaderProps.begin(); shaderPropIt != shaderProps.end(); ++shaderPropIt)
-								{
-									std::string val = (*shaderPropIt)->getValue();
-									newPass->mShaderProperties.setProperty((*shaderPropIt)->getName(), makeProperty(val));
-								}
-							}
-							else if (name2 == "texture_unit")
-							{
-								MaterialInstanceTextureUnit* newTex = newPass->createTextureUnit(val2);
-								std::vector<ScriptNode*> texProps = (*propIt2)->getChildren();
-								for (std::vector<ScriptNode*>::const_iterator texPropIt = texProps.begin(); texPropIt != texProps.end(); ++texPropIt)
-								{
-									std::string val = (*texPropIt)->getValue();
-									newTex->setProperty((*texPropIt)->getName(), makeProperty(val));
-								}
-							}
-							else
-								newPass->setProperty((*propIt2)->getName(), makeProperty(val2));
+							std::string val = (*texPropIt)->getValue();
+							newTex->setProperty((*texPropIt)->getName(), makeProperty(val));
 						}
 					}
-					else if (name == "parent")
-						newInstance.setParentInstance(val);
 					else
-						newInstance.setProperty((*propIt)->getName(), makeProperty(val));
+						newPass->setProperty((*propIt2)->getName(), makeProperty(val2));
 				}
+			}
+			else if (name == "parent")
+				m->setParentInstance(val);
+			else
+				m->setProperty((*propIt)->getName(), makeProperty(val));
+		}
+	}
 
-				if (newInstance.hasProperty("create_configuration"))
-				{
-					std::string config = retrieveValue<StringValue>(newInstance.getProperty("create_configuration"), NULL).get();
-					newInstance.createForConfiguration (config, 0);
-				}
+	void Factory::resolveParent (MaterialInstance* m)
+	{
+		std::string parent = m->getParentInstance();
+		if (parent != "")
+		{
+			MaterialInstance* parentInstance = searchInstance (parent);
+			if (!parentInstance)
+				throw std::runtime_error ("Unable to find parent for material instance \"" + m->getName() + "\"");
+			m->setParent(parentInstance);
+		}
+	}
+
+	MaterialInstance* Factory::loadIndexedMaterial (MaterialIndex::iterator it)
+	{
+		std::string name = it->first;
+		std::string file = *it->second.mFile;
+		size_t offset = it->second.mOffset;
+		mMaterialIndex.erase(it);
+
+		TraceScope trace (&mTracer, "loadMaterial");
+		trace.addArgument("material", name);
+
+		ScriptLoader nodeLoader(".mat");
+		ScriptNode* node = nodeLoader.parseNode(file, offset);
+
+		ScriptLoader fileLoader(".mat");
+		if (!node || node->getName() != "material" || node->getValue() != name)
+		{
+			// the file was changed since it was indexed
+			fileLoader.mCurrentFileName = file;
+			fileLoader.parseFile(file);
+			node = fileLoader.getConfigScript(name);
+		}
+		if (!node)
+		{
+			std::string message = "Material \"" + name + "\" was not found in " + file;
+			std::cerr << "sh::Factory: " << message << std::endl;
+			logError(message);
+			return NULL;
+		}
+
+		// the material has to be in the map before its parents are loaded, in case they refer back to it
+		MaterialInstance* m = addMaterial (name, node);
+		resolveParent (m);
+		return m;
+	}
+
+	void Factory::setLazyMaterialLoading (bool enabled)
+	{
+		if (enabled && !mPlatform->supportsMaterialLookup())
+			throw std::runtime_error ("Lazy material loading not supported by this platform");
+		mLazyMaterialLoading = enabled;
+	}
+
+	void Factory::loadAllMaterials ()
+	{
+		TraceScope trace (&mTracer, "loadAllMaterials");
+
+		// parse every file once, instead of once for every material in it
+		typedef std::map<const std::string*, std::vector<MaterialIndex::iterator> > FileMap;
+		FileMap files;
+		for (MaterialIndex::iterator it = mMaterialIndex.begin(); it != mMaterialIndex.end(); ++it)
+			files[it->second.mFile].push_back(it);
 
-				mMaterials.insert (std::make_pair(it->first, newInstance));
+		std::vector<MaterialInstance*> created;
+		for (FileMap::iterator fileIt = files.begin(); fileIt != files.end(); ++fileIt)
+		{
+			ScriptLoader loader(".mat");
+			loader.mCurrentFileName = *fileIt->first;
+			loader.parseFile(loader.mCurrentFileName);
+			for (std::vector<MaterialIndex::iterator>::iterator it = fileIt->second.begin(); it != fileIt->second.end(); ++it)
+			{
+				ScriptNode* node = loader.getConfigScript((*it)->first);
+				if (!node || node->getName() != "material" || node->getOffset() != (*it)->second.mOffset)
+					continue; // the file was changed since it was indexed, loadIndexedMaterial will handle it
+				created.push_back(addMaterial ((*it)->first, node));
+				mMaterialIndex.erase(*it);
 			}
+		}
 
-			// now that all materials are loaded, replace the parent names with the actual pointers to parent
-			for (MaterialMap::iterator it = mMaterials.begin(); it != mMaterials.end(); ++it)
+		for (std::vector<MaterialInstance*>::iterator it = created.begin(); it != created.end(); ++it)
+			resolveParent (*it);
+
+		while (!mMaterialIndex.empty())
+			loadIndexedMaterial (mMaterialIndex.begin());
+	}
+
+	void Factory::precompile (const std::vector<std::string>& configurations, const std::vector<int>& lodLevels, unsigned int threadCount)
+	{
+		loadAllMaterials();
+
+		// collect the permutations on this thread, since this has to access the (shared) property sets
+		std::vector<PendingShaderInstancePtr> pending;
+		for (std::vector<std::string>::const_iterator configIt = configurations.begin(); configIt != configurations.end(); ++configIt)
+		{
+			if (!mPlatform->isDefaultMaterialSchemeName(*configIt) && mConfigurations.find(*configIt) == mConfigurations.end())
+			{
+				std::cerr << "sh::Factory: Warning: Can't precompile unknown configuration \"" << *configIt << "\"" << std::endl;
+				continue;
+			}
+			for (std::vector<int>::const_iterator lodIt = lodLevels.begin(); lodIt != lodLevels.end(); ++lodIt)
 			{
-				std::string parent = it->second.getParentInstance();
-				if (parent != "")
+				if (*lodIt != 0 && mLodConfigurations.find(*lodIt) == mLodConfigurations.end())
+					continue;
+
+				for (MaterialMap::iterator it = mMaterials.begin(); it != mMaterials.end(); ++it)
 				{
-					if (mMaterials.find (it->second.getParentInstance()) == mMaterials.end())
-						throw std::runtime_error ("Unable to find parent for material instance \"" + it->first + "\"");
-					it->second.setParent(&mMaterials.find(parent)->second);
+					try
+					{
+						it->second.queueShaders (*configIt, *lodIt, pending);
+					}
+					catch (std::exception& e)
+					{
+						std::stringstream msg;
+						msg << "Error while precompiling material " << it->first << " (configuration " << *configIt
+							<< ", lod level " << *lodIt << "): " << e.what();
+						std::cerr << msg.str() << std::endl;
+						logError(msg.str());
+					}
 				}
 			}
 		}
 
-		if (mPlatform->supportsShaderSerialization () && mReadMicrocodeCache && !removeBinaryCache)
 		{
-			std::string file = mPlatform->getCacheFolder () + "/" + mBinaryCacheName;
-			if (boost::filesystem::exists(file))
-			{
-				mPlatform->deserializeShaders (file);
-			}
+			WorkQueue workers (threadCount);
+			for (std::vector<PendingShaderInstancePtr>::iterator it = pending.begin(); it != pending.end(); ++it)
+				workers.push (boost::bind(&PendingShaderInstance::generate, *it));
+			workers.wait();
 		}
+
+		// creating the GPU programs has to happen on this thread
+		for (std::vector<PendingShaderInstancePtr>::iterator it = pending.begin(); it != pending.end(); ++it)
+			(*it)->mSet->finishInstance(*it);
 	}
 
 	Factory::~Factory ()
 	{
+		// make sure no background jobs are using the shader sets anymore
+		delete mBackgroundQueue;
+		mBackgroundQueue = NULL;
+
+		delete mFileWatcher;
+		mFileWatcher = NULL;
+
+		// the entries are named by content hash, so old entries would stay forever otherwise
+		if (!mShaderSets.empty())
+		{
+			try
+			{
+				if (mSourceCache)
+					mSourceCache->removeIf(boost::bind(&Factory::isOutdatedCacheEntry, this, _1));
+				if (mFailedPermutationCache)
+					mFailedPermutationCache->removeIf(boost::bind(&Factory::isOutdatedCacheEntry, this, _1));
+			}
+			catch (std::exception& e)
+			{
+				std::cerr << "sh::Factory: Failed to remove outdated cache entries: " << e.what() << std::endl;
+			}
+		}
+
 		mShaderSets.clear();
 
+		// merges the entries that were written in this run into the archives
+		delete mSourceCache;
+		mSourceCache = NULL;
+		delete mFailedPermutationCache;
+		mFailedPermutationCache = NULL;
+		delete mScriptSnapshot;
+		mScriptSnapshot = NULL;
+
 		if (mPlatform->supportsShaderSerialization () && mWriteMicrocodeCache)
 		{
 			std::string file = mPlatform->getCacheFolder () + "/" + mBinaryCacheName;
 			mPlatform->serializeShaders (file);
 		}
 
-		if (mReadSourceCache)
+		if (mReadMicrocodeCache || mWriteMicrocodeCache)
 		{
-			// save the last modified time of shader sources (as of when they were loaded)
+			// save the content hashes of the shader sets, so that the next run knows if the microcode cache is still valid
 			std::ofstream file;
-			file.open(std::string(mPlatform->getCacheFolder () + "/lastModified.txt").c_str());
+			file.open(std::string(mPlatform->getCacheFolder () + "/" + mContentHashesName).c_str());
 
-			for (LastModifiedMap::const_iterator it = mShadersLastModifiedNew.begin(); it != mShadersLastModifiedNew.end(); ++it)
+			for (ContentHashMap::const_iterator it = mShaderContentHashes.begin(); it != mShaderContentHashes.end(); ++it)
 			{
-				file << it->first << "\n" << it->second << std::endl;
+				file << it->first << "\n" << std::hex << it->second << std::dec << std::endl;
 			}
 
 			file.close();
@@ -273,13 +582,25 @@ namespace sh
 		sThis = 0;
 	}
 
+	bool Factory::isOutdatedCacheEntry (const std::string& name) const
+	{
+		ShaderSetMap::const_iterator it = mShaderSets.find(name.substr(0, name.find('\n')));
+		if (it == mShaderSets.end())
+			return true;
+		std::string prefix = it->second.getCacheNamePrefix();
+		return name.compare(0, prefix.size(), prefix) != 0;
+	}
+
 	MaterialInstance* Factory::searchInstance (const std::string& name)
 	{
 		MaterialMap::iterator it = mMaterials.find(name);
 		if (it != mMaterials.end())
 			return &(it->second);
-		else
-			return NULL;
+
+		MaterialIndex::iterator indexed = mMaterialIndex.find(name);
+		if (indexed != mMaterialIndex.end())
+			return loadIndexedMaterial (indexed);
+		return NULL;
 	}
 
 	MaterialInstance* Factory::findInstance (const std::string& name)
@@ -290,6 +611,47 @@ namespace sh
 	}
 
 	MaterialInstance* Factory::requestMaterial (const std::string& name, const std::string& configuration, unsigned short lodIndex)
+	{
+		TraceScope trace (&mTracer, "requestMaterial");
+		trace.addArgument("material", name);
+		trace.addArgument("configuration", configuration);
+		trace.addArgument("lod", lodIndex);
+
+		if (mHitchThreshold <= 0)
+			return findOrCreateMaterial (name, configuration, lodIndex);
+
+		HitchReport report;
+		report.mMaterial = name;
+		report.mConfiguration = configuration;
+		report.mLodIndex = lodIndex;
+
+		// requests can be nested, e.g. by a material listener
+		HitchReport* previousReport = mCurrentHitchReport;
+		mCurrentHitchReport = &report;
+		boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
+		MaterialInstance* m;
+		try
+		{
+			m = findOrCreateMaterial (name, configuration, lodIndex);
+		}
+		catch (...)
+		{
+			mCurrentHitchReport = previousReport;
+			throw;
+		}
+		mCurrentHitchReport = previousReport;
+
+		report.mTime = boost::chrono::duration<float, boost::milli>(boost::chrono::steady_clock::now() - start).count();
+		if (report.mTime > mHitchThreshold)
+		{
+			addHitchReport (report);
+			if (mHitchListener)
+				mHitchListener->hitchDetected (report);
+		}
+		return m;
+	}
+
+	MaterialInstance* Factory::findOrCreateMaterial (const std::string& name, const std::string& configuration, unsigned short lodIndex)
 	{
 		MaterialInstance* m = searchInstance (name);
 
@@ -297,40 +659,185 @@ namespace sh
 			return NULL;
 		if (m)
 		{
-			if (m->createForConfiguration (configuration, 0))
+			// if the shaders are still being generated, the platform will render a placeholder for now
+			if (mAsyncMaterialCreation && !queueMaterial (m, configuration))
+				return m;
+
+			if (!createMaterial (m, configuration))
+				return NULL;
+		}
+		return m;
+	}
+
+	bool Factory::createMaterial (MaterialInstance* m, const std::string& configuration)
+	{
+		HitchReport* report = mCurrentHitchReport;
+		if (m->createForConfiguration (configuration, 0))
+		{
+			if (report)
+				report->mCreatedLodLevels.push_back(0);
+			if (mListener)
+				mListener->materialCreated (m, configuration, 0);
+		}
+		else
+			return false;
+
+		for (LodConfigurationMap::iterator it = mLodConfigurations.begin(); it != mLodConfigurations.end(); ++it)
+		{
+			if (m->createForConfiguration (configuration, it->first))
 			{
+				if (report)
+					report->mCreatedLodLevels.push_back(it->first);
 				if (mListener)
-					mListener->materialCreated (m, configuration, 0);
+					mListener->materialCreated (m, configuration, it->first);
 			}
 			else
-				return NULL;
+				return false;
+		}
+		return true;
+	}
 
+	bool Factory::queueMaterial (MaterialInstance* m, const std::string& configuration)
+	{
+		std::pair<std::string, std::string> key (m->getName(), configuration);
+		if (mPendingMaterials.find(key) != mPendingMaterials.end())
+			return false;
+
+		std::vector<PendingShaderInstancePtr> pending;
+		bool ready = true;
+		bool failed = false;
+		try
+		{
+			ready = m->queueShaders (configuration, 0, pending) && ready;
 			for (LodConfigurationMap::iterator it = mLodConfigurations.begin(); it != mLodConfigurations.end(); ++it)
+				ready = m->queueShaders (configuration, it->first, pending) && ready;
+		}
+		catch (std::exception&)
+		{
+			failed = true;
+		}
+
+		for (std::vector<PendingShaderInstancePtr>::iterator it = pending.begin(); it != pending.end(); ++it)
+			mBackgroundQueue->push (boost::bind(&Factory::generateInBackground, this, *it));
+
+		// if something went wrong, create synchronously so that the error is reported as usual
+		if (failed)
+			return true;
+
+		if (!ready)
+			mPendingMaterials.insert(key);
+		return ready;
+	}
+
+	void Factory::generateInBackground (PendingShaderInstancePtr pending)
+	{
+		pending->generate();
+
+		boost::mutex::scoped_lock lock(mFinishedShadersMutex);
+		mFinishedShaders.push_back(pending);
+	}
+
+	void Factory::processPendingMaterials ()
+	{
+		std::vector<PendingShaderInstancePtr> finished;
+		{
+			boost::mutex::scoped_lock lock(mFinishedShadersMutex);
+			finished.swap(mFinishedShaders);
+		}
+
+		for (std::vector<PendingShaderInstancePtr>::iterator it = finished.begin(); it != finished.end(); ++it)
+			(*it)->mSet->finishInstance(*it);
+
+		// nothing changed for the waiting materials
+		if (finished.empty() && !mRecheckPendingMaterials)
+			return;
+		mRecheckPendingMaterials = false;
+
+		PendingMaterialSet materials;
+		materials.swap(mPendingMaterials);
+		for (PendingMaterialSet::iterator it = materials.begin(); it != materials.end(); ++it)
+		{
+			MaterialInstance* m = searchInstance (it->first);
+			if (!m)
+				continue; // destroyed in the meantime
+
+			// will be put back into mPendingMaterials if it is still waiting for some shaders
+			if (queueMaterial (m, it->second))
+				createMaterial (m, it->second);
+		}
+	}
+
+	void Factory::discardPendingShaders (const std::set<const ShaderSet*>* shaderSets)
+	{
+		if (!mBackgroundQueue)
+			return;
+		mBackgroundQueue->wait();
+
+		boost::mutex::scoped_lock lock(mFinishedShadersMutex);
+		std::vector<PendingShaderInstancePtr> kept;
+		for (std::vector<PendingShaderInstancePtr>::iterator it = mFinishedShaders.begin(); it != mFinishedShaders.end(); ++it)
+		{
+			if (shaderSets && shaderSets->find((*it)->mSet) == shaderSets->end())
+				kept.push_back(*it);
+			else
+				(*it)->mSet->discardInstance(*it);
+		}
+		mFinishedShaders.swap(kept);
+
+		// the waiting materials have to queue their shaders again
+		mRecheckPendingMaterials = true;
+	}
+
+	void Factory::setAsyncMaterialCreation (bool enabled, unsigned int threadCount)
+	{
+		if (!enabled)
+		{
+			// create whatever is still waiting
+			discardPendingShaders();
+			delete mBackgroundQueue;
+			mBackgroundQueue = NULL;
+
+			mAsyncMaterialCreation = false;
+			PendingMaterialSet materials;
+			materials.swap(mPendingMaterials);
+			for (PendingMaterialSet::iterator it = materials.begin(); it != materials.end(); ++it)
 			{
-				if (m->createForConfiguration (configuration, it->first))
-				{
-					if (mListener)
-						mListener->materialCreated (m, configuration, it->first);
-				}
-				else
-					return NULL;
+				MaterialInstance* m = searchInstance (it->first);
+				if (m)
+					createMaterial (m, it->second);
 			}
+			return;
 		}
-		return m;
+
+		if (mBackgroundQueue && threadCount != 0 && mBackgroundQueue->getThreadCount() != threadCount)
+		{
+			discardPendingShaders();
+			delete mBackgroundQueue;
+			mBackgroundQueue = NULL;
+		}
+		if (!mBackgroundQueue)
+			mBackgroundQueue = new WorkQueue(threadCount);
+		mAsyncMaterialCreation = true;
 	}
 
 	MaterialInstance* Factory::createMaterialInstance (const std::string& name, const std::string& parentInstance)
 	{
-		if (parentInstance != "" && mMaterials.find(parentInstance) == mMaterials.end())
+		MaterialInstance* parent = (parentInstance != "") ? searchInstance(parentInstance) : NULL;
+		if (parentInstance != "" && !parent)
 			throw std::runtime_error ("trying to clone material that does not exist");
 
+		// an existing material is kept (see mMaterials.insert below), so an indexed one has to be loaded first
+		MaterialIndex::iterator indexed = mMaterialIndex.find(name);
+		if (indexed != mMaterialIndex.end())
+			loadIndexedMaterial (indexed);
+
 		MaterialInstance newInstance(name, this);
 
 		if (!mShadersEnabled)
 			newInstance.setShadersEnabled(false);
 
-		if (parentInstance != "")
-			newInstance.setParent (&mMaterials.find(parentInstance)->second);
+		if (parent)
+			newInstance.setParent (parent);
 
 		newInstance.create(mPlatform);
 
@@ -343,6 +850,7 @@ namespace sh
 	{
 		if (mMaterials.find(name) != mMaterials.end())
 			mMaterials.erase(name);
+		mMaterialIndex.erase(name);
 	}
 
 	void Factory::setShadersEnabled (bool enabled)
@@ -509,6 +1017,11 @@ namespace sh
 		mShaderDebugOutputEnabled = enabled;
 	}
 
+	void Factory::setPreprocessorBackend (PreprocessorBackend backend)
+	{
+		mPreprocessorBackend = backend;
+	}
+
 	PropertySetGet* Factory::getCurrentGlobalSettings()
 	{
 		PropertySetGet* p = &mGlobalSettings;
@@ -531,6 +1044,9 @@ namespace sh
 
 	void Factory::saveAll ()
 	{
+		// every material of a file has to be written
+		loadAllMaterials();
+
 		std::map<std::string, std::ofstream*> files;
 		for (MaterialMap::iterator it = mMaterials.begin(); it != mMaterials.end(); ++it)
 		{
@@ -576,10 +1092,17 @@ namespace sh
 
 	void Factory::listMaterials(std::vector<std::string> &out)
 	{
+		size_t first = out.size();
 		for (MaterialMap::iterator it = mMaterials.begin(); it != mMaterials.end(); ++it)
 		{
 			out.push_back(it->first);
 		}
+
+		// the materials that were not created yet, keep the result sorted by name
+		size_t middle = out.size();
+		for (MaterialIndex::iterator it = mMaterialIndex.begin(); it != mMaterialIndex.end(); ++it)
+			out.push_back(it->first);
+		std::inplace_merge(out.begin() + first, out.begin() + middle, out.end());
 	}
 
 	void Factory::listGlobalSettings(std::map<std::string, std::string> &out)
@@ -631,54 +1154,110 @@ namespace sh
 		}
    	}
 
-	bool Factory::removeCache(const std::string& pattern)
+	void Factory::setHitchBufferSize (unsigned int size)
+	{
+		std::vector<HitchReport> reports = getHitchReports();
+		if (reports.size() > size)
+			reports.erase(reports.begin(), reports.end() - size);
+
+		boost::mutex::scoped_lock lock(mHitchReportsMutex);
+		mHitchReports.swap(reports);
+		mNextHitchReport = 0;
+		mHitchBufferSize = size;
+	}
+
+	std::vector<HitchReport> Factory::getHitchReports ()
 	{
-		bool ret = false;
-		if ( boost::filesystem::exists(mPlatform->getCacheFolder())
-			 && boost::filesystem::is_directory(mPlatform->getCacheFolder()))
+		boost::mutex::scoped_lock lock(mHitchReportsMutex);
+		std::vector<HitchReport> result (mHitchReports.begin() + mNextHitchReport, mHitchReports.end());
+		result.insert(result.end(), mHitchReports.begin(), mHitchReports.begin() + mNextHitchReport);
+		return result;
+	}
+
+	void Factory::clearHitchReports ()
+	{
+		boost::mutex::scoped_lock lock(mHitchReportsMutex);
+		mHitchReports.clear();
+		mNextHitchReport = 0;
+	}
+
+	void Factory::addHitchReport (const HitchReport& report)
+	{
+		boost::mutex::scoped_lock lock(mHitchReportsMutex);
+		if (mHitchBufferSize == 0)
+			return;
+		if (mHitchReports.size() < mHitchBufferSize)
+			mHitchReports.push_back(report);
+		else
 		{
-			boost::filesystem::directory_iterator end_iter;
-			for( boost::filesystem::directory_iterator dir_iter(mPlatform->getCacheFolder()) ; dir_iter != end_iter ; ++dir_iter)
-			{
-				if (boost::filesystem::is_regular_file(dir_iter->status()) )
-				{
-					boost::filesystem::path file = dir_iter->path();
+			mHitchReports[mNextHitchReport] = report;
+			mNextHitchReport = (mNextHitchReport + 1) % mHitchReports.size();
+		}
+	}
 
-					std::string pathname = file.filename().string();
+	void Factory::startTrace (const std::string& file)
+	{
+		mTracer.start(file);
+	}
 
-					// get first part of filename, e.g. main_fragment_546457654 -> main_fragment
-					// there is probably a better method for this...
-					std::vector<std::string> tokens;
-					boost::split(tokens, pathname, boost::is_any_of("_"));
-					tokens.erase(--tokens.end());
-					std::string shaderName;
-					for (std::vector<std::string>::const_iterator vector_iter = tokens.begin(); vector_iter != tokens.end();)
-					{
-						shaderName += *(vector_iter++);
-						if (vector_iter != tokens.end())
-							shaderName += "_";
-					}
+	void Factory::stopTrace ()
+	{
+		mTracer.stop();
+	}
 
-					if (shaderName == pattern)
-					{
-						boost::filesystem::remove(file);
-						ret = true;
-						std::cout << "Removing outdated shader: " << file << std::endl;
-					}
-				}
+	void Factory::loadScripts (ScriptLoader& loader)
+	{
+		StatisticsTimer timer (mStatistics, StatisticsPhase_ScriptParse);
+		loader.setSnapshot (mScriptSnapshot, mReadScriptSnapshot, mWriteScriptSnapshot);
+		ScriptLoader::loadAllFiles (&loader, mPlatform->getBasePath());
+		for (std::vector<std::string>::const_iterator it = loader.getFiles().begin(); it != loader.getFiles().end(); ++it)
+			mScriptFiles[*it] = getScriptFileState(*it);
+		mStatistics.increment (StatisticsCounter_ScriptSnapshotHit, loader.getSnapshotHits());
+		mStatistics.increment (StatisticsCounter_ScriptSnapshotMiss, loader.getSnapshotMisses());
+	}
+
+	void Factory::loadContentHashes()
+	{
+		mShaderContentHashes.clear();
+
+		std::string path = mPlatform->getCacheFolder () + "/" + mContentHashesName;
+		if (!boost::filesystem::exists (path))
+			return;
+
+		try
+		{
+			std::ifstream file;
+			file.open(path.c_str());
+
+			std::string name, line;
+			while (getline(file, name))
+			{
+				if (!getline(file, line))
+					throw std::runtime_error("missing hash for shader set \"" + name + "\"");
+
+				boost::uint64_t hash;
+				std::stringstream stream (line);
+				if (!(stream >> std::hex >> hash))
+					throw std::runtime_error("invalid hash for shader set \"" + name + "\"");
+				mShaderContentHashes[name] = hash;
 			}
 		}
-		return ret;
+		catch (std::exception& e)
+		{
+			std::cerr << "Failed to load shader content hashes: " << e.what() << std::endl;
+			mShaderContentHashes.clear();
+		}
 	}
 
 	bool Factory::reloadShaders()
 	{
-		mShaderSets.clear();
-		notifyConfigurationChanged();
+		TraceScope trace (&mTracer, "reloadShaders");
 
 		bool removeBinaryCache = false;
+		ContentHashMap contentHashes;
+		ShaderSetMap shaderSets;
 		ScriptLoader shaderSetLoader(".shaderset");
-		ScriptLoader::loadAllFiles (&shaderSetLoader, mPlatform->getBasePath());
+		loadScripts(shaderSetLoader);
 		std::map <std::string, ScriptNode*> nodes = shaderSetLoader.getAllConfigScripts();
 		for (std::map <std::string, ScriptNode*>::const_iterator it = nodes.begin();
 			it != nodes.end(); ++it)
@@ -723,7 +1302,6 @@ namespace sh
 			}
 
 			std::string sourceAbsolute = mPlatform->getBasePath() + "/" + it->second->findChild("source")->getValue();
-			std::string sourceRelative = it->second->findChild("source")->getValue();
 
 			ShaderSet newSet (it->second->findChild("type")->getValue(), cg_profile, hlsl_profile,
 							  sourceAbsolute,
@@ -731,60 +1309,539 @@ namespace sh
 							  it->first,
 							  &mGlobalSettings);
 
-			int lastModified = boost::filesystem::last_write_time (boost::filesystem::path(sourceAbsolute));
-			mShadersLastModifiedNew[sourceRelative] = lastModified;
-			if (mShadersLastModified.find(sourceRelative) != mShadersLastModified.end())
+			// the source cache is keyed by the content hash, but the microcode cache is keyed by program name only
+			ContentHashMap::const_iterator previous = mShaderContentHashes.find(it->first);
+			if (previous == mShaderContentHashes.end() || previous->second != newSet.getContentHash())
+				removeBinaryCache = true;
+			contentHashes[it->first] = newSet.getContentHash();
+
+			shaderSets.insert(std::make_pair(it->first, newSet));
+		}
+
+		mShaderContentHashes = contentHashes;
+
+		// keep the shader sets whose permutations would be the same
+		std::set<std::string> changed;
+		std::set<const ShaderSet*> replaced;
+		for (ShaderSetMap::const_iterator it = mShaderSets.begin(); it != mShaderSets.end(); ++it)
+		{
+			ShaderSetMap::const_iterator newSet = shaderSets.find(it->first);
+			if (newSet == shaderSets.end() || !newSet->second.isSameAs(it->second))
 			{
-				if (mShadersLastModified[sourceRelative] != lastModified)
-				{
-					// delete any outdated shaders based on this shader set
-					if (removeCache (it->first))
-						removeBinaryCache = true;
-				}
+				changed.insert(it->first);
+				replaced.insert(&it->second);
 			}
-			else
+		}
+		for (ShaderSetMap::const_iterator it = shaderSets.begin(); it != shaderSets.end(); ++it)
+		{
+			if (mShaderSets.find(it->first) == mShaderSets.end())
+				changed.insert(it->first);
+		}
+
+		if (!changed.empty())
+		{
+			discardPendingShaders(&replaced);
+			Preprocessor::clearCache();
+			Preprocessor::clearIncludeCache();
+
+			for (std::set<std::string>::const_iterator it = changed.begin(); it != changed.end(); ++it)
 			{
-				// if we get here, this is either the first run or a new shader file was added
-				// in both cases we can safely delete
-				if (removeCache (it->first))
-					removeBinaryCache = true;
+				// destroys the programs of the previous permutations
+				mShaderSets.erase(*it);
+				ShaderSetMap::const_iterator newSet = shaderSets.find(*it);
+				if (newSet != shaderSets.end())
+					mShaderSets.insert(*newSet);
+			}
+			mStatistics.increment (StatisticsCounter_ShaderSetReload, changed.size());
+
+			// materials that use a changed shader set, or one that did not exist before
+			const char* programs[] = { "vertex_program", "fragment_program" };
+			for (MaterialMap::iterator it = mMaterials.begin(); it != mMaterials.end(); ++it)
+			{
+				MaterialInstance* m = &it->second;
+				PassVector* passes = m->getParentPasses();
+				bool affected = false;
+				for (PassVector::iterator pass = passes->begin(); pass != passes->end() && !affected; ++pass)
+				{
+					for (int i=0; i<2 && !affected; ++i)
+					{
+						if (!pass->hasProperty(programs[i]))
+							continue;
+						try
+						{
+							affected = changed.find(retrieveValue<StringValue>(pass->getProperty(programs[i]), m).get()) != changed.end();
+						}
+						catch (std::exception&)
+						{
+							// the error is reported when the material is created
+						}
+					}
+				}
+				if (affected)
+					invalidateMaterial(m);
 			}
-			mShaderSets.insert(std::make_pair(it->first, newSet));
 		}
 
-		// new is now current
-		mShadersLastModified = mShadersLastModifiedNew;
+		// remember which files the shader sets depend on, for doMonitorShaderFiles
+		mShaderFiles.clear();
+		for (ShaderSetMap::const_iterator it = mShaderSets.begin(); it != mShaderSets.end(); ++it)
+		{
+			mShaderFiles[canonicalPath(it->second.getSourceFile())].insert(it->first);
+			const std::set<std::string>& includes = it->second.getIncludedFiles();
+			for (std::set<std::string>::const_iterator include = includes.begin(); include != includes.end(); ++include)
+				mShaderFiles[*include].insert(it->first);
+		}
+		if (mFileWatcher)
+		{
+			for (ShaderFileMap::const_iterator it = mShaderFiles.begin(); it != mShaderFiles.end(); ++it)
+				mFileWatcher->watchFile(it->first);
+		}
 
 		return removeBinaryCache;
 	}
 
 	void Factory::doMonitorShaderFiles()
 	{
+		collectFileChanges();
+
 		bool reload=false;
-		ScriptLoader shaderSetLoader(".shaderset");
-		ScriptLoader::loadAllFiles (&shaderSetLoader, mPlatform->getBasePath());
-		std::map <std::string, ScriptNode*> nodes = shaderSetLoader.getAllConfigScripts();
-		for (std::map <std::string, ScriptNode*>::const_iterator it = nodes.begin();
-			it != nodes.end(); ++it)
+		if (mCheckAllShaderFiles)
 		{
+			mCheckAllShaderFiles = false;
+			ScriptLoader shaderSetLoader(".shaderset");
+			loadScripts(shaderSetLoader);
+			std::map <std::string, ScriptNode*> nodes = shaderSetLoader.getAllConfigScripts();
+			for (std::map <std::string, ScriptNode*>::const_iterator it = nodes.begin();
+				it != nodes.end(); ++it)
+			{
 
-			std::string sourceAbsolute = mPlatform->getBasePath() + "/" + it->second->findChild("source")->getValue();
-			std::string sourceRelative = it->second->findChild("source")->getValue();
+				std::string sourceAbsolute = mPlatform->getBasePath() + "/" + it->second->findChild("source")->getValue();
 
-			int lastModified = boost::filesystem::last_write_time (boost::filesystem::path(sourceAbsolute));
-			if (mShadersLastModified.find(sourceRelative) != mShadersLastModified.end())
-			{
-				if (mShadersLastModified[sourceRelative] != lastModified)
+				ShaderSetMap::const_iterator shaderSet = mShaderSets.find(it->first);
+				if (shaderSet == mShaderSets.end() || shaderSet->second.getContentHash() != ShaderSet::computeContentHash(sourceAbsolute))
 				{
 					reload=true;
 					break;
 				}
 			}
 		}
+		else
+		{
+			std::set<std::string> shaderSets;
+			for (std::set<std::string>::const_iterator it = mChangedShaderFiles.begin(); it != mChangedShaderFiles.end(); ++it)
+			{
+				if (boost::filesystem::path(*it).extension() == ".shaderset")
+				{
+					reload = true;
+					break;
+				}
+				ShaderFileMap::const_iterator users = mShaderFiles.find(*it);
+				if (users != mShaderFiles.end())
+					shaderSets.insert(users->second.begin(), users->second.end());
+			}
+
+			// a file may have been saved without changing it
+			for (std::set<std::string>::const_iterator it = shaderSets.begin(); it != shaderSets.end() && !reload; ++it)
+			{
+				ShaderSetMap::const_iterator shaderSet = mShaderSets.find(*it);
+				if (shaderSet == mShaderSets.end() || shaderSet->second.getContentHash() != ShaderSet::computeContentHash(shaderSet->second.getSourceFile()))
+					reload=true;
+			}
+		}
+		mChangedShaderFiles.clear();
+
 		if (reload)
 			reloadShaders();
 	}
 
+	void Factory::collectFileChanges ()
+	{
+		if (!mFileWatcher)
+		{
+			mFileWatcher = new FileWatcher(mPlatform->getBasePath(), mFileWatcherBackend);
+			for (ShaderFileMap::const_iterator it = mShaderFiles.begin(); it != mShaderFiles.end(); ++it)
+				mFileWatcher->watchFile(it->first);
+
+			// files that were changed before the watcher was started are only found by checking all of them
+			mCheckAllShaderFiles = true;
+			mCheckAllScriptFiles = true;
+			return;
+		}
+
+		std::vector<std::string> changes;
+		if (!mFileWatcher->getChanges(changes))
+		{
+			mCheckAllShaderFiles = true;
+			mCheckAllScriptFiles = true;
+		}
+
+		for (std::vector<std::string>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+		{
+			std::string extension = boost::filesystem::path(*it).extension().string();
+			if (extension == ".mat" || extension == ".configuration" || extension == ".lod")
+				mChangedScriptFiles.insert(*it);
+			else if (extension == ".shaderset")
+				mChangedShaderFiles.insert(*it);
+			else
+			{
+				std::string path = canonicalPath(*it);
+				if (mShaderFiles.find(path) != mShaderFiles.end())
+					mChangedShaderFiles.insert(path);
+			}
+		}
+	}
+
+	Factory::ScriptFileState Factory::getScriptFileState (const std::string& file)
+	{
+		boost::system::error_code ec;
+		ScriptFileState state;
+		state.mSize = boost::filesystem::file_size(file, ec);
+		state.mModified = boost::filesystem::last_write_time(file, ec);
+		return state;
+	}
+
+	bool Factory::doMonitorScriptFiles()
+	{
+		collectFileChanges();
+		if (mCheckAllScriptFiles)
+		{
+			mCheckAllScriptFiles = false;
+			findChangedScriptFiles();
+		}
+
+		std::vector<std::string> changed (mChangedScriptFiles.begin(), mChangedScriptFiles.end());
+		mChangedScriptFiles.clear();
+
+		// configurations have to be up to date before the materials that are created for them
+		const char* fileEndings[] = { ".configuration", ".lod", ".mat" };
+		bool reloaded = false;
+		for (int i=0; i<3; ++i)
+		{
+			for (std::vector<std::string>::const_iterator it = changed.begin(); it != changed.end(); ++it)
+			{
+				if (boost::filesystem::path(*it).extension() == fileEndings[i])
+					reloaded = reloadScriptFile(*it) || reloaded;
+			}
+		}
+		return reloaded;
+	}
+
+	void Factory::findChangedScriptFiles ()
+	{
+		std::set<std::string> found;
+		for (boost::filesystem::recursive_directory_iterator end, dir(mPlatform->getBasePath()); dir != end; ++dir)
+		{
+			std::string extension = dir->path().extension().string();
+			if (extension != ".mat" && extension != ".configuration" && extension != ".lod")
+				continue;
+			std::string file = dir->path().string();
+			found.insert(file);
+			ScriptFileMap::const_iterator previous = mScriptFiles.find(file);
+			if (previous == mScriptFiles.end() || !(previous->second == getScriptFileState(file)))
+				mChangedScriptFiles.insert(file);
+		}
+
+		// files that were removed
+		for (ScriptFileMap::const_iterator it = mScriptFiles.begin(); it != mScriptFiles.end(); ++it)
+		{
+			if (found.find(it->first) != found.end())
+				continue;
+			std::string extension = boost::filesystem::path(it->first).extension().string();
+			if (extension == ".mat" || extension == ".configuration" || extension == ".lod")
+				mChangedScriptFiles.insert(it->first);
+		}
+	}
+
+	bool Factory::reloadScriptFile (const std::string& file)
+	{
+		TraceScope trace (&mTracer, "reloadScriptFile");
+		trace.addArgument("file", file);
+
+		std::string fileEnding = boost::filesystem::path(file).extension().string();
+		ScriptLoader loader(fileEnding);
+		try
+		{
+			if (boost::filesystem::exists(file))
+			{
+				// remember the state first, so that a broken file is not parsed again until it is saved again
+				mScriptFiles[file] = getScriptFileState(file);
+				loader.setSnapshot (mScriptSnapshot, false, mWriteScriptSnapshot);
+				loader.mCurrentFileName = file;
+				loader.parseFile(file);
+			}
+			else
+				mScriptFiles.erase(file);
+
+			if (fileEnding == ".configuration")
+				return reloadConfigurations(file, loader);
+			else if (fileEnding == ".lod")
+				return reloadLodConfigurations(file, loader);
+			else if (fileEnding == ".mat")
+				return reloadMaterials(file, loader);
+			else
+				std::cerr << "sh::Factory: Warning: Can't reload file type " << fileEnding << std::endl;
+		}
+		catch (std::exception& e)
+		{
+			std::string message = "Failed to reload " + file + ": " + e.what();
+			std::cerr << "sh::Factory: " << message << std::endl;
+			logError(message);
+		}
+		return false;
+	}
+
+	bool Factory::reloadConfigurations (const std::string& file, ScriptLoader& loader)
+	{
+		bool changed = false;
+		std::map <std::string, ScriptNode*> nodes = loader.getAllConfigScripts();
+		for (std::map <std::string, ScriptNode*>::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+		{
+			if (!(it->second->getName() == "configuration"))
+			{
+				std::cerr << "sh::Factory: Warning: Unsupported root node type \"" << it->second->getName() << "\" for file type .configuration" << std::endl;
+				continue;
+			}
+
+			ConfigurationMap::iterator configuration = mConfigurations.find(it->first);
+			if (configuration != mConfigurations.end() && configuration->second.getSourceFile() != file)
+				continue; // the first definition wins, like in loadAllFiles
+
+			ScriptProperties properties;
+			readProperties(it->second, properties);
+			if (configuration == mConfigurations.end())
+			{
+				configuration = mConfigurations.insert(std::make_pair(it->first, Configuration())).first;
+				configuration->second.setParent(&mGlobalSettings);
+				configuration->second.setSourceFile(file);
+			}
+			else if (sameProperties(configuration->second, properties))
+				continue;
+
+			setProperties(configuration->second, properties);
+			changed = true;
+		}
+
+		for (ConfigurationMap::iterator it = mConfigurations.begin(); it != mConfigurations.end(); )
+		{
+			if (it->second.getSourceFile() == file && nodes.find(it->first) == nodes.end())
+			{
+				mConfigurations.erase(it++);
+				changed = true;
+			}
+			else
+				++it;
+		}
+
+		// any material can be created for any configuration
+		if (changed)
+			notifyConfigurationChanged();
+		return changed;
+	}
+
+	bool Factory::reloadLodConfigurations (const std::string& file, ScriptLoader& loader)
+	{
+		bool changed = false;
+		std::set<int> defined;
+		std::map <std::string, ScriptNode*> nodes = loader.getAllConfigScripts();
+		for (std::map <std::string, ScriptNode*>::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+		{
+			if (!(it->second->getName() == "lod_configuration"))
+			{
+				std::cerr << "sh::Factory: Warning: Unsupported root node type \"" << it->second->getName() << "\" for file type .lod" << std::endl;
+				continue;
+			}
+
+			int index = boost::lexical_cast<int>(it->first);
+			if (index == 0)
+				throw std::runtime_error("lod level 0 (max lod) can't have a configuration");
+			defined.insert(index);
+
+			LodSourceFileMap::const_iterator source = mLodSourceFiles.find(index);
+			if (mLodConfigurations.find(index) != mLodConfigurations.end() && (source == mLodSourceFiles.end() || source->second != file))
+				continue; // registered by code, or defined in another file first
+
+			ScriptProperties properties;
+			readProperties(it->second, properties);
+			PropertySetGet& lod = mLodConfigurations[index];
+			if (source != mLodSourceFiles.end() && sameProperties(lod, properties))
+				continue;
+
+			setProperties(lod, properties);
+			mLodSourceFiles[index] = file;
+			changed = true;
+		}
+
+		for (LodSourceFileMap::iterator it = mLodSourceFiles.begin(); it != mLodSourceFiles.end(); )
+		{
+			if (it->second == file && defined.find(it->first) == defined.end())
+			{
+				mLodConfigurations.erase(it->first);
+				mLodSourceFiles.erase(it++);
+				changed = true;
+			}
+			else
+				++it;
+		}
+
+		if (changed)
+			notifyConfigurationChanged();
+		return changed;
+	}
+
+	bool Factory::reloadMaterials (const std::string& file, ScriptLoader& loader)
+	{
+		bool changed = false;
+		std::vector<MaterialInstance*> updated;
+		std::map <std::string, ScriptNode*> nodes = loader.getAllConfigScripts();
+		for (std::map <std::string, ScriptNode*>::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+		{
+			if (!(it->second->getName() == "material"))
+			{
+				std::cerr << "sh::Factory: Warning: Unsupported root node type \"" << it->second->getName() << "\" for file type .mat" << std::endl;
+				continue;
+			}
+
+			MaterialMap::iterator material = mMaterials.find(it->first);
+			MaterialIndex::iterator indexed = mMaterialIndex.find(it->first);
+			if (material != mMaterials.end())
+			{
+				MaterialInstance* m = &material->second;
+				if (m->getSourceFile() != file || !materialChanged(m, it->second))
+					continue;
+
+				PropertyMap previous = m->listProperties();
+				for (PropertyMap::const_iterator propIt = previous.begin(); propIt != previous.end(); ++propIt)
+					m->deleteProperty(propIt->first);
+				m->getPasses()->clear();
+				m->setParentInstance("");
+				m->setParent(NULL);
+				readMaterial(m, it->second);
+				updated.push_back(m);
+			}
+			else if (indexed != mMaterialIndex.end())
+			{
+				// not created yet, so only the location can be out of date
+				if (*indexed->second.mFile == file)
+					indexed->second.mOffset = it->second->getOffset();
+				continue;
+			}
+			else if (mLazyMaterialLoading && !it->second->findChild("create_configuration"))
+			{
+				MaterialLocation location;
+				location.mFile = &*mMaterialFiles.insert(file).first;
+				location.mOffset = it->second->getOffset();
+				mMaterialIndex.insert (std::make_pair(it->first, location));
+			}
+			else
+				updated.push_back(addMaterial (it->first, it->second));
+			changed = true;
+		}
+
+		for (MaterialIndex::iterator it = mMaterialIndex.begin(); it != mMaterialIndex.end(); )
+		{
+			if (*it->second.mFile == file && nodes.find(it->first) == nodes.end())
+			{
+				mMaterialIndex.erase(it++);
+				changed = true;
+			}
+			else
+				++it;
+		}
+
+		// the parents can only be resolved once all new materials exist
+		for (std::vector<MaterialInstance*>::iterator it = updated.begin(); it != updated.end(); ++it)
+			resolveParent (*it);
+		mStatistics.increment (StatisticsCounter_MaterialReload, updated.size());
+
+		// materials that were removed from the file
+		std::vector<MaterialMap::iterator> removed;
+		for (MaterialMap::iterator it = mMaterials.begin(); it != mMaterials.end(); ++it)
+		{
+			if (it->second.getSourceFile() == file && nodes.find(it->first) == nodes.end())
+				removed.push_back(it);
+		}
+		if (!removed.empty())
+		{
+			// the ones that are still a parent have to stay
+			std::set<PropertySetGet*> parents;
+			for (MaterialMap::iterator it = mMaterials.begin(); it != mMaterials.end(); ++it)
+				parents.insert(it->second.getParent());
+			for (std::vector<MaterialMap::iterator>::iterator it = removed.begin(); it != removed.end(); ++it)
+			{
+				if (parents.find(&(*it)->second) != parents.end())
+				{
+					std::string message = "Material \"" + (*it)->first + "\" was removed from " + file + ", but other materials derive from it";
+					std::cerr << "sh::Factory: " << message << std::endl;
+					logError(message);
+					continue;
+				}
+				mMaterials.erase(*it);
+				changed = true;
+			}
+		}
+
+		// invalidate the updated materials, and the ones that derive from them
+		if (!updated.empty())
+		{
+			std::set<PropertySetGet*> invalid (updated.begin(), updated.end());
+			for (MaterialMap::iterator it = mMaterials.begin(); it != mMaterials.end(); ++it)
+			{
+				for (PropertySetGet* m = &it->second; m; m = m->getParent())
+				{
+					if (invalid.find(m) != invalid.end())
+					{
+						invalidateMaterial(&it->second);
+						break;
+					}
+				}
+			}
+		}
+
+		return changed;
+	}
+
+	bool Factory::materialChanged (MaterialInstance* m, ScriptNode* node)
+	{
+		std::string parent;
+		ScriptProperties properties;
+		std::vector<ScriptNode*> passes;
+		ScriptNodeList children = node->getChildren();
+		for (ScriptNodeList::const_iterator it = children.begin(); it != children.end(); ++it)
+		{
+			std::string name = (*it)->getName();
+			if (name == "pass")
+				passes.push_back(*it);
+			else if (name == "parent")
+				parent = (*it)->getValue();
+			else
+				properties[name] = (*it)->getValue();
+		}
+
+		if (parent != m->getParentInstance() || !sameProperties(*m, properties) || passes.size() != m->getPasses()->size())
+			return true;
+
+		for (size_t i=0; i<passes.size(); ++i)
+		{
+			if (passChanged((*m->getPasses())[i], passes[i]))
+				return true;
+		}
+		return false;
+	}
+
+	void Factory::invalidateMaterial (MaterialInstance* m)
+	{
+		if (!m->hasProperty("create_configuration"))
+		{
+			m->destroyAll();
+			return;
+		}
+
+		// these are only created once, when they are loaded
+		m->destroyAll(true);
+		std::string config = retrieveValue<StringValue>(m->getProperty("create_configuration"), NULL).get();
+		m->createForConfiguration (config, 0);
+	}
+
 	void Factory::logError(const std::string &msg)
 	{
 		mErrorLog << msg << '\n';
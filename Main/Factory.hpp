@@ -2,16 +2,29 @@
 #define SH_FACTORY_H
 
 #include <map>
+#include <set>
+#include <ctime>
 #include <string>
 #include <sstream>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/cstdint.hpp>
 
 #include "MaterialInstance.hpp"
 #include "ShaderSet.hpp"
 #include "Language.hpp"
+#include "PreprocessorBackend.hpp"
+#include "Statistics.hpp"
+#include "FileWatcher.hpp"
 
 namespace sh
 {
 	class Platform;
+	class WorkQueue;
+	class CacheArchive;
+	class ScriptLoader;
+	class ScriptNode;
 
 	class Configuration : public PropertySetGet
 	{
@@ -29,7 +42,8 @@ namespace sh
 	typedef std::map<std::string, ShaderSet> ShaderSetMap;
 	typedef std::map<std::string, Configuration> ConfigurationMap;
 	typedef std::map<int, PropertySetGet> LodConfigurationMap;
-	typedef std::map<std::string, int> LastModifiedMap;
+	typedef std::map<int, std::string> LodSourceFileMap;
+	typedef std::map<std::string, boost::uint64_t> ContentHashMap;
 
 	typedef std::map<std::string, std::string> TextureAliasMap;
 
@@ -46,6 +60,43 @@ namespace sh
 		virtual void materialCreated (MaterialInstance* m, const std::string& configuration, unsigned short lodIndex) = 0;
 	};
 
+	/// A shader permutation that was needed by a material request, see \a HitchReport
+	struct HitchPermutation
+	{
+		std::string mName; ///< name of the gpu program
+		bool mCompiled; ///< false if the permutation already existed, or is known to fail
+		bool mFailed; ///< true if the permutation failed to compile, in this request or before
+		float mTime; ///< milliseconds
+	};
+
+	/// A material request that took longer than the hitch threshold, see \a Factory::setHitchThreshold
+	struct HitchReport
+	{
+		std::string mMaterial;
+		std::string mConfiguration;
+		unsigned short mLodIndex; ///< lod index that was requested
+		std::vector<unsigned short> mCreatedLodLevels; ///< all lod levels of the configuration are created at once
+		std::vector<HitchPermutation> mPermutations;
+		unsigned int mCompiledCount; ///< permutations that were compiled, including those that failed
+		unsigned int mCachedCount; ///< permutations that already existed
+		unsigned int mFailedCount; ///< permutations that failed to compile, in this request or before
+		float mCompileTime; ///< milliseconds spent on permutations that were compiled
+		float mTime; ///< milliseconds spent on the whole request
+
+		HitchReport () : mLodIndex(0), mCompiledCount(0), mCachedCount(0), mFailedCount(0), mCompileTime(0), mTime(0) {}
+	};
+
+	/**
+	 * @brief
+	 * Allows you to be notified when a material request took longer than the frame budget, for example to log which
+	 * materials should be created in advance. See \a Factory::setHitchThreshold
+	 */
+	class HitchListener
+	{
+	public:
+		virtual void hitchDetected (const HitchReport& report) = 0;
+	};
+
 	/**
 	 * @brief
 	 * The main interface class
@@ -75,6 +126,12 @@ namespace sh
 		/// write generated shaders to current directory, useful for debugging
 		void setShaderDebugOutputEnabled (bool enabled);
 
+		/// Select the preprocessor implementation used for shader sources. \n
+		/// The built-in backend is much faster, sources it can not handle are passed to boost::wave automatically.
+		void setPreprocessorBackend (PreprocessorBackend backend);
+
+		PreprocessorBackend getPreprocessorBackend () { return mPreprocessorBackend; }
+
 		/// Use this to manage user settings. \n
 		/// Global settings can be retrieved in shaders through a macro. \n
 		/// When a global setting is changed, the shaders that depend on them are recompiled automatically.
@@ -115,9 +172,48 @@ namespace sh
 		/// Attach a listener for material created events
 		void setMaterialListener (MaterialListener* listener);
 
+		/// Report material requests that take longer than \a milliseconds to the hitch listener, and keep them in the hitch buffer.
+		/// \note The default is 0 (disabled)
+		void setHitchThreshold (float milliseconds) { mHitchThreshold = milliseconds; }
+
+		/// Attach a listener for material requests that take longer than the hitch threshold
+		void setHitchListener (HitchListener* listener) { mHitchListener = listener; }
+
+		/// Set the number of hitch reports to keep, the oldest are dropped first. The default is 64.
+		void setHitchBufferSize (unsigned int size);
+
+		/// @return the hitch reports in the buffer, oldest first
+		/// \note Can be called from any thread, e.g. from a crash handler.
+		std::vector<HitchReport> getHitchReports ();
+
+		void clearHitchReports ();
+
 		/// Call this after you have set up basic stuff, like the shader language.
 		void loadAllFiles ();
 
+		/// Controls lazy material loading. If enabled, loadAllFiles only remembers where the materials are defined, and a material
+		/// is parsed and created the first time it is looked up (e.g. with getMaterialInstance, or when the platform requests it),
+		/// together with its parents. Materials with a "create_configuration" property are still created right away. \n
+		/// The platform material only exists once the MaterialInstance is created, so the platform has to look up the materials
+		/// it does not know through the factory (see Platform::supportsMaterialLookup). With Ogre, get the materials with
+		/// OgrePlatform::getMaterial instead of Ogre::MaterialManager.
+		/// \note Call this before loadAllFiles. The default is off (loadAllFiles creates all materials).
+		/// Throws if the platform does not support it.
+		void setLazyMaterialLoading (bool enabled);
+
+		/// Create all materials that were not looked up yet, see setLazyMaterialLoading. saveAll and precompile call this.
+		void loadAllMaterials ();
+
+		/// Generate the shader permutations of all materials for the given configurations and lod levels up front,
+		/// instead of compiling them on demand while rendering. \n
+		/// The source generation (macro parsing & preprocessing) runs on \a threadCount worker threads,
+		/// the GPU programs are then created on the calling thread.
+		/// @param configurations configurations to compile for, use the platform's default material scheme name for the default configuration
+		/// @param lodLevels lod levels to compile for (0 is the highest lod)
+		/// @param threadCount number of worker threads, 0 to use the number of hardware threads
+		/// @note Call this after loadAllFiles. Errors are written to the error log (see getErrorLog), and reported again when the material is requested.
+		void precompile (const std::vector<std::string>& configurations, const std::vector<int>& lodLevels, unsigned int threadCount = 0);
+
 		/// Controls writing of generated shader source code to the cache folder, so that the
 		/// (rather expensive) preprocessing step can be skipped on the next run. See Factory::setReadSourceCache \n
 		/// \note The default is off (no cache writing)
@@ -138,6 +234,37 @@ namespace sh
 		/// \note The default is off (no cache reading)
 		void setReadMicrocodeCache(bool read) { mReadMicrocodeCache = read; }
 
+		/// Controls writing a snapshot of the parsed script files (.mat, .configuration, .lod and .shaderset) to the cache folder,
+		/// so that files that did not change don't have to be parsed again on the next run. See Factory::setReadScriptSnapshot
+		/// \note The default is off (no snapshot writing)
+		void setWriteScriptSnapshot(bool write) { mWriteScriptSnapshot = write; }
+
+		/// Controls reading of the script snapshot from the cache folder. A file is parsed again if its size changed,
+		/// or if its modification time and content changed.
+		/// \note The default is off (no snapshot reading)
+		void setReadScriptSnapshot(bool read) { mReadScriptSnapshot = read; }
+
+		/// Controls non-blocking material creation. If enabled, requesting a material whose shaders are not compiled yet
+		/// will not compile them right away. Instead, their source is generated on \a threadCount background threads,
+		/// and the platform renders a placeholder in the meantime: the technique that was in use before the material
+		/// was invalidated, or the material set with setPlaceholderMaterial. \n
+		/// You then have to call processPendingMaterials once per frame, which creates the materials whose shaders are ready.
+		/// \note The default is off (materials are created synchronously when they are requested)
+		void setAsyncMaterialCreation (bool enabled, unsigned int threadCount = 1);
+
+		bool getAsyncMaterialCreation () { return mAsyncMaterialCreation; }
+
+		/// Set the name of a platform material to render with while a material is created in the background,
+		/// and there is no previous technique available. See setAsyncMaterialCreation. \n
+		/// This should be a simple material that does not need any shader permutations to be compiled.
+		void setPlaceholderMaterial (const std::string& name) { mPlaceholderMaterial = name; }
+
+		std::string getPlaceholderMaterial () { return mPlaceholderMaterial; }
+
+		/// Compiles the shaders that were generated in the background, and creates the materials that were waiting for them.
+		/// Call this once per frame if async material creation is enabled.
+		void processPendingMaterials ();
+
 		/// Lists all materials currently registered with the factory. Whether they are
 		/// loaded or not does not matter.
 		void listMaterials (std::vector<std::string>& out);
@@ -154,15 +281,40 @@ namespace sh
 		/// Lists shader sets.
 		void listShaderSets (std::vector<std::string>& out);
 
+		/// Load the .shaderset files again, and create the shader sets whose definition, source or included files changed. \n
+		/// Only the materials that use one of these shader sets as vertex_program or fragment_program are invalidated,
+		/// the other shader sets keep their compiled permutations and the other materials their techniques.
+		/// @return true if the content of any shader set differs from the previous run, see setReadMicrocodeCache
 		/// \note This only works if microcode caching is disabled, as there is currently no way to remove the cache
 		/// through the Ogre API. Luckily, this is already fixed in Ogre 1.9.
 		bool reloadShaders();
 
-		/// Calls reloadShaders() if shader files have been modified since the last reload.
+		/// Calls reloadShaders() if shader files (or files included by them) have been modified since the last reload. \n
+		/// The first call starts a \a FileWatcher on the base path and checks all files, later calls only look at the files
+		/// that the watcher reported in the meantime, so this is cheap enough to be called every frame.
 		/// \note This only works if microcode caching is disabled, as there is currently no way to remove the cache
 		/// through the Ogre API. Luckily, this is already fixed in Ogre 1.9.
 		void doMonitorShaderFiles();
 
+		/// Parse a .configuration, .lod or .mat file again, and apply the differences to the objects that were loaded from it. \n
+		/// Only the materials whose definition changed are invalidated, together with the materials that derive from them.
+		/// Objects that were removed from the file are destroyed (a file that does not exist anymore counts as empty),
+		/// except for materials that other materials still derive from. \n
+		/// If a file can't be parsed, the error is logged and the objects are left unchanged.
+		/// @param file path of the file, as found under the base path of the platform
+		/// @return true if anything changed
+		bool reloadScriptFile (const std::string& file);
+
+		/// Calls reloadScriptFile for every .configuration, .lod and .mat file that was added, removed or modified
+		/// since it was loaded. Uses the same \a FileWatcher as doMonitorShaderFiles, the first call checks the size and
+		/// modification time of all files.
+		/// @return true if anything changed
+		bool doMonitorScriptFiles();
+
+		/// Select how doMonitorShaderFiles and doMonitorScriptFiles are notified of changed files.
+		/// \note Call this before the first doMonitor call. The default is FileWatcherBackend_Native
+		void setFileWatcherBackend (FileWatcherBackend backend) { mFileWatcherBackend = backend; }
+
 		/// Unloads all materials that are currently not referenced. This will not unload the textures themselves,
 		/// but it will let go of the SharedPtr's to the textures, so that you may unload them if you so desire. \n
 		/// A good time to call this would be after a new level has been loaded, but just calling it occasionally after a period
@@ -193,10 +345,49 @@ namespace sh
 
 		Configuration* getConfiguration (const std::string& name);
 
+		/// @note throws if there is no shader set with this name
+		ShaderSet* getShaderSet (const std::string& name);
+
+		/// Counters and cumulative times of the phases of material and shader creation. Use \a Statistics::reset to start over.
+		Statistics& getStatistics () { return mStatistics; }
+
+		/// Start writing a Chrome trace (JSON, open it in chrome://tracing or Perfetto) of material requests, shader creation
+		/// and file loading to \a file. The events are tagged with the material, configuration, lod and permutation name.
+		/// @note throws if the file can't be opened
+		void startTrace (const std::string& file);
+
+		/// Finish the trace file that was started with \a startTrace.
+		void stopTrace ();
+
 	private:
 
 		MaterialInstance* requestMaterial (const std::string& name, const std::string& configuration, unsigned short lodIndex);
-		ShaderSet* getShaderSet (const std::string& name);
+
+		/// requestMaterial without the hitch detection
+		MaterialInstance* findOrCreateMaterial (const std::string& name, const std::string& configuration, unsigned short lodIndex);
+
+		/// @return the report of the material request that is currently being handled, NULL if hitch detection is disabled
+		HitchReport* getCurrentHitchReport () { return mCurrentHitchReport; }
+
+		void addHitchReport (const HitchReport& report);
+
+		/// create all lod levels of the given configuration
+		/// @return false if the material could not be created
+		bool createMaterial (MaterialInstance* m, const std::string& configuration);
+
+		/// Queue the shaders that the given configuration of \a m needs in the background
+		/// @return true if the configuration can be created right away
+		bool queueMaterial (MaterialInstance* m, const std::string& configuration);
+
+		void generateInBackground (PendingShaderInstancePtr pending);
+
+		/// wait for any shaders that are being generated in the background, and drop them
+		/// @param shaderSets only drop the shaders of these sets, NULL to drop all
+		void discardPendingShaders (const std::set<const ShaderSet*>* shaderSets = NULL);
+
+		/// @return true if the source or failed permutation cache entry \a name belongs to a shader set that no longer exists,
+		/// or to an older content of a shader set (see ShaderSet::getCacheNamePrefix)
+		bool isOutdatedCacheEntry (const std::string& name) const;
 		Platform* getPlatform ();
 
 		PropertySetGet* getCurrentGlobalSettings();
@@ -207,6 +398,11 @@ namespace sh
 		std::string getCacheFolder () { return mPlatform->getCacheFolder (); }
 		bool getReadSourceCache() { return mReadSourceCache; }
 		bool getWriteSourceCache() { return mWriteSourceCache; }
+		/// @return the archive that stores the generated shader sources, NULL if the source cache is not used
+		CacheArchive* getSourceCache() { return mSourceCache; }
+		/// @return the archive that stores the permutations that failed to compile, NULL if the microcode cache is not used
+		CacheArchive* getFailedPermutationCache() { return mFailedPermutationCache; }
+		bool getReadMicrocodeCache() { return mReadMicrocodeCache; }
 	public:
 		bool getWriteMicrocodeCache() { return mWriteMicrocodeCache; } // Fixme
 
@@ -231,19 +427,43 @@ namespace sh
 
 		bool mShadersEnabled;
 		bool mShaderDebugOutputEnabled;
+		PreprocessorBackend mPreprocessorBackend;
 
 		bool mReadMicrocodeCache;
 		bool mWriteMicrocodeCache;
 		bool mReadSourceCache;
 		bool mWriteSourceCache;
+		CacheArchive* mSourceCache;
+		CacheArchive* mFailedPermutationCache;
+		bool mReadScriptSnapshot;
+		bool mWriteScriptSnapshot;
+		CacheArchive* mScriptSnapshot;
 		std::stringstream mErrorLog;
+		Tracer mTracer;
+		Statistics mStatistics;
 
 		MaterialMap mMaterials;
 		ShaderSetMap mShaderSets;
 		ConfigurationMap mConfigurations;
 		LodConfigurationMap mLodConfigurations;
-		LastModifiedMap mShadersLastModified;
-		LastModifiedMap mShadersLastModifiedNew;
+		LodSourceFileMap mLodSourceFiles; ///< the files the lod configurations were loaded from
+		ContentHashMap mShaderContentHashes; ///< shader set name -> content hash, as of the last reload
+
+		typedef std::map<std::string, std::set<std::string> > ShaderFileMap;
+		ShaderFileMap mShaderFiles; ///< canonical path of a shader source or included file -> names of the shader sets that use it
+
+		FileWatcherBackend mFileWatcherBackend;
+		FileWatcher* mFileWatcher; ///< started by the first doMonitorShaderFiles or doMonitorScriptFiles call
+		std::set<std::string> mChangedShaderFiles; ///< reported by the file watcher, but not handled by doMonitorShaderFiles yet
+		std::set<std::string> mChangedScriptFiles; ///< same for doMonitorScriptFiles
+		bool mCheckAllShaderFiles; ///< the file watcher was just started, or lost changes
+		bool mCheckAllScriptFiles;
+
+		/// Start the file watcher, or sort the files it reported into mChangedShaderFiles and mChangedScriptFiles
+		void collectFileChanges ();
+
+		/// Add every script file whose size or modification time is not the same as when it was loaded to mChangedScriptFiles
+		void findChangedScriptFiles ();
 
 		PropertySetGet mGlobalSettings;
 
@@ -256,15 +476,93 @@ namespace sh
 
 		MaterialListener* mListener;
 
+		float mHitchThreshold;
+		HitchListener* mHitchListener;
+		HitchReport* mCurrentHitchReport;
+		boost::mutex mHitchReportsMutex;
+		std::vector<HitchReport> mHitchReports; ///< ring buffer
+		size_t mNextHitchReport; ///< position of the oldest report, once the buffer is full
+		unsigned int mHitchBufferSize;
+
+		bool mAsyncMaterialCreation;
+		WorkQueue* mBackgroundQueue;
+		std::string mPlaceholderMaterial;
+
+		boost::mutex mFinishedShadersMutex;
+		std::vector<PendingShaderInstancePtr> mFinishedShaders; ///< generated in the background, waiting to be compiled
+
+		typedef std::set< std::pair<std::string, std::string> > PendingMaterialSet;
+		PendingMaterialSet mPendingMaterials; ///< (material, configuration) pairs that are waiting for background shaders
+		bool mRecheckPendingMaterials;
+
 		Platform* mPlatform;
 
 		MaterialInstance* findInstance (const std::string& name);
+
+		/// @return the material, after creating it if it was not looked up before (see setLazyMaterialLoading), NULL if it does not exist
 		MaterialInstance* searchInstance (const std::string& name);
 
-		/// @return was anything removed?
-		bool removeCache (const std::string& pattern);
+		/// where a material that was not created yet is defined
+		struct MaterialLocation
+		{
+			const std::string* mFile; ///< points into mMaterialFiles
+			size_t mOffset;
+		};
+		typedef std::map<std::string, MaterialLocation> MaterialIndex;
+
+		bool mLazyMaterialLoading;
+		MaterialIndex mMaterialIndex; ///< materials that were found by loadAllFiles, but not created yet
+		std::set<std::string> mMaterialFiles;
+
+		/// Create a material from its script node, the parent is not resolved yet.
+		MaterialInstance* addMaterial (const std::string& materialName, ScriptNode* node);
+
+		/// Add the properties, passes and parent name of a material script node to \a m
+		void readMaterial (MaterialInstance* m, ScriptNode* node);
+
+		/// @return true if the script node defines anything different than what \a m currently has
+		bool materialChanged (MaterialInstance* m, ScriptNode* node);
+
+		/// Destroy the techniques of \a m, so that they are created again when needed
+		void invalidateMaterial (MaterialInstance* m);
+
+		/// Set the parent of \a m, which is created if necessary
+		void resolveParent (MaterialInstance* m);
+
+		/// Parse and create an indexed material and its parents, and remove it from the index
+		/// @return NULL if the material is not in its file anymore
+		MaterialInstance* loadIndexedMaterial (MaterialIndex::iterator it);
+
+		/// Load all files of the loader's type from the base path
+		void loadScripts (ScriptLoader& loader);
+
+		/// size and modification time of a script file when it was last loaded, see doMonitorScriptFiles
+		struct ScriptFileState
+		{
+			boost::uintmax_t mSize;
+			std::time_t mModified;
+
+			bool operator== (const ScriptFileState& other) const { return mSize == other.mSize && mModified == other.mModified; }
+		};
+		typedef std::map<std::string, ScriptFileState> ScriptFileMap;
+		ScriptFileMap mScriptFiles;
+
+		static ScriptFileState getScriptFileState (const std::string& file);
+
+		/// Apply the nodes of a reloaded file, see reloadScriptFile
+		bool reloadConfigurations (const std::string& file, ScriptLoader& loader);
+		bool reloadLodConfigurations (const std::string& file, ScriptLoader& loader);
+		bool reloadMaterials (const std::string& file, ScriptLoader& loader);
+
+		/// Loads the content hashes of the shader sets from the previous run,
+		/// the microcode cache can't be used if any of them changed.
+		void loadContentHashes ();
 
 		static const std::string mBinaryCacheName;
+		static const std::string mContentHashesName;
+		static const std::string mSourceCacheName;
+		static const std::string mFailedPermutationCacheName;
+		static const std::string mScriptSnapshotName;
 	};
 }
 
@@ -0,0 +1,288 @@
+#include "FileWatcher.hpp"
+
+#include <iostream>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/chrono.hpp>
+
+#ifdef __linux__
+#define SH_FILEWATCHER_INOTIFY
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace sh
+{
+#ifdef SH_FILEWATCHER_INOTIFY
+	namespace
+	{
+		const boost::uint32_t sWatchMask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+	}
+#endif
+
+	FileWatcher::FileWatcher (const std::string& path, FileWatcherBackend backend, unsigned int pollInterval)
+		: mPath(path)
+		, mBackend(FileWatcherBackend_Polling)
+		, mPollInterval(pollInterval)
+		, mLost(false)
+		, mNotify(-1)
+		, mThread(NULL)
+	{
+#ifdef SH_FILEWATCHER_INOTIFY
+		if (backend == FileWatcherBackend_Native)
+		{
+			mNotify = inotify_init();
+			if (mNotify >= 0)
+			{
+				watchDirectory(mPath, false);
+				if (mLost)
+				{
+					// most likely the limit of watches per user is reached
+					close(mNotify);
+					mNotify = -1;
+					mWatches.clear();
+					mLost = false;
+				}
+				else
+					mBackend = FileWatcherBackend_Native;
+			}
+			if (mBackend != FileWatcherBackend_Native)
+				std::cerr << "sh::FileWatcher: Warning: Can't watch " << mPath << " with inotify, using polling instead" << std::endl;
+		}
+#endif
+
+		if (mBackend == FileWatcherBackend_Native)
+			mThread = new boost::thread(boost::bind(&FileWatcher::runNative, this));
+		else
+		{
+			scan(false);
+			mThread = new boost::thread(boost::bind(&FileWatcher::runPolling, this));
+		}
+	}
+
+	FileWatcher::~FileWatcher ()
+	{
+		mThread->interrupt();
+		mThread->join();
+		delete mThread;
+
+#ifdef SH_FILEWATCHER_INOTIFY
+		if (mNotify >= 0)
+			close(mNotify);
+#endif
+	}
+
+	void FileWatcher::watchFile (const std::string& file)
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+		if (!mFiles.insert(file).second)
+			return;
+
+		if (mBackend == FileWatcherBackend_Polling)
+		{
+			mNewFiles.insert(file);
+			return;
+		}
+
+#ifdef SH_FILEWATCHER_INOTIFY
+		// watch the directory instead of the file, since editors often save by replacing the file
+		std::string directory = boost::filesystem::path(file).parent_path().string();
+		int watch = inotify_add_watch(mNotify, directory.c_str(), sWatchMask);
+		if (watch < 0)
+		{
+			std::cerr << "sh::FileWatcher: Warning: Can't watch " << file << std::endl;
+			return;
+		}
+		if (mWatches.find(watch) == mWatches.end())
+		{
+			WatchedDirectory& watched = mWatches[watch];
+			watched.mPath = directory;
+			watched.mFiltered = true;
+		}
+#endif
+	}
+
+	bool FileWatcher::getChanges (std::vector<std::string>& out)
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+		out.insert(out.end(), mChanges.begin(), mChanges.end());
+		mChanges.clear();
+		mChangeSet.clear();
+		bool lost = mLost;
+		mLost = false;
+		return !lost;
+	}
+
+	void FileWatcher::post (const std::string& file)
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+		if (mChangeSet.insert(file).second)
+			mChanges.push_back(file);
+	}
+
+	void FileWatcher::watchDirectory (const std::string& directory, bool post)
+	{
+#ifdef SH_FILEWATCHER_INOTIFY
+		// add the watch before listing the files, so that no file that is created in the meantime is missed
+		int watch = inotify_add_watch(mNotify, directory.c_str(), sWatchMask);
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			if (watch < 0)
+			{
+				mLost = true;
+				return;
+			}
+			WatchedDirectory& watched = mWatches[watch];
+			watched.mPath = directory;
+			watched.mFiltered = false;
+		}
+
+		boost::system::error_code ec;
+		for (boost::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+		{
+			if (boost::filesystem::is_directory(it->status()))
+				watchDirectory(it->path().string(), post);
+			else if (post)
+				this->post(it->path().string());
+		}
+#endif
+	}
+
+	void FileWatcher::runNative ()
+	{
+#ifdef SH_FILEWATCHER_INOTIFY
+		std::vector<char> buffer (64 * 1024);
+		while (true)
+		{
+			boost::this_thread::interruption_point();
+
+			// wake up regularly to check for interruption
+			pollfd descriptor;
+			descriptor.fd = mNotify;
+			descriptor.events = POLLIN;
+			descriptor.revents = 0;
+			if (poll(&descriptor, 1, 100) <= 0)
+				continue;
+
+			ssize_t length = read(mNotify, &buffer[0], buffer.size());
+			if (length <= 0)
+				continue;
+
+			for (ssize_t offset = 0; offset < length; )
+			{
+				const inotify_event* event = reinterpret_cast<const inotify_event*>(&buffer[offset]);
+				offset += sizeof(inotify_event) + event->len;
+
+				WatchedDirectory directory;
+				{
+					boost::mutex::scoped_lock lock(mMutex);
+					if (event->mask & IN_Q_OVERFLOW)
+					{
+						mLost = true;
+						continue;
+					}
+					std::map<int, WatchedDirectory>::iterator watched = mWatches.find(event->wd);
+					if (watched == mWatches.end())
+						continue;
+					if (event->mask & IN_IGNORED)
+					{
+						// the directory was removed
+						mWatches.erase(watched);
+						continue;
+					}
+					directory = watched->second;
+				}
+				if (event->len == 0)
+					continue;
+
+				std::string file = (boost::filesystem::path(directory.mPath) / event->name).string();
+				if (event->mask & IN_ISDIR)
+				{
+					if (directory.mFiltered)
+						continue;
+					if (event->mask & (IN_CREATE | IN_MOVED_TO))
+						watchDirectory(file, true);
+					else
+					{
+						// the files that were in the directory are not known here
+						boost::mutex::scoped_lock lock(mMutex);
+						mLost = true;
+					}
+					continue;
+				}
+
+				if (directory.mFiltered)
+				{
+					boost::mutex::scoped_lock lock(mMutex);
+					if (mFiles.find(file) == mFiles.end())
+						continue;
+				}
+				post(file);
+			}
+		}
+#endif
+	}
+
+	void FileWatcher::runPolling ()
+	{
+		while (true)
+		{
+			boost::this_thread::sleep_for(boost::chrono::milliseconds(mPollInterval));
+			scan(true);
+		}
+	}
+
+	void FileWatcher::scan (bool post)
+	{
+		std::set<std::string> files;
+		std::set<std::string> newFiles;
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			files = mFiles;
+			newFiles.swap(mNewFiles);
+		}
+
+		boost::system::error_code ec;
+		for (boost::filesystem::recursive_directory_iterator it(mPath, ec), end; !ec && it != end; it.increment(ec))
+		{
+			if (boost::filesystem::is_regular_file(it->status()))
+				files.insert(it->path().string());
+		}
+
+		FileStateMap states;
+		for (std::set<std::string>::const_iterator it = files.begin(); it != files.end(); ++it)
+		{
+			boost::system::error_code ec;
+			FileState state;
+			state.mSize = boost::filesystem::file_size(*it, ec);
+			if (ec)
+				continue; // a watched file that does not exist (anymore)
+			state.mModified = boost::filesystem::last_write_time(*it, ec);
+			states[*it] = state;
+		}
+
+		if (post)
+		{
+			for (FileStateMap::const_iterator it = states.begin(); it != states.end(); ++it)
+			{
+				FileStateMap::const_iterator previous = mFileStates.find(it->first);
+				if (previous == mFileStates.end())
+				{
+					// files that were just passed to watchFile are not new
+					if (newFiles.find(it->first) == newFiles.end())
+						this->post(it->first);
+				}
+				else if (previous->second.mSize != it->second.mSize || previous->second.mModified != it->second.mModified)
+					this->post(it->first);
+			}
+			for (FileStateMap::const_iterator it = mFileStates.begin(); it != mFileStates.end(); ++it)
+			{
+				if (states.find(it->first) == states.end())
+					this->post(it->first);
+			}
+		}
+		mFileStates.swap(states);
+	}
+}
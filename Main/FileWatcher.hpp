@@ -0,0 +1,93 @@
+#ifndef SH_FILEWATCHER_H
+#define SH_FILEWATCHER_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <ctime>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace sh
+{
+	enum FileWatcherBackend
+	{
+		FileWatcherBackend_Native, ///< notifications of the operating system (inotify on Linux), falls back to polling where not available
+		FileWatcherBackend_Polling ///< compare the size and modification time of all files periodically
+	};
+
+	/**
+	 * @brief Watches a directory tree (and optionally files outside of it) on a background thread,
+	 * and collects the files that were modified, created, removed or renamed until they are picked up with \a getChanges.
+	 */
+	class FileWatcher : private boost::noncopyable
+	{
+	public:
+		/// @param path directory to watch, including all of its subdirectories
+		/// @param pollInterval milliseconds between two checks of all files, if polling is used
+		FileWatcher (const std::string& path, FileWatcherBackend backend = FileWatcherBackend_Native, unsigned int pollInterval = 500);
+		~FileWatcher ();
+
+		/// Also watch a file outside of the directory, e.g. a shader include. Watching a file more than once is fine.
+		void watchFile (const std::string& file);
+
+		/// Move the files that changed since the last call to \a out, each file only once.
+		/// The paths start with the path of the watched directory, or are the paths passed to \a watchFile.
+		/// @return false if changes may have been lost (e.g. the event queue of the system overflowed),
+		/// the caller then has to check all files itself
+		bool getChanges (std::vector<std::string>& out);
+
+		/// @return the backend that is actually in use
+		FileWatcherBackend getBackend () const { return mBackend; }
+
+	private:
+		void runNative ();
+		void runPolling ();
+
+		void post (const std::string& file);
+
+		/// size and modification time of a file, for polling
+		struct FileState
+		{
+			boost::uintmax_t mSize;
+			std::time_t mModified;
+		};
+		typedef std::map<std::string, FileState> FileStateMap;
+
+		/// Record the state of all watched files, and post the ones that differ from \a mFileStates
+		void scan (bool post);
+
+		/// Add native watches for \a directory and all of its subdirectories, and post the files in them if \a post is set
+		void watchDirectory (const std::string& directory, bool post);
+
+		std::string mPath;
+		FileWatcherBackend mBackend;
+		unsigned int mPollInterval;
+
+		boost::mutex mMutex;
+		std::vector<std::string> mChanges;
+		std::set<std::string> mChangeSet; ///< the files in mChanges
+		bool mLost; ///< changes were lost since the last getChanges
+		std::set<std::string> mFiles; ///< files outside of mPath, see watchFile
+		std::set<std::string> mNewFiles; ///< files that were passed to watchFile since the last scan
+
+		FileStateMap mFileStates; ///< only used by the polling thread
+
+		/// a directory with a native watch, files in a filtered directory are only reported if they are in mFiles
+		struct WatchedDirectory
+		{
+			std::string mPath;
+			bool mFiltered;
+		};
+		int mNotify; ///< inotify descriptor
+		std::map<int, WatchedDirectory> mWatches;
+
+		boost::thread* mThread;
+	};
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SH_HASH_H
+#define SH_HASH_H
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+namespace sh
+{
+	/**
+	 * @brief 64-bit FNV-1a hash, used to key caches by the contents of (potentially large) strings
+	 * @note Unlike boost::hash, the result is stable across platforms and program runs, so it may be persisted.
+	 */
+	class Hash
+	{
+	public:
+		Hash () : mValue(14695981039346656037ULL) {}
+
+		void add (const char* data, size_t size)
+		{
+			for (size_t i=0; i<size; ++i)
+			{
+				mValue ^= static_cast<unsigned char>(data[i]);
+				mValue *= 1099511628211ULL;
+			}
+		}
+
+		/// @note also hashes the terminating null character, so that e.g. ("ab", "c") and ("a", "bc") produce different results
+		void add (const std::string& str)
+		{
+			add (str.c_str(), str.size()+1);
+		}
+
+		boost::uint64_t get () const { return mValue; }
+
+	private:
+		boost::uint64_t mValue;
+	};
+}
+
+#endif
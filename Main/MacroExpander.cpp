@@ -0,0 +1,170 @@
+#include "MacroExpander.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+	bool isSpace (char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+	}
+
+	/// @return the ')' that matches the '(' at \a open, NULL if there is none
+	const char* findClosingParenthesis (const char* open, const char* end)
+	{
+		int depth = 0;
+		for (const char* it = open; it != end; ++it)
+		{
+			if (*it == '(')
+				++depth;
+			else if (*it == ')' && --depth == 0)
+				return it;
+		}
+		return NULL;
+	}
+}
+
+namespace sh
+{
+	MacroExpander::MacroExpander (char unknownPrefix)
+		: mUnknownPrefix(unknownPrefix)
+	{
+	}
+
+	void MacroExpander::addMacro (const std::string& name, const Handler& handler, ArgumentList arguments)
+	{
+		Macro macro;
+		macro.mName = name;
+		macro.mHandler = handler;
+		macro.mArguments = arguments;
+		mMacros.push_back(macro);
+	}
+
+	void MacroExpander::addBlockMacro (const std::string& name, const std::string& endName, const BlockHandler& handler, ArgumentList arguments)
+	{
+		Macro macro;
+		macro.mName = name;
+		macro.mEndMarker = "@" + endName;
+		macro.mBlockHandler = handler;
+		macro.mArguments = arguments;
+		mMacros.push_back(macro);
+	}
+
+	const MacroExpander::Macro* MacroExpander::findMacro (const char* name, const char* end) const
+	{
+		for (std::vector<Macro>::const_iterator it = mMacros.begin(); it != mMacros.end(); ++it)
+		{
+			if (static_cast<size_t>(end - name) >= it->mName.size() && std::memcmp(name, it->mName.data(), it->mName.size()) == 0)
+				return &*it;
+		}
+		return NULL;
+	}
+
+	void MacroExpander::expand (const std::string& source, std::string& result) const
+	{
+		expand(source.data(), source.data() + source.size(), result);
+	}
+
+	void MacroExpander::expand (const char* begin, const char* end, std::string& result) const
+	{
+		result.clear();
+		result.reserve(end - begin);
+
+		Arguments args;
+		std::string command;
+
+		const char* pos = begin;
+		while (pos != end)
+		{
+			const char* at = static_cast<const char*>(std::memchr(pos, '@', end - pos));
+			if (!at)
+			{
+				result.append(pos, end);
+				break;
+			}
+			result.append(pos, at);
+
+			const Macro* macro = findMacro(at+1, end);
+			if (!macro)
+			{
+				result += mUnknownPrefix;
+				pos = at+1;
+				continue;
+			}
+
+			const char* nameEnd = at+1+macro->mName.size();
+			const char* open = NULL;
+			const char* close = NULL;
+			if (macro->mArguments == ArgumentList_Flat)
+			{
+				open = std::find(at, end, '(');
+				close = std::find(at, end, ')');
+				if (open == end || close == end || close < open)
+					throw std::runtime_error ("missing argument list for macro \"@" + macro->mName + "\"");
+			}
+			else if (macro->mArguments == ArgumentList_Nested || (macro->mArguments == ArgumentList_Optional && nameEnd != end && *nameEnd == '('))
+			{
+				open = std::find(at, end, '(');
+				close = (open == end) ? NULL : findClosingParenthesis(open, end);
+				if (!close)
+					throw std::runtime_error ("missing argument list for macro \"@" + macro->mName + "\"");
+			}
+
+			args.clear();
+			if (open)
+			{
+				command.assign(at+1, open);
+				splitArguments(open+1, close, macro->mArguments != ArgumentList_Flat, args);
+				pos = close+1;
+			}
+			else
+			{
+				command = macro->mName;
+				pos = nameEnd;
+			}
+
+			if (macro->mEndMarker.empty())
+			{
+				macro->mHandler(command, args, result);
+				continue;
+			}
+
+			const char* blockEnd = std::search(pos, end, macro->mEndMarker.begin(), macro->mEndMarker.end());
+			if (blockEnd == end)
+				throw std::runtime_error ("missing " + macro->mEndMarker + " for macro \"@" + macro->mName + "\"");
+			Argument content = { pos, blockEnd };
+			macro->mBlockHandler(command, args, content, result);
+			pos = blockEnd + macro->mEndMarker.size();
+		}
+	}
+
+	void MacroExpander::splitArguments (const char* begin, const char* end, bool nested, Arguments& args)
+	{
+		while (true)
+		{
+			const char* argEnd = begin;
+			int depth = 0;
+			while (argEnd != end && (*argEnd != ',' || depth > 0))
+			{
+				if (nested && *argEnd == '(')
+					++depth;
+				else if (nested && *argEnd == ')')
+					--depth;
+				++argEnd;
+			}
+
+			Argument arg = { begin, argEnd };
+			while (arg.mBegin != arg.mEnd && isSpace(*arg.mBegin))
+				++arg.mBegin;
+			while (arg.mEnd != arg.mBegin && isSpace(*(arg.mEnd-1)))
+				--arg.mEnd;
+			args.push_back(arg);
+
+			if (argEnd == end)
+				break;
+			begin = argEnd+1;
+		}
+	}
+}
@@ -0,0 +1,89 @@
+#ifndef SH_MACROEXPANDER_H
+#define SH_MACROEXPANDER_H
+
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+
+namespace sh
+{
+	/**
+	 * @brief Expands a set of @sh* macros in a single pass over the source
+	 * @note Macros are matched by prefix (e.g. a macro registered as "shUniformProperty" also handles "@shUniformProperty4f").
+	 * The replacement of a macro is not scanned for macros again, handlers that need this can call \a expand themselves.
+	 */
+	class MacroExpander
+	{
+	public:
+		/// A part of the source, the arguments are not copied out of the source.
+		struct Argument
+		{
+			const char* mBegin;
+			const char* mEnd;
+
+			size_t size () const { return mEnd - mBegin; }
+			bool empty () const { return mBegin == mEnd; }
+			std::string str () const { return std::string(mBegin, mEnd); }
+
+			bool operator== (const std::string& other) const { return other.size() == size() && other.compare(0, other.size(), mBegin, size()) == 0; }
+			bool operator!= (const std::string& other) const { return !(*this == other); }
+		};
+		typedef std::vector<Argument> Arguments;
+
+		/// how the argument list of a macro is delimited
+		enum ArgumentList
+		{
+			ArgumentList_None, ///< the macro has no argument list
+			ArgumentList_Flat, ///< ends at the first ')', i.e. the arguments can not contain parentheses
+			ArgumentList_Nested, ///< ends at the matching ')', the arguments may contain parentheses (e.g. other macros)
+			ArgumentList_Optional ///< like ArgumentList_Nested, but only if the macro name is directly followed by '('
+		};
+
+		/// @param command the full command name, without the leading '@' (and without the argument list)
+		/// @param args the trimmed, comma separated arguments (empty for macros without argument list)
+		/// @param result string to append the replacement to
+		typedef boost::function<void (const std::string& command, const Arguments& args, std::string& result)> Handler;
+
+		/// @param content the source between the argument list and the end marker of the block
+		typedef boost::function<void (const std::string& command, const Arguments& args, const Argument& content, std::string& result)> BlockHandler;
+
+		/// @param unknownPrefix character to write in place of an '@' that does not start one of the registered macros
+		MacroExpander (char unknownPrefix = '@');
+
+		/// @param name name of the macro without the leading '@'
+		void addMacro (const std::string& name, const Handler& handler, ArgumentList arguments = ArgumentList_Flat);
+
+		/// Add a macro that spans everything up to \a endName, e.g. @shForeach(...) ... @shEndForeach
+		/// @param name name of the macro without the leading '@'
+		/// @param endName name of the macro that ends the block, without the leading '@'
+		void addBlockMacro (const std::string& name, const std::string& endName, const BlockHandler& handler,
+			ArgumentList arguments = ArgumentList_Nested);
+
+		/// Expands all registered macros in \a source and writes the result to \a result
+		void expand (const std::string& source, std::string& result) const;
+
+		/// Expands all registered macros in [\a begin, \a end) and writes the result to \a result
+		void expand (const char* begin, const char* end, std::string& result) const;
+
+	private:
+		struct Macro
+		{
+			std::string mName;
+			std::string mEndMarker; ///< '@' followed by the name of the block end, empty for macros that are not blocks
+			Handler mHandler;
+			BlockHandler mBlockHandler;
+			ArgumentList mArguments;
+		};
+
+		std::vector<Macro> mMacros;
+		char mUnknownPrefix;
+
+		const Macro* findMacro (const char* name, const char* end) const;
+
+		/// Split the arguments in [\a begin, \a end) at the commas (only those outside of parentheses if \a nested is set)
+		static void splitArguments (const char* begin, const char* end, bool nested, Arguments& args);
+	};
+}
+
+#endif
@@ -42,11 +42,16 @@ namespace sh
 			mMaterial->setLodLevels (retrieveValue<StringValue>(getProperty("lod_values"), NULL).get());
 	}
 
-	void MaterialInstance::destroyAll ()
+	void MaterialInstance::destroyAll (bool force)
 	{
-		if (hasProperty("create_configuration"))
+		if (!force && hasProperty("create_configuration"))
 			return;
-		mMaterial->removeAll();
+		StatisticsTimer timer (mFactory->getStatistics(), StatisticsPhase_DestroyAll);
+		timer.addTraceArgument("material", mName);
+		if (mFactory->getAsyncMaterialCreation())
+			mMaterial->retireAll(); // keep rendering the old techniques until the new ones are created
+		else
+			mMaterial->removeAll();
 		mTexUnits.clear();
 		mFailedToCreate = false;
 	}
@@ -61,6 +66,10 @@ namespace sh
 	{
 		if (mFailedToCreate)
 			return false;
+		StatisticsTimer timer (mFactory->getStatistics(), StatisticsPhase_CreateForConfiguration);
+		timer.addTraceArgument("material", mName);
+		timer.addTraceArgument("configuration", configuration);
+		timer.addTraceArgument("lod", lodIndex);
 		try{
 			mMaterial->ensureLoaded();
 			bool res = mMaterial->createConfiguration(configuration, lodIndex);
@@ -190,6 +199,49 @@ namespace sh
 		}
 	}
 
+	bool MaterialInstance::queueShaders (const std::string& configuration, unsigned short lodIndex, std::vector<PendingShaderInstancePtr>& out)
+	{
+		if (mFailedToCreate)
+			return true;
+
+		bool allowFixedFunction = true;
+		if (!mShadersEnabled && hasProperty("allow_fixed_function"))
+		{
+			allowFixedFunction = retrieveValue<BooleanValue>(getProperty("allow_fixed_function"), NULL).get();
+		}
+		if (!mShadersEnabled && allowFixedFunction)
+			return true;
+
+		mFactory->setActiveConfiguration (configuration);
+		mFactory->setActiveLodLevel (lodIndex);
+
+		bool allReady = true;
+		PassVector* passes = getParentPasses();
+		for (PassVector::iterator it = passes->begin(); it != passes->end(); ++it)
+		{
+			PropertySetGet* context = this;
+			it->setContext(context);
+			it->mShaderProperties.setContext(context);
+
+			const char* programs[] = { "vertex_program", "fragment_program" };
+			for (int i=0; i<2; ++i)
+			{
+				if (!it->hasProperty(programs[i]))
+					continue;
+				std::string shaderSet = retrieveValue<StringValue>(it->getProperty(programs[i]), context).get();
+				if (shaderSet.empty())
+					continue;
+
+				bool ready;
+				PendingShaderInstancePtr pending = mFactory->getShaderSet(shaderSet)->queueInstance(&it->mShaderProperties, &ready);
+				if (pending)
+					out.push_back(pending);
+				allReady = allReady && ready;
+			}
+		}
+		return allReady;
+	}
+
 	Material* MaterialInstance::getMaterial ()
 	{
 		return mMaterial.get();
@@ -7,6 +7,7 @@
 #include "PropertyBase.hpp"
 #include "Platform.hpp"
 #include "MaterialInstancePass.hpp"
+#include "ShaderSet.hpp"
 
 namespace sh
 {
@@ -71,7 +72,13 @@ namespace sh
 		void create (Platform* platform);
 		bool createForConfiguration (const std::string& configuration, unsigned short lodIndex);
 
-		void destroyAll ();
+		/// Queue the shader permutations that are required for the given configuration, without creating anything yet.
+		/// See Factory::precompile
+		/// @return true if all required permutations are available already, i.e. the configuration can be created without compiling
+		bool queueShaders (const std::string& configuration, unsigned short lodIndex, std::vector<PendingShaderInstancePtr>& out);
+
+		/// @param force also destroy a material with "create_configuration", which is otherwise only created once
+		void destroyAll (bool force = false);
 
 		void setShadersEnabled (bool enabled);
 
@@ -32,16 +32,31 @@ namespace sh
 		return false;
 	}
 
+	bool Platform::supportsMaterialLookup ()
+	{
+		return false;
+	}
+
 	bool Platform::supportsShaderSerialization ()
 	{
 		return false;
 	}
 
+	bool Platform::isMicrocodeCached (const std::string& /*name*/)
+	{
+		return false;
+	}
+
 	MaterialInstance* Platform::fireMaterialRequested (const std::string& name, const std::string& configuration, unsigned short lodIndex)
 	{
 		return mFactory->requestMaterial (name, configuration, lodIndex);
 	}
 
+	MaterialInstance* Platform::fireMaterialLookup (const std::string& name)
+	{
+		return mFactory->searchInstance (name);
+	}
+
 	void Platform::serializeShaders (const std::string& file)
 	{
 		throw std::runtime_error ("Shader serialization not supported by this platform");
@@ -64,6 +79,13 @@ namespace sh
 
 	// ------------------------------------------------------------------------------
 
+	void Material::retireAll ()
+	{
+		removeAll ();
+	}
+
+	// ------------------------------------------------------------------------------
+
 	bool TextureUnitState::setPropertyOverride (const std::string& name, PropertyValuePtr& value, PropertySetGet *context)
 	{
 		if (name == "texture_alias")
@@ -68,6 +68,10 @@ namespace sh
 		virtual bool createConfiguration (const std::string& name, unsigned short lodIndex) = 0; ///< @return false if already exists
 		virtual void removeAll () = 0; ///< remove all configurations
 
+		/// Like \a removeAll, but the platform may keep the old configurations around for rendering until they are
+		/// created again (see Factory::setAsyncMaterialCreation). The default implementation just calls \a removeAll.
+		virtual void retireAll ();
+
 		virtual bool isUnreferenced() = 0;
 		virtual void unreferenceTextures() = 0;
 		virtual void ensureLoaded() = 0;
@@ -120,6 +124,10 @@ namespace sh
 		 */
 		virtual bool supportsShaderSerialization ();
 
+		/// @return is there microcode for the gpu program with this name in the loaded microcode cache?
+		/// Only used for statistics, the default implementation returns false.
+		virtual bool isMicrocodeCached (const std::string& name);
+
 		/**
 		 * this will be \a true if the platform supports a listener that notifies the system
 		 * whenever a material is requested for rendering. if this is supported, shaders can be
@@ -128,6 +136,12 @@ namespace sh
 		 */
 		virtual bool supportsMaterialQueuedListener ();
 
+		/**
+		 * this will be \a true if the platform looks up the materials it does not know through
+		 * \a fireMaterialLookup. only then materials can be created when they are first used (see Factory::setLazyMaterialLoading)
+		 */
+		virtual bool supportsMaterialLookup ();
+
 		/**
 		 * fire event: material requested for rendering
 		 * @param name material name
@@ -135,6 +149,13 @@ namespace sh
 		 */
 		MaterialInstance* fireMaterialRequested (const std::string& name, const std::string& configuration, unsigned short lodIndex);
 
+		/**
+		 * fire event: the platform needs a material that it does not know (yet)
+		 * @param name material name
+		 * @return the material, after creating it if it was not used before. NULL if there is no material with this name
+		 */
+		MaterialInstance* fireMaterialLookup (const std::string& name);
+
 		std::string mCacheFolder;
 		Factory* mFactory;
 
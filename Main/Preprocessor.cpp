@@ -4,12 +4,122 @@
 #include <boost/wave/cpplexer/cpp_lex_token.hpp>
 #include <boost/wave/cpplexer/cpp_lex_iterator.hpp>
 
+#include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <ctime>
+#include <list>
+#include <map>
+
+#include "Hash.hpp"
+#include "BuiltinPreprocessor.hpp"
+
+namespace
+{
+	/// contents of included files, so that they are not read from disk again for every permutation
+	class IncludeCache
+	{
+	public:
+		IncludeCache ()
+			: mHits(0)
+			, mMisses(0)
+		{
+		}
+
+		/// @return false if the file could not be read
+		bool load (const std::string& filename, std::string& contents)
+		{
+			namespace bfs = boost::filesystem;
+
+			boost::mutex::scoped_lock lock(mMutex);
+
+			std::map<std::string, std::string>::iterator pathIt = mCanonicalPaths.find(filename);
+			if (pathIt == mCanonicalPaths.end())
+			{
+				boost::system::error_code ec;
+				bfs::path canonical = bfs::canonical(bfs::path(filename), ec);
+				if (ec)
+					return false;
+				pathIt = mCanonicalPaths.insert(std::make_pair(filename, canonical.string())).first;
+			}
+			const std::string& path = pathIt->second;
+
+			boost::system::error_code ec;
+			std::time_t lastModified = bfs::last_write_time(bfs::path(path), ec);
+			if (ec)
+				return false;
+
+			FileMap::iterator it = mFiles.find(path);
+			if (it != mFiles.end() && it->second.mLastModified == lastModified)
+			{
+				++mHits;
+				contents = it->second.mContents;
+				return true;
+			}
+
+			bfs::ifstream instream(bfs::path(path.c_str()));
+			if (!instream.is_open())
+				return false;
+			instream.unsetf(std::ios::skipws);
+
+			++mMisses;
+			File& file = mFiles[path];
+			file.mLastModified = lastModified;
+			file.mContents.assign(
+				std::istreambuf_iterator<char>(instream.rdbuf()),
+				std::istreambuf_iterator<char>());
+			contents = file.mContents;
+			return true;
+		}
+
+		void clear ()
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			mCanonicalPaths.clear();
+			mFiles.clear();
+		}
+
+		unsigned int getHits ()
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			return mHits;
+		}
+
+		unsigned int getMisses ()
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			return mMisses;
+		}
+
+	private:
+		struct File
+		{
+			std::time_t mLastModified;
+			std::string mContents;
+		};
+		typedef std::map<std::string, File> FileMap;
+
+		boost::mutex mMutex;
+		std::map<std::string, std::string> mCanonicalPaths; ///< include file name as passed by wave -> canonical path
+		FileMap mFiles; ///< canonical path -> contents
+		unsigned int mHits;
+		unsigned int mMisses;
+	};
+
+	IncludeCache sIncludeCache;
+
+	bool loadIncludeFile (const std::string& filename, std::string& contents)
+	{
+		return sIncludeCache.load(filename, contents);
+	}
+}
 
 /*
 	Almost exact copy of load_file_to_string policy found in
 	boost::wave headers with the only change that it uses
-	boost::filesystem facility to handle UTF-8 paths properly on windows.
+	boost::filesystem facility to handle UTF-8 paths properly on windows,
+	and that it reads the files through the include cache.
 
 	Original namespace is used due to required bost::wave
 	internal symbols.
@@ -32,17 +142,11 @@ namespace iteration_context_policies {
                                 namespace bfs = boost::filesystem;
 
 				// read in the file
-				bfs::ifstream instream(bfs::path(iter_ctx.filename.c_str()));
-				if (!instream.is_open()) {
+				if (!sIncludeCache.load(iter_ctx.filename.c_str(), iter_ctx.instring)) {
 					BOOST_WAVE_THROW_CTX(iter_ctx.ctx, preprocess_exception,
 						bad_include_file, iter_ctx.filename.c_str(), act_pos);
 					return;
 				}
-				instream.unsetf(std::ios::skipws);
-
-				iter_ctx.instring.assign(
-					std::istreambuf_iterator<char>(instream.rdbuf()),
-					std::istreambuf_iterator<char>());
 
 				iter_ctx.first = iterator_type(
 					iter_ctx.instring.begin(), iter_ctx.instring.end(),
@@ -56,10 +160,290 @@ namespace iteration_context_policies {
 	};
 } } }
 
+namespace
+{
+	/// least recently used cache of preprocessed sources, keyed by the full input
+	class PreprocessCache
+	{
+	public:
+		PreprocessCache ()
+			: mMaxSize(32*1024*1024)
+			, mSize(0)
+			, mHits(0)
+			, mMisses(0)
+		{
+		}
+
+		bool find (boost::uint64_t hash, const std::string& key, std::string& result)
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			for (IndexMap::iterator it = mIndex.lower_bound(hash); it != mIndex.end() && it->first == hash; ++it)
+			{
+				if (it->second->mKey == key)
+				{
+					mEntries.splice(mEntries.begin(), mEntries, it->second);
+					result = it->second->mResult;
+					++mHits;
+					return true;
+				}
+			}
+			++mMisses;
+			return false;
+		}
+
+		void insert (boost::uint64_t hash, const std::string& key, const std::string& result)
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			size_t size = key.size() + result.size();
+			if (size > mMaxSize)
+				return;
+
+			for (IndexMap::iterator it = mIndex.lower_bound(hash); it != mIndex.end() && it->first == hash; ++it)
+			{
+				// another thread was faster
+				if (it->second->mKey == key)
+					return;
+			}
+
+			Entry entry;
+			entry.mHash = hash;
+			entry.mKey = key;
+			entry.mResult = result;
+			mEntries.push_front(entry);
+			mIndex.insert(std::make_pair(hash, mEntries.begin()));
+			mSize += size;
+
+			trim();
+		}
+
+		void clear ()
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			mEntries.clear();
+			mIndex.clear();
+			mSize = 0;
+		}
+
+		void setMaxSize (size_t bytes)
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			mMaxSize = bytes;
+			trim();
+		}
+
+		size_t getMaxSize ()
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			return mMaxSize;
+		}
+
+		unsigned int getHits ()
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			return mHits;
+		}
+
+		unsigned int getMisses ()
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			return mMisses;
+		}
+
+	private:
+		struct Entry
+		{
+			boost::uint64_t mHash;
+			std::string mKey;
+			std::string mResult;
+		};
+		typedef std::list<Entry> EntryList;
+		typedef std::multimap<boost::uint64_t, EntryList::iterator> IndexMap;
+
+		/// remove the least recently used entries until the size limit is met
+		void trim ()
+		{
+			while (mSize > mMaxSize)
+			{
+				EntryList::iterator last = --mEntries.end();
+				for (IndexMap::iterator it = mIndex.lower_bound(last->mHash); it != mIndex.end() && it->first == last->mHash; ++it)
+				{
+					if (it->second == last)
+					{
+						mIndex.erase(it);
+						break;
+					}
+				}
+				mSize -= last->mKey.size() + last->mResult.size();
+				mEntries.erase(last);
+			}
+		}
+
+		boost::mutex mMutex;
+		EntryList mEntries; ///< most recently used first
+		IndexMap mIndex;
+		size_t mMaxSize;
+		size_t mSize;
+		unsigned int mHits;
+		unsigned int mMisses;
+	};
+
+	PreprocessCache sCache;
+
+	boost::mutex sCountersMutex;
+	unsigned int sBuiltinFallbacks = 0;
+	unsigned int sBackendMismatches = 0;
+
+	/// @return the first line that differs in \a builtin and \a wave, for error messages
+	std::string describeDifference (const std::string& builtin, const std::string& wave)
+	{
+		size_t offset = 0;
+		while (offset < builtin.size() && offset < wave.size() && builtin[offset] == wave[offset])
+			++offset;
+
+		size_t lineStart = (offset == 0) ? std::string::npos : builtin.rfind('\n', offset-1);
+		lineStart = (lineStart == std::string::npos) ? 0 : lineStart+1;
+		unsigned int line = 1 + std::count(builtin.begin(), builtin.begin() + lineStart, '\n');
+
+		std::stringstream description;
+		description << "line " << line << ", offset " << offset << "\n"
+			<< "  built-in: " << builtin.substr(lineStart, builtin.find('\n', offset) - lineStart) << "\n"
+			<< "  wave:     " << wave.substr(lineStart, wave.find('\n', offset) - lineStart);
+		return description.str();
+	}
+}
+
 namespace sh
 {
-	std::string Preprocessor::preprocess (std::string source, const std::string& includePath, std::vector<std::string> definitions, const std::string& name)
+	std::string Preprocessor::preprocess (std::string source, const std::string& includePath, std::vector<std::string> definitions, const std::string& name,
+		PreprocessorBackend backend)
+	{
+		if (sCache.getMaxSize() == 0)
+			return run(source, includePath, definitions, name, backend);
+
+		// the name is only used for error messages, so it is not part of the key
+		std::string key (1, static_cast<char>(backend));
+		key += includePath;
+		key += '\0';
+		for (std::vector<std::string>::const_iterator it = definitions.begin(); it != definitions.end(); ++it)
+		{
+			key += *it;
+			key += '\0';
+		}
+		key += '\0';
+		key += source;
+
+		Hash hash;
+		hash.add(key);
+
+		std::string result;
+		if (sCache.find(hash.get(), key, result))
+			return result;
+
+		result = run(source, includePath, definitions, name, backend);
+
+		// the result depends on the name if the source uses __FILE__, don't share it in that case
+		if (result.find(name) == std::string::npos)
+			sCache.insert(hash.get(), key, result);
+		return result;
+	}
+
+	void Preprocessor::setCacheSize (size_t bytes)
+	{
+		sCache.setMaxSize(bytes);
+	}
+
+	void Preprocessor::clearCache ()
+	{
+		sCache.clear();
+	}
+
+	void Preprocessor::clearIncludeCache ()
+	{
+		sIncludeCache.clear();
+	}
+
+	unsigned int Preprocessor::getIncludeCacheHits ()
+	{
+		return sIncludeCache.getHits();
+	}
+
+	unsigned int Preprocessor::getIncludeCacheMisses ()
+	{
+		return sIncludeCache.getMisses();
+	}
+
+	unsigned int Preprocessor::getBuiltinFallbacks ()
+	{
+		boost::mutex::scoped_lock lock(sCountersMutex);
+		return sBuiltinFallbacks;
+	}
+
+	unsigned int Preprocessor::getBackendMismatches ()
+	{
+		boost::mutex::scoped_lock lock(sCountersMutex);
+		return sBackendMismatches;
+	}
+
+	unsigned int Preprocessor::getCacheHits ()
+	{
+		return sCache.getHits();
+	}
+
+	unsigned int Preprocessor::getCacheMisses ()
+	{
+		return sCache.getMisses();
+	}
+
+	std::string Preprocessor::run (std::string source, const std::string& includePath, std::vector<std::string> definitions, const std::string& name,
+		PreprocessorBackend backend)
 	{
+		if (backend == PreprocessorBackend_Builtin)
+		{
+			std::string result;
+			if (BuiltinPreprocessor::preprocess(source, includePath, definitions, name, &loadIncludeFile, result))
+				return result;
+
+			// not supported, boost::wave will either handle it or report an error
+			boost::mutex::scoped_lock lock(sCountersMutex);
+			++sBuiltinFallbacks;
+		}
+		else if (backend == PreprocessorBackend_Compare)
+		{
+			std::string builtin;
+			bool supported = BuiltinPreprocessor::preprocess(source, includePath, definitions, name, &loadIncludeFile, builtin);
+			if (!supported)
+			{
+				boost::mutex::scoped_lock lock(sCountersMutex);
+				++sBuiltinFallbacks;
+			}
+
+			std::string wave;
+			try
+			{
+				wave = run(source, includePath, definitions, name, PreprocessorBackend_Wave);
+			}
+			catch (std::runtime_error& e)
+			{
+				if (!supported)
+					throw;
+				{
+					boost::mutex::scoped_lock lock(sCountersMutex);
+					++sBackendMismatches;
+				}
+				throw std::runtime_error(name + ": the built-in preprocessor accepted a source that boost::wave rejected: " + e.what());
+			}
+
+			if (supported && builtin != wave)
+			{
+				{
+					boost::mutex::scoped_lock lock(sCountersMutex);
+					++sBackendMismatches;
+				}
+				throw std::runtime_error(name + ": the built-in preprocessor output differs from boost::wave at " + describeDifference(builtin, wave));
+			}
+			return wave;
+		}
+
 		std::stringstream returnString;
 
 		// current file position is saved for exception handling
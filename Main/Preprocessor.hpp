@@ -18,6 +18,8 @@
 #include <boost/wave/util/macro_helpers.hpp>
 #include <boost/wave/preprocessing_hooks.hpp>
 
+#include "PreprocessorBackend.hpp"
+
 namespace sh
 {
 	/**
@@ -32,9 +34,40 @@ namespace sh
 		 * @param includePath path to search for includes (that are included with #include)
 		 * @param definitions macros to predefine (vector of strings of the format MACRO=value, or just MACRO to define it as 1)
 		 * @param name name to use for error messages
+		 * @param backend preprocessor implementation to use
 		 * @return processed string
 		 */
-		static std::string preprocess (std::string source, const std::string& includePath, std::vector<std::string> definitions, const std::string& name);
+		static std::string preprocess (std::string source, const std::string& includePath, std::vector<std::string> definitions, const std::string& name,
+			PreprocessorBackend backend = PreprocessorBackend_Wave);
+
+		/// Set the maximum amount of memory used for caching preprocessed sources, 0 disables the cache. \n
+		/// Different permutations often produce the same text after the property macros have been expanded,
+		/// the cache makes sure such identical jobs (same source, include path and definitions) are only run once.
+		static void setCacheSize (size_t bytes);
+
+		/// Must be called when any of the included files has changed.
+		static void clearCache ();
+
+		static unsigned int getCacheHits ();
+		static unsigned int getCacheMisses ();
+
+		/// Included files are kept in memory and only read again once their modification time changes. \n
+		/// Use this to release the memory, or if the files were changed without updating the modification time.
+		static void clearIncludeCache ();
+
+		static unsigned int getIncludeCacheHits ();
+		static unsigned int getIncludeCacheMisses ();
+
+		/// @return number of sources that the built-in backend could not handle and were passed to boost::wave instead
+		static unsigned int getBuiltinFallbacks ();
+
+		/// @return number of sources for which the built-in backend produced a different output than boost::wave
+		/// (only checked with PreprocessorBackend_Compare)
+		static unsigned int getBackendMismatches ();
+
+	private:
+		static std::string run (std::string source, const std::string& includePath, std::vector<std::string> definitions, const std::string& name,
+			PreprocessorBackend backend);
 	};
 
 
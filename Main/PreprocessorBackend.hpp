@@ -0,0 +1,14 @@
+#ifndef SH_PREPROCESSORBACKEND_H
+#define SH_PREPROCESSORBACKEND_H
+
+namespace sh
+{
+	enum PreprocessorBackend
+	{
+		PreprocessorBackend_Wave, ///< boost::wave, supports the complete C++ preprocessor
+		PreprocessorBackend_Builtin, ///< much faster, but only supports the subset that is typically used in shaders (falls back to boost::wave for anything else)
+		PreprocessorBackend_Compare ///< runs both and fails if the output of the built-in backend is not exactly the same as boost::wave's, for testing
+	};
+}
+
+#endif
@@ -5,22 +5,171 @@
 #include <map>
 #include <exception>
 #include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <new>
+#include <algorithm>
 
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "WorkQueue.hpp"
+#include "CacheArchive.hpp"
+#include "Hash.hpp"
+
+namespace
+{
+	/// snapshot entry header: version, file size, modification time, content hash, number of root nodes
+	const boost::uint32_t sSnapshotVersion = 2;
+	const size_t sSnapshotHeaderSize = 32;
+
+	boost::uint32_t readUInt32 (const char* data)
+	{
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+		return boost::uint32_t(bytes[0]) | (boost::uint32_t(bytes[1]) << 8) | (boost::uint32_t(bytes[2]) << 16) | (boost::uint32_t(bytes[3]) << 24);
+	}
+
+	boost::uint64_t readUInt64 (const char* data)
+	{
+		return boost::uint64_t(readUInt32(data)) | (boost::uint64_t(readUInt32(data+4)) << 32);
+	}
+
+	void writeUInt32 (std::string& out, boost::uint32_t value)
+	{
+		for (int i=0; i<4; ++i)
+			out += static_cast<char>((value >> (i*8)) & 0xff);
+	}
+
+	void writeUInt64 (std::string& out, boost::uint64_t value)
+	{
+		writeUInt32(out, static_cast<boost::uint32_t>(value));
+		writeUInt32(out, static_cast<boost::uint32_t>(value >> 32));
+	}
+
+	std::string readStream (std::istream& stream)
+	{
+		if (!stream.good())
+			return "";
+		std::stringstream buffer;
+		buffer << stream.rdbuf();
+		return buffer.str();
+	}
+
+	/// The contents of a file, mapped into memory if possible
+	class FileContents : private boost::noncopyable
+	{
+	public:
+		FileContents (const std::string& fileName)
+		{
+			namespace bip = boost::interprocess;
+			try
+			{
+				mFile.reset(new bip::file_mapping(fileName.c_str(), bip::read_only));
+				mRegion.reset(new bip::mapped_region(*mFile, bip::read_only));
+				mData = static_cast<const char*>(mRegion->get_address());
+				mSize = mRegion->get_size();
+			}
+			catch (bip::interprocess_exception&)
+			{
+				std::ifstream stream(fileName.c_str(), std::ios::binary);
+				mContents = readStream(stream);
+				mData = mContents.data();
+				mSize = mContents.size();
+			}
+		}
+
+		const char* getData () const { return mData; }
+		size_t getSize () const { return mSize; }
+
+	private:
+		boost::scoped_ptr<boost::interprocess::file_mapping> mFile;
+		boost::scoped_ptr<boost::interprocess::mapped_region> mRegion;
+		std::string mContents; ///< if the file could not be mapped
+		const char* mData;
+		size_t mSize;
+	};
+}
 
 namespace sh
 {
-	void ScriptLoader::loadAllFiles(ScriptLoader* c, const std::string& path)
+	/// The result of parsing one file on a worker thread
+	struct ScriptLoader::ParsedFile
+	{
+		boost::shared_ptr<ScriptLoader> mParser;
+		bool mFailed;
+		std::string mError;
+
+		ParsedFile() : mFailed(false) {}
+	};
+
+	void ScriptLoader::loadAllFiles(ScriptLoader* c, const std::string& path, unsigned int threadCount)
 	{
+		std::vector<std::string> files;
 		for ( boost::filesystem::recursive_directory_iterator end, dir(path); dir != end; ++dir )
 		{
 			boost::filesystem::path p(*dir);
 			if(p.extension() == c->mFileEnding)
+				files.push_back((*dir).path().string());
+		}
+		c->mFiles.insert(c->mFiles.end(), files.begin(), files.end());
+
+		if (threadCount == 0)
+			threadCount = std::max(1u, boost::thread::hardware_concurrency());
+		threadCount = std::min(threadCount, static_cast<unsigned int>(files.size()));
+
+		if (threadCount <= 1)
+		{
+			for (std::vector<std::string>::const_iterator it = files.begin(); it != files.end(); ++it)
 			{
-				c->mCurrentFileName = (*dir).path().string();
-				std::ifstream in((*dir).path().string().c_str(), std::ios::binary);
-				c->parseScript(in);
+				c->mCurrentFileName = *it;
+				c->parseFile(c->mCurrentFileName);
 			}
+			return;
+		}
+
+		std::vector<ParsedFile> parsedFiles (files.size());
+		{
+			WorkQueue workers (threadCount);
+			for (size_t i=0; i<files.size(); ++i)
+				workers.push(boost::bind(&ScriptLoader::_parseFileJob, &parsedFiles[i], files[i], c));
+			workers.wait();
+		}
+
+		for (size_t i=0; i<files.size(); ++i)
+		{
+			ScriptLoader& parser = *parsedFiles[i].mParser;
+			c->mCurrentFileName = files[i];
+			c->mArena.splice(parser.mArena);
+			c->mParsedNodes.swap(parser.mParsedNodes);
+			c->_addParsedNodes();
+			c->mSnapshotHits += parser.mSnapshotHits;
+			c->mSnapshotMisses += parser.mSnapshotMisses;
+
+			// the files after a broken one would not have been parsed, their nodes are released with parsedFiles
+			if (parsedFiles[i].mFailed)
+				throw std::runtime_error(parsedFiles[i].mError);
+		}
+	}
+
+	void ScriptLoader::_parseFileJob(ParsedFile* file, const std::string& fileName, const ScriptLoader* loader)
+	{
+		file->mParser.reset(new ScriptLoader(loader->mFileEnding));
+		file->mParser->mCurrentFileName = fileName;
+		file->mParser->setSnapshot(loader->mSnapshot, loader->mReadSnapshot, loader->mWriteSnapshot);
+		try
+		{
+			file->mParser->_parseFile(fileName);
+		}
+		catch (std::exception& e)
+		{
+			file->mFailed = true;
+			file->mError = e.what();
 		}
 	}
 
@@ -28,7 +177,18 @@ namespace sh
 		: mLoadOrder(0)
 		, mToken(TOKEN_NewLine)
 		, mLastToken(TOKEN_NewLine)
-
+		, mTokenStart(NULL)
+		, mTokenLength(0)
+		, mBufferStart(NULL)
+		, mPosition(NULL)
+		, mEnd(NULL)
+		, mFileNameCopy(NULL)
+		, mFileNameLength(0)
+		, mSnapshot(NULL)
+		, mReadSnapshot(false)
+		, mWriteSnapshot(false)
+		, mSnapshotHits(0)
+		, mSnapshotMisses(0)
 	{
 		mFileEnding = fileEnding;
 	}
@@ -40,12 +200,9 @@ namespace sh
 
 	void ScriptLoader::clearScriptList()
 	{
-		std::map <std::string, ScriptNode *>::iterator i;
-		for (i = m_scriptList.begin(); i != m_scriptList.end(); ++i)
-		{
-			delete i->second;
-		}
 		m_scriptList.clear();
+		mParsedNodes.clear();
+		mArena.clear();
 	}
 
 	ScriptNode *ScriptLoader::getConfigScript(const std::string &name)
@@ -73,52 +230,297 @@ namespace sh
 
 	void ScriptLoader::parseScript(std::ifstream &stream)
 	{
-		//Get first token
-		_nextToken(stream);
-		if (mToken == TOKEN_EOF)
+		std::string contents = readStream(stream);
+		stream.close();
+		parseScript(contents.data(), contents.size());
+	}
+
+	void ScriptLoader::parseScript(const char* data, size_t size)
+	{
+		try
 		{
-			stream.close();
-			return;
+			_parseBuffer(data, size);
+		}
+		catch (...)
+		{
+			// keep the nodes that were complete before the error
+			_addParsedNodes();
+			throw;
 		}
+		_addParsedNodes();
+	}
 
-		//Parse the script
-		_parseNodes(stream, 0);
+	void ScriptLoader::parseFile(const std::string& fileName)
+	{
+		try
+		{
+			_parseFile(fileName);
+		}
+		catch (...)
+		{
+			_addParsedNodes();
+			throw;
+		}
+		_addParsedNodes();
+	}
 
-		stream.close();
+	void ScriptLoader::setSnapshot(CacheArchive* snapshot, bool read, bool write)
+	{
+		mSnapshot = snapshot;
+		mReadSnapshot = read;
+		mWriteSnapshot = write;
 	}
 
-	void ScriptLoader::_nextToken(std::ifstream &stream)
+	ScriptNode* ScriptLoader::parseNode(const std::string& fileName, size_t offset)
 	{
-		//EOF token
-		if (!stream.good())
+		// empty files can't be mapped
+		boost::system::error_code ec;
+		boost::uintmax_t fileSize = boost::filesystem::file_size(fileName, ec);
+		if (ec || offset >= fileSize)
+			return NULL;
+
+		mCurrentFileName = fileName;
+		FileContents contents (fileName);
+		size_t firstNode = mParsedNodes.size();
+		try
 		{
-			mToken = TOKEN_EOF;
+			_parseBuffer(contents.getData(), contents.getSize(), offset, true);
+		}
+		catch (...)
+		{
+			_addParsedNodes();
+			throw;
+		}
+		ScriptNode* node = (mParsedNodes.size() > firstNode) ? mParsedNodes[firstNode] : NULL;
+		_addParsedNodes();
+		return node;
+	}
+
+	void ScriptLoader::_parseFile(const std::string& fileName)
+	{
+		// empty files can't be mapped
+		boost::system::error_code ec;
+		boost::uintmax_t fileSize = boost::filesystem::file_size(fileName, ec);
+		if (fileSize == 0 || ec)
 			return;
+
+		boost::int64_t modificationTime = 0;
+		std::string entry;
+		bool haveEntry = false;
+		if (mSnapshot)
+		{
+			modificationTime = boost::filesystem::last_write_time(fileName, ec);
+			haveEntry = mReadSnapshot && mSnapshot->find(fileName, entry) && entry.size() >= sSnapshotHeaderSize
+				&& readUInt32(entry.data()) == sSnapshotVersion && readUInt64(entry.data() + 4) == fileSize;
+			if (haveEntry && static_cast<boost::int64_t>(readUInt64(entry.data() + 12)) == modificationTime && _readSnapshot(entry))
+			{
+				++mSnapshotHits;
+				return;
+			}
 		}
 
-		//(Get next character)
-		int ch = stream.get();
+		FileContents contents (fileName);
+		const char* data = contents.getData();
+		size_t size = contents.getSize();
 
-		while ((ch == ' ' || ch == 9) && !stream.eof())
-		{    //Skip leading spaces / tabs
-			ch = stream.get();
+		if (!mSnapshot)
+		{
+			_parseBuffer(data, size);
+			return;
 		}
 
-		if (!stream.good())
+		Hash contentHash;
+		contentHash.add(data, size);
+
+		// only the modification time changed (e.g. the file was checked out again), the entry is still valid
+		if (haveEntry && readUInt64(entry.data() + 20) == contentHash.get() && _readSnapshot(entry))
+		{
+			++mSnapshotHits;
+			if (mWriteSnapshot)
+			{
+				std::string time;
+				writeUInt64(time, static_cast<boost::uint64_t>(modificationTime));
+				entry.replace(12, 8, time);
+				mSnapshot->insert(fileName, entry);
+			}
+			return;
+		}
+
+		++mSnapshotMisses;
+		_parseBuffer(data, size);
+		if (mWriteSnapshot)
+			mSnapshot->insert(fileName, _writeSnapshot(size, modificationTime, contentHash.get()));
+	}
+
+	void ScriptLoader::_parseBuffer(const char* data, size_t size, size_t offset, bool singleRoot)
+	{
+		mBufferStart = data;
+		mPosition = data + std::min(offset, size);
+		mEnd = data + size;
+		mChildStack.clear();
+		_copyFileName();
+
+		//Get first token
+		_nextToken();
+		if (mToken != TOKEN_EOF)
+		{
+			//Parse the script
+			_parseNodes(0, singleRoot);
+		}
+
+		// don't keep pointers into the buffer
+		mBufferStart = mPosition = mEnd = mTokenStart = NULL;
+		mTokenLength = 0;
+	}
+
+	void ScriptLoader::_copyFileName()
+	{
+		mFileNameLength = mCurrentFileName.size();
+		mFileNameCopy = mArena.copyString(mCurrentFileName.data(), mFileNameLength);
+	}
+
+	/// Reads the nodes of a snapshot entry, throws if the entry is truncated
+	struct ScriptLoader::SnapshotReader
+	{
+		const char* mPosition;
+		const char* mEnd;
+
+		SnapshotReader(const char* data, size_t size) : mPosition(data), mEnd(data + size) {}
+
+		void need(size_t size)
+		{
+			if (static_cast<size_t>(mEnd - mPosition) < size)
+				throw std::runtime_error("truncated snapshot entry");
+		}
+
+		boost::uint32_t readUInt32()
+		{
+			need(4);
+			boost::uint32_t value = ::readUInt32(mPosition);
+			mPosition += 4;
+			return value;
+		}
+
+		/// @return pointer to \a length bytes in the entry, NULL if \a length is 0
+		const char* readString(size_t& length)
+		{
+			length = readUInt32();
+			need(length);
+			const char* data = length ? mPosition : NULL;
+			mPosition += length;
+			return data;
+		}
+	};
+
+	bool ScriptLoader::_readSnapshot(const std::string& entry)
+	{
+		// the strings of the nodes point into this copy
+		char* data = static_cast<char*>(mArena.allocate(entry.size()));
+		std::memcpy(data, entry.data(), entry.size());
+
+		_copyFileName();
+
+		size_t firstNode = mParsedNodes.size();
+		try
+		{
+			boost::uint32_t rootCount = readUInt32(data + sSnapshotHeaderSize - 4);
+			SnapshotReader reader(data + sSnapshotHeaderSize, entry.size() - sSnapshotHeaderSize);
+			for (boost::uint32_t i=0; i<rootCount; ++i)
+				mParsedNodes.push_back(_readSnapshotNode(reader, NULL));
+			if (reader.mPosition != reader.mEnd)
+				throw std::runtime_error("invalid snapshot entry");
+		}
+		catch (std::runtime_error&)
+		{
+			mParsedNodes.resize(firstNode);
+			return false;
+		}
+		return true;
+	}
+
+	ScriptNode* ScriptLoader::_readSnapshotNode(SnapshotReader& reader, ScriptNode* parent)
+	{
+		size_t offset = parent ? 0 : reader.readUInt32();
+		size_t nameLength;
+		const char* name = reader.readString(nameLength);
+		ScriptNode* node = _createNode(parent, name, nameLength, offset);
+		node->mValue = reader.readString(node->mValueLength);
+
+		boost::uint32_t childCount = reader.readUInt32();
+		if (childCount)
+		{
+			// every child needs at least 12 bytes, check before allocating
+			reader.need(childCount * 12);
+			ScriptNode** children = static_cast<ScriptNode**>(mArena.allocate(childCount * sizeof(ScriptNode*)));
+			for (boost::uint32_t i=0; i<childCount; ++i)
+				children[i] = _readSnapshotNode(reader, node);
+			node->mChildren = children;
+			node->mChildCount = childCount;
+		}
+		return node;
+	}
+
+	std::string ScriptLoader::_writeSnapshot(boost::uint64_t size, boost::int64_t modificationTime, boost::uint64_t contentHash)
+	{
+		std::string out;
+		writeUInt32(out, sSnapshotVersion);
+		writeUInt64(out, size);
+		writeUInt64(out, static_cast<boost::uint64_t>(modificationTime));
+		writeUInt64(out, contentHash);
+		writeUInt32(out, static_cast<boost::uint32_t>(mParsedNodes.size()));
+		for (std::vector<ScriptNode*>::const_iterator it = mParsedNodes.begin(); it != mParsedNodes.end(); ++it)
+			_writeSnapshotNode(out, *it);
+		return out;
+	}
+
+	void ScriptLoader::_writeSnapshotNode(std::string& out, const ScriptNode* node)
+	{
+		if (!node->mParent)
+			writeUInt32(out, static_cast<boost::uint32_t>(node->mOffset));
+		writeUInt32(out, static_cast<boost::uint32_t>(node->mNameLength));
+		out.append(node->mName, node->mNameLength);
+		writeUInt32(out, static_cast<boost::uint32_t>(node->mValueLength));
+		out.append(node->mValue, node->mValueLength);
+		writeUInt32(out, static_cast<boost::uint32_t>(node->mChildCount));
+		for (size_t i=0; i<node->mChildCount; ++i)
+			_writeSnapshotNode(out, node->mChildren[i]);
+	}
+
+	void ScriptLoader::_addParsedNodes()
+	{
+		typedef std::pair<std::string, ScriptNode*> ScriptItem;
+
+		for (std::vector<ScriptNode*>::iterator it = mParsedNodes.begin(); it != mParsedNodes.end(); ++it)
+		{
+			// duplicates stay in the arena until the loader is destroyed
+			std::string key = (*it)->getValue();
+			if (!m_scriptList.insert(ScriptItem(key, *it)).second)
+				std::cout << "Script node '" << key << "' already exists" << std::endl;
+		}
+		mParsedNodes.clear();
+	}
+
+	void ScriptLoader::_nextToken()
+	{
+		//Skip leading spaces / tabs
+		while (mPosition != mEnd && (*mPosition == ' ' || *mPosition == 9))
+			++mPosition;
+
+		//EOF token
+		if (mPosition == mEnd)
 		{
 			mToken = TOKEN_EOF;
 			return;
 		}
 
+		//(Get next character)
+		unsigned char ch = *mPosition++;
+
 		//Newline token
 		if (ch == '\r' || ch == '\n')
 		{
-			do
-			{
-				ch = stream.get();
-			} while ((ch == '\r' || ch == '\n') && !stream.eof());
-
-			stream.unget();
+			while (mPosition != mEnd && (*mPosition == '\r' || *mPosition == '\n'))
+				++mPosition;
 
 			mToken = TOKEN_NewLine;
 			return;
@@ -144,53 +546,64 @@ namespace sh
 			throw std::runtime_error("Parse Error: Invalid character, ConfigLoader::load()");
 		}
 
-		mTokenValue = "";
 		mToken = TOKEN_Text;
+		mTokenStart = mPosition - 1;
+		const char* end = mTokenStart;
 		do
 		{
 			//Skip comments
-			if (ch == '/')
+			if (*end == '/' && end+1 != mEnd && end[1] == '/')
 			{
-				int ch2 = stream.peek();
-
-				//C++ style comment (//)
-				if (ch2 == '/')
-				{
-					stream.get();
-					do
-					{
-						ch = stream.get();
-					} while (ch != '\r' && ch != '\n' && !stream.eof());
-
-					mToken = TOKEN_NewLine;
-					return;
-				}
+				//C++ style comment (//), ends the token and the line (including the first line break character)
+				end += 2;
+				while (end != mEnd && *end != '\r' && *end != '\n')
+					++end;
+				if (end != mEnd)
+					++end;
+
+				mPosition = end;
+				mToken = TOKEN_NewLine;
+				return;
 			}
 
-			//Add valid char to tokVal
-			mTokenValue += (char)ch;
-
 			//Next char
-			ch = stream.get();
+			++end;
+			ch = (end != mEnd) ? *end : 0;
 
-		} while (ch > 32 && ch <= 122 && !stream.eof());
+		} while (ch > 32 && ch <= 122);
 
-		stream.unget();
-
-		return;
+		mTokenLength = end - mTokenStart;
+		mPosition = end;
 	}
 
-	void ScriptLoader::_skipNewLines(std::ifstream &stream)
+	void ScriptLoader::_skipNewLines()
 	{
 		while (mToken == TOKEN_NewLine)
 		{
-			_nextToken(stream);
+			_nextToken();
 		}
 	}
 
-	void ScriptLoader::_parseNodes(std::ifstream &stream, ScriptNode *parent)
+	ScriptNode* ScriptLoader::_createNode(ScriptNode *parent, const char* name, size_t nameLength, size_t offset)
 	{
-		typedef std::pair<std::string, ScriptNode*> ScriptItem;
+		ScriptNode* node = new (mArena.allocate(sizeof(ScriptNode))) ScriptNode();
+		node->mName = name;
+		node->mNameLength = nameLength;
+		node->mValue = NULL;
+		node->mValueLength = 0;
+		node->mFileName = mFileNameCopy;
+		node->mFileNameLength = mFileNameLength;
+		node->mOffset = offset;
+		node->mChildren = NULL;
+		node->mChildCount = 0;
+		node->mParent = parent;
+		return node;
+	}
+
+	void ScriptLoader::_parseNodes(ScriptNode *parent, bool singleRoot)
+	{
+		// the children of parent are collected on top of the stack
+		const size_t childStackBase = mChildStack.size();
 
 		while (true)
 		{
@@ -200,65 +613,67 @@ namespace sh
 				case TOKEN_Text:
 				{
 					//Add the new node
-					ScriptNode *newNode;
+					ScriptNode *newNode = _createNode(parent, mArena.copyString(mTokenStart, mTokenLength), mTokenLength, mTokenStart - mBufferStart);
 					if (parent)
+						mChildStack.push_back(newNode);
+
+					//Get values. Usually they are separated by single spaces, then the value can be copied from the buffer at once
+					_nextToken();
+					const char* valueStart = NULL;
+					const char* valueEnd = NULL;
+					std::string joinedValue;
+					bool joined = false;
+					while (mToken == TOKEN_Text)
 					{
-						newNode = parent->addChild(mTokenValue);
+						if (!valueStart)
+							valueStart = mTokenStart;
+						else if (joined || mTokenStart != valueEnd + 1 || *valueEnd != ' ')
+						{
+							if (!joined)
+								joinedValue.assign(valueStart, valueEnd);
+							joined = true;
+							joinedValue += ' ';
+							joinedValue.append(mTokenStart, mTokenLength);
+						}
+						valueEnd = mTokenStart + mTokenLength;
+						_nextToken();
 					}
-					else
+					if (joined)
 					{
-						newNode = new ScriptNode(0, mTokenValue);
+						newNode->mValue = mArena.copyString(joinedValue.data(), joinedValue.size());
+						newNode->mValueLength = joinedValue.size();
 					}
-
-					//Get values
-					_nextToken(stream);
-					std::string valueStr;
-					int i=0;
-					while (mToken == TOKEN_Text)
+					else if (valueStart)
 					{
-						if (i == 0)
-							valueStr += mTokenValue;
-						else
-							valueStr += " " + mTokenValue;
-						_nextToken(stream);
-						++i;
+						newNode->mValue = mArena.copyString(valueStart, valueEnd - valueStart);
+						newNode->mValueLength = valueEnd - valueStart;
 					}
-					newNode->setValue(valueStr);
 
-					_skipNewLines(stream);
+					_skipNewLines();
 
 					//Add any sub-nodes
 					if (mToken == TOKEN_OpenBrace)
 					{
 						//Parse nodes
-						_nextToken(stream);
-						_parseNodes(stream, newNode);
+						_nextToken();
+						_parseNodes(newNode);
 						//Check for matching closing brace
 						if (mToken != TOKEN_CloseBrace)
 						{
 							throw std::runtime_error("Parse Error: Expecting closing brace");
 						}
-						_nextToken(stream);
-						_skipNewLines(stream);
+						_nextToken();
+						_skipNewLines();
 					}
 
-					newNode->mFileName = mCurrentFileName;
-
-					//Add root nodes to scriptList
+					//Root nodes are added to scriptList by _addParsedNodes
 					if (!parent)
 					{
-						std::string key;
-
-						if (newNode->getValue() == "")
+						if (newNode->mValueLength == 0)
 								throw std::runtime_error("Root node must have a name (\"" + newNode->getName() + "\")");
-						key = newNode->getValue();
-
-						if (!m_scriptList.insert(ScriptItem(key, newNode)).second)
-						{
-							std::cout << "Script node '" << key << "' already exists" << std::endl;
-							delete newNode;
-							newNode = NULL;
-						}
+						mParsedNodes.push_back(newNode);
+						if (singleRoot)
+							return;
 					}
 
 					break;
@@ -271,52 +686,96 @@ namespace sh
 
 				//Return if end of nodes have been reached
 				case TOKEN_CloseBrace:
-					return;
-
 				//Return if reached end of file
 				case TOKEN_EOF:
+					if (parent && mChildStack.size() > childStackBase)
+					{
+						// move the children to a contiguous array in the arena
+						size_t count = mChildStack.size() - childStackBase;
+						ScriptNode** children = static_cast<ScriptNode**>(mArena.allocate(count * sizeof(ScriptNode*)));
+						std::copy(mChildStack.begin() + childStackBase, mChildStack.end(), children);
+						parent->mChildren = children;
+						parent->mChildCount = count;
+						mChildStack.resize(childStackBase);
+					}
 					return;
 
 				case TOKEN_NewLine:
-					_nextToken(stream);
+					_nextToken();
 					break;
 			}
 		};
 	}
 
-	ScriptNode::ScriptNode(ScriptNode *parent, const std::string &name)
+	ScriptNodeArena::ScriptNodeArena()
+		: mCurrent(NULL)
+		, mRemaining(0)
+	{
+	}
+
+	ScriptNodeArena::~ScriptNodeArena()
 	{
-		mName = name;
-		mParent = parent;
+		clear();
 	}
 
-	ScriptNode::~ScriptNode()
+	void* ScriptNodeArena::allocate(size_t size)
 	{
-		//Delete all children
-		std::vector<ScriptNode*>::iterator i;
-		for (i = mChildren.begin(); i != mChildren.end(); ++i)
+		static const size_t alignment = sizeof(void*);
+		static const size_t blockSize = 64 * 1024;
+
+		size = (size + alignment - 1) & ~(alignment - 1);
+		if (size > mRemaining)
 		{
-			ScriptNode *node = *i;
-			delete node;
+			// big allocations get their own block, so the rest of the current block is not wasted
+			if (size > blockSize / 4)
+			{
+				mBlocks.push_back(new char[size]);
+				return mBlocks.back();
+			}
+
+			mCurrent = new char[blockSize];
+			mRemaining = blockSize;
+			mBlocks.push_back(mCurrent);
 		}
-		mChildren.clear();
+
+		void* result = mCurrent;
+		mCurrent += size;
+		mRemaining -= size;
+		return result;
 	}
 
-	ScriptNode *ScriptNode::addChild(const std::string &name)
+	const char* ScriptNodeArena::copyString(const char* data, size_t length)
 	{
-		ScriptNode* node = new ScriptNode(this, name);
-		mChildren.push_back(node);
-		return node;
+		if (length == 0)
+			return NULL;
+		char* copy = static_cast<char*>(allocate(length));
+		std::memcpy(copy, data, length);
+		return copy;
 	}
 
-	ScriptNode *ScriptNode::findChild(const std::string &name)
+	void ScriptNodeArena::splice(ScriptNodeArena& other)
 	{
-		int childCount = (int)mChildren.size();
+		mBlocks.insert(mBlocks.end(), other.mBlocks.begin(), other.mBlocks.end());
+		other.mBlocks.clear();
+		other.mCurrent = NULL;
+		other.mRemaining = 0;
+	}
+
+	void ScriptNodeArena::clear()
+	{
+		for (std::vector<char*>::iterator it = mBlocks.begin(); it != mBlocks.end(); ++it)
+			delete[] *it;
+		mBlocks.clear();
+		mCurrent = NULL;
+		mRemaining = 0;
+	}
 
+	ScriptNode *ScriptNode::findChild(const std::string &name)
+	{
 		//Search for the node from start to finish
-		for (int indx = 0; indx < childCount; ++indx){
+		for (size_t indx = 0; indx < mChildCount; ++indx){
 			ScriptNode *node = mChildren[indx];
-			if (node->mName == name)
+			if (node->mNameLength == name.size() && std::memcmp(node->mName, name.data(), name.size()) == 0)
 				return node;
 		}
 
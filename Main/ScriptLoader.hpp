@@ -5,20 +5,80 @@
 #include <vector>
 #include <cassert>
 #include <string>
- 
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+
 namespace sh
 {
-    class ScriptNode;
+	class ScriptNode;
+	class CacheArchive;
+
+	/**
+	 * @brief Memory for the nodes and strings of a parsed script. Allocations are never freed individually,
+	 * all of them are released at once when the arena is cleared or destroyed.
+	 */
+	class ScriptNodeArena : private boost::noncopyable
+	{
+	public:
+		ScriptNodeArena();
+		~ScriptNodeArena();
+
+		/// @return \a size bytes of uninitialized memory, aligned for pointers
+		void* allocate(size_t size);
+
+		/// @return a copy of \a data in the arena, not null terminated
+		const char* copyString(const char* data, size_t length);
+
+		/// Take over all memory of \a other, which is empty afterwards.
+		void splice(ScriptNodeArena& other);
+
+		/// Release all memory. Any nodes or strings allocated from this arena are invalid afterwards.
+		void clear();
+
+	private:
+		std::vector<char*> mBlocks;
+		char* mCurrent;
+		size_t mRemaining;
+	};
+
+	/// The children of a \a ScriptNode, a contiguous array in the arena of the \a ScriptLoader
+	class ScriptNodeList
+	{
+	public:
+		typedef ScriptNode* const* const_iterator;
+
+		ScriptNodeList(const_iterator begin, const_iterator end) : mBegin(begin), mEnd(end) {}
+
+		const_iterator begin() const { return mBegin; }
+		const_iterator end() const { return mEnd; }
+		size_t size() const { return mEnd - mBegin; }
+		bool empty() const { return mBegin == mEnd; }
+
+		ScriptNode* operator[](size_t index) const
+		{
+			assert(index < size());
+			return mBegin[index];
+		}
+
+	private:
+		const_iterator mBegin;
+		const_iterator mEnd;
+	};
 
 	/**
 	 * @brief The base class of loaders that read Ogre style script files to get configuration and settings.
 	 * Heavily inspired by: http://www.ogre3d.org/tikiwiki/All-purpose+script+parser
 	 * ( "Non-ogre version")
+	 * @note The nodes are owned by the loader and are only valid as long as it exists.
 	 */
 	class ScriptLoader
 	{
 	public:
-		static void loadAllFiles(ScriptLoader* c, const std::string& path);
+		/// Parse all files in \a path (recursively) that have the file ending of \a c.
+		/// The files are parsed concurrently on \a threadCount worker threads (0 to use the number of hardware threads),
+		/// then their nodes are added in directory order, so that the first of several nodes with the same name wins as before.
+		static void loadAllFiles(ScriptLoader* c, const std::string& path, unsigned int threadCount = 0);
 
 		ScriptLoader(const std::string& fileEnding);
 		virtual ~ScriptLoader();
@@ -36,8 +96,38 @@ namespace sh
 
 		std::map <std::string, ScriptNode*> getAllConfigScripts ();
 
+		/// @return the files that were parsed by loadAllFiles, in the order their nodes were added
+		const std::vector<std::string>& getFiles () const { return mFiles; }
+
+		/// Parse the contents of a script file.
 		void parseScript(std::ifstream &stream);
 
+		/// Parse a script from memory. The buffer only needs to stay valid during the call,
+		/// tokens are read in place and only copied when nodes are created.
+		void parseScript(const char* data, size_t size);
+
+		/// Parse the script file at \a fileName, which is mapped into memory instead of being read.
+		/// If a snapshot is set and has an up to date entry for the file, the nodes are read from the snapshot instead.
+		void parseFile(const std::string& fileName);
+
+		/// Use a snapshot of the parsed nodes, to skip parsing of files that did not change since the last run. \n
+		/// An entry is up to date if the size and modification time of the file are unchanged. If only the modification time
+		/// changed, the content hash of the file decides.
+		/// @param snapshot may be NULL to disable the snapshot
+		/// @param read use the entries of the snapshot
+		/// @param write add an entry for every file that had to be parsed
+		void setSnapshot(CacheArchive* snapshot, bool read, bool write);
+
+		/// Parse only the root node that starts at \a offset in the file, see \a ScriptNode::getOffset
+		/// @return the node (which is also added to the loader like the nodes of parseFile), NULL if the file is shorter
+		ScriptNode* parseNode(const std::string& fileName, size_t offset);
+
+		/// @return number of files that were read from the snapshot
+		unsigned int getSnapshotHits() const { return mSnapshotHits; }
+
+		/// @return number of files that had to be parsed although a snapshot was set
+		unsigned int getSnapshotMisses() const { return mSnapshotMisses; }
+
 		std::string mCurrentFileName;
 
 	protected:
@@ -57,70 +147,131 @@ namespace sh
 		};
 
 		Token mToken, mLastToken;
-		std::string mTokenValue;
 
-		void _parseNodes(std::ifstream &stream, ScriptNode *parent);
-		void _nextToken(std::ifstream &stream);
-		void _skipNewLines(std::ifstream &stream);
+		/// the text of the current token, points into the buffer that is being parsed
+		const char* mTokenStart;
+		size_t mTokenLength;
+
+		/// the part of the buffer that is left to parse
+		const char* mBufferStart;
+		const char* mPosition;
+		const char* mEnd;
+
+		/// holds all nodes of this loader
+		ScriptNodeArena mArena;
+
+		/// mCurrentFileName, copied to the arena
+		const char* mFileNameCopy;
+		size_t mFileNameLength;
+
+		CacheArchive* mSnapshot;
+		bool mReadSnapshot;
+		bool mWriteSnapshot;
+		unsigned int mSnapshotHits;
+		unsigned int mSnapshotMisses;
+
+		/// see getFiles
+		std::vector<std::string> mFiles;
+
+		/// root nodes that were parsed, but not added to m_scriptList yet
+		std::vector<ScriptNode*> mParsedNodes;
+
+		/// children of the nodes that are being parsed, they are copied to the arena once a node is complete
+		std::vector<ScriptNode*> mChildStack;
+
+		struct ParsedFile;
+		static void _parseFileJob(ParsedFile* file, const std::string& fileName, const ScriptLoader* loader);
+
+		void _parseFile(const std::string& fileName);
+		/// @param offset position in the buffer to start parsing at
+		/// @param singleRoot stop after the first root node
+		void _parseBuffer(const char* data, size_t size, size_t offset = 0, bool singleRoot = false);
+		void _copyFileName();
+
+		/// Add the root nodes of a snapshot entry to mParsedNodes.
+		/// @return false if the entry is invalid, mParsedNodes is unchanged then
+		bool _readSnapshot(const std::string& entry);
+
+		/// @return a snapshot entry of the nodes in mParsedNodes
+		std::string _writeSnapshot(boost::uint64_t size, boost::int64_t modificationTime, boost::uint64_t contentHash);
+
+		struct SnapshotReader;
+		ScriptNode* _readSnapshotNode(SnapshotReader& reader, ScriptNode* parent);
+		static void _writeSnapshotNode(std::string& out, const ScriptNode* node);
+		void _addParsedNodes();
+
+		/// @param name has to be in the arena already
+		ScriptNode* _createNode(ScriptNode *parent, const char* name, size_t nameLength, size_t offset);
+		void _parseNodes(ScriptNode *parent, bool singleRoot = false);
+		void _nextToken();
+		void _skipNewLines();
 
 		void clearScriptList();
 	};
 
+	/// A node of a parsed script. Nodes are allocated by their \a ScriptLoader and can not be modified.
 	class ScriptNode
 	{
 	public:
-		ScriptNode(ScriptNode *parent, const std::string &name = "untitled");
-		~ScriptNode();
-
-		inline void setName(const std::string &name)
+		inline std::string getName() const
 		{
-			this->mName = name;
+			return std::string(mName, mNameLength);
 		}
 
-		inline std::string &getName()
+		inline std::string getValue() const
 		{
-			return mName;
+			return std::string(mValue, mValueLength);
 		}
 
-		inline void setValue(const std::string &value)
+		/// @return the file that this node was parsed from
+		inline std::string getFileName() const
 		{
-			mValue = value;
+			return std::string(mFileName, mFileNameLength);
 		}
 
-		inline std::string &getValue()
+		/// @return byte offset of the node in its file, to parse it again with \a ScriptLoader::parseNode
+		/// @note only known for root nodes
+		inline size_t getOffset() const
 		{
-			return mValue;
+			return mOffset;
 		}
 
-		ScriptNode *addChild(const std::string &name = "untitled");
 		ScriptNode *findChild(const std::string &name);
 
-		inline std::vector<ScriptNode*> &getChildren()
+		inline ScriptNodeList getChildren() const
 		{
-			return mChildren;
+			return ScriptNodeList(mChildren, mChildren + mChildCount);
 		}
 
 		inline ScriptNode *getChild(unsigned int index = 0)
 		{
-			assert(index < mChildren.size());
+			assert(index < mChildCount);
 			return mChildren[index];
 		}
- 
+
 		inline ScriptNode *getParent()
 		{
 			return mParent;
 		}
 
-		std::string mFileName;
+	private:
+		friend class ScriptLoader;
 
+		ScriptNode() {}
 
-	private:
-		std::string mName;
-		std::string mValue;
-		std::vector<ScriptNode*> mChildren;
+		// all strings point into the arena
+		const char* mName;
+		size_t mNameLength;
+		const char* mValue;
+		size_t mValueLength;
+		const char* mFileName;
+		size_t mFileNameLength;
+		size_t mOffset;
+		ScriptNode* const* mChildren;
+		size_t mChildCount;
 		ScriptNode *mParent;
 	};
- 
+
 }
- 
+
 #endif
@@ -5,14 +5,15 @@
 #include <fstream>
 
 #include <boost/lexical_cast.hpp>
-#include <boost/algorithm/string.hpp>
 #include <boost/bind.hpp>
 
 #include <boost/filesystem.hpp>
 
 #include "Preprocessor.hpp"
+#include "MacroExpander.hpp"
 #include "Factory.hpp"
 #include "ShaderSet.hpp"
+#include "CacheArchive.hpp"
 
 namespace
 {
@@ -51,9 +52,42 @@ namespace
 			return (num_components == 1) ? "float" : "vec" + boost::lexical_cast<std::string>(num_components);
 	}
 
-	bool isCmd (const std::string& source, size_t pos, const std::string& cmd)
+	void expandCounter (const std::string& /*command*/, const sh::MacroExpander::Arguments& args, std::string& result, std::map<int, int>& counters)
 	{
-		return (source.size() >= pos + cmd.size() && source.substr(pos, cmd.size()) == cmd);
+		assert(args.size());
+
+		int index = boost::lexical_cast<int>(args[0].mBegin, args[0].size());
+
+		if (counters.find(index) == counters.end())
+			counters[index] = 0;
+
+		result += boost::lexical_cast<std::string>(counters[index]++);
+	}
+
+	void expandIterator (const std::string& /*command*/, const sh::MacroExpander::Arguments& args, std::string& result,
+		const int& iteration, const sh::MacroExpander& expander)
+	{
+		int offset = 0;
+		if (!args.empty())
+		{
+			std::string offsetString;
+			expander.expand(args[0].mBegin, args[0].mEnd, offsetString);
+			offset = boost::lexical_cast<int>(offsetString);
+		}
+		result += boost::lexical_cast<std::string>(iteration + offset);
+	}
+
+	/// Append \a value to \a result, after expanding the macros in it
+	void appendExpanded (const std::string& value, const sh::MacroExpander& expander, std::string& result)
+	{
+		if (value.find('@') == std::string::npos)
+		{
+			result += value;
+			return;
+		}
+		std::string expanded;
+		expander.expand(value, expanded);
+		result += expanded;
 	}
 
 	void writeDebugFile (const std::string& content, const std::string& filename)
@@ -174,185 +208,152 @@ namespace sh
 
 	void ShaderInstance::parse (std::string& source, PropertySetGet* properties)
 	{
-		size_t pos = 0;
-		while (true)
+		MacroExpander expander;
+		expander.addMacro("shProperty", boost::bind(&ShaderInstance::expandProperty, this, _1, _2, _3, properties, boost::cref(expander)));
+		expander.addMacro("shGlobalSetting", boost::bind(&ShaderInstance::expandGlobalSetting, this, _1, _2, _3, boost::cref(expander)));
+		expander.addBlockMacro("shForeach", "shEndForeach", boost::bind(&ShaderInstance::expandForeach, this, _1, _2, _3, _4, boost::cref(expander)));
+
+		std::string expanded;
+		expander.expand(source, expanded);
+		source.swap(expanded);
+	}
+
+	void ShaderInstance::expandProperty (const std::string& command, const MacroExpander::Arguments& args, std::string& result,
+		PropertySetGet* properties, const MacroExpander& expander)
+	{
+		std::string replaceValue;
+		if (command == "shPropertyBool")
+		{
+			PropertyValuePtr value = properties->getProperty(args[0].str());
+			bool val = retrieveValue<BooleanValue>(value, properties->getContext()).get();
+			replaceValue = val ? "1" : "0";
+		}
+		else if (command == "shPropertyString")
+		{
+			PropertyValuePtr value = properties->getProperty(args[0].str());
+			replaceValue = retrieveValue<StringValue>(value, properties->getContext()).get();
+		}
+		else if (command == "shPropertyEqual")
+		{
+			std::string value = retrieveValue<StringValue>(properties->getProperty(args[0].str()), properties->getContext()).get();
+			replaceValue = (args[1] == value) ? "1" : "0";
+		}
+		else if (command == "shPropertyHasValue")
 		{
-			pos =  source.find("@", pos);
-			if (pos == std::string::npos)
-				break;
+			assert(args.size() == 1);
+			PropertyValuePtr value = properties->getProperty(args[0].str());
+			std::string val = retrieveValue<StringValue>(value, properties->getContext()).get();
+			replaceValue = (val.empty() ? "0" : "1");
+		}
+		else
+			throw std::runtime_error ("unknown command \"" + command + "\"");
+		appendExpanded(replaceValue, expander, result);
+	}
 
-			if (isCmd(source, pos, "@shProperty"))
-			{
-				std::vector<std::string> args = extractMacroArguments (pos, source);
-
-				size_t start = source.find("(", pos);
-				size_t end = source.find(")", pos);
-				std::string cmd = source.substr(pos+1, start-(pos+1));
-
-				std::string replaceValue;
-				if (cmd == "shPropertyBool")
-				{
-					std::string propertyName = args[0];
-					PropertyValuePtr value = properties->getProperty(propertyName);
-					bool val = retrieveValue<BooleanValue>(value, properties->getContext()).get();
-					replaceValue = val ? "1" : "0";
-				}
-				else if (cmd == "shPropertyString")
-				{
-					std::string propertyName = args[0];
-					PropertyValuePtr value = properties->getProperty(propertyName);
-					replaceValue = retrieveValue<StringValue>(value, properties->getContext()).get();
-				}
-				else if (cmd == "shPropertyEqual")
-				{
-					std::string propertyName = args[0];
-					std::string comparedAgainst = args[1];
-					std::string value = retrieveValue<StringValue>(properties->getProperty(propertyName), properties->getContext()).get();
-					replaceValue = (value == comparedAgainst) ? "1" : "0";
-				}
-				else if (isCmd(source, pos, "@shPropertyHasValue"))
-				{
-					assert(args.size() == 1);
-					std::string propertyName = args[0];
-					PropertyValuePtr value = properties->getProperty(propertyName);
-					std::string val = retrieveValue<StringValue>(value, properties->getContext()).get();
-					replaceValue = (val.empty() ? "0" : "1");
-				}
-				else
-					throw std::runtime_error ("unknown command \"" + cmd + "\"");
-				source.replace(pos, (end+1)-pos, replaceValue);
-			}
-			else if (isCmd(source, pos, "@shGlobalSetting"))
-			{
-				std::vector<std::string> args = extractMacroArguments (pos, source);
-
-				std::string cmd = source.substr(pos+1,  source.find("(", pos)-(pos+1));
-				std::string replaceValue;
-				if (cmd == "shGlobalSettingBool")
-				{
-					std::string settingName = args[0];
-					std::string value = retrieveValue<StringValue>(mParent->getCurrentGlobalSettings()->getProperty(settingName), NULL).get();
-					replaceValue = (value == "true" || value == "1") ? "1" : "0";
-				}
-				else if (cmd == "shGlobalSettingEqual")
-				{
-					std::string settingName = args[0];
-					std::string comparedAgainst = args[1];
-					std::string value = retrieveValue<StringValue>(mParent->getCurrentGlobalSettings()->getProperty(settingName), NULL).get();
-					replaceValue = (value == comparedAgainst) ? "1" : "0";
-				}
-				else if (cmd == "shGlobalSettingString")
-				{
-					std::string settingName = args[0];
-					replaceValue = retrieveValue<StringValue>(mParent->getCurrentGlobalSettings()->getProperty(settingName), NULL).get();
-				}
-				else
-					throw std::runtime_error ("unknown command \"" + cmd + "\"");
-
-				source.replace(pos, (source.find(")", pos)+1)-pos, replaceValue);
-			}
-			else if (isCmd(source, pos, "@shForeach"))
-			{
+	void ShaderInstance::expandGlobalSetting (const std::string& command, const MacroExpander::Arguments& args, std::string& result, const MacroExpander& expander)
+	{
+		std::string replaceValue;
+		if (command == "shGlobalSettingBool")
+		{
+			std::string value = retrieveValue<StringValue>(mGlobalSettings->getProperty(args[0].str()), NULL).get();
+			replaceValue = (value == "true" || value == "1") ? "1" : "0";
+		}
+		else if (command == "shGlobalSettingEqual")
+		{
+			std::string value = retrieveValue<StringValue>(mGlobalSettings->getProperty(args[0].str()), NULL).get();
+			replaceValue = (args[1] == value) ? "1" : "0";
+		}
+		else if (command == "shGlobalSettingString")
+		{
+			replaceValue = retrieveValue<StringValue>(mGlobalSettings->getProperty(args[0].str()), NULL).get();
+		}
+		else
+			throw std::runtime_error ("unknown command \"" + command + "\"");
+		appendExpanded(replaceValue, expander, result);
+	}
 
-				assert(source.find("@shEndForeach", pos) != std::string::npos);
-				size_t block_end = source.find("@shEndForeach", pos);
-
-				// get the argument for parsing
-				size_t start = source.find("(", pos);
-				size_t end = start;
-				int brace_depth = 1;
-				while (brace_depth > 0)
-				{
-					++end;
-					if (source[end] == '(')
-						++brace_depth;
-					else if (source[end] == ')')
-						--brace_depth;
-				}
-				std::string arg = source.substr(start+1, end-(start+1));
-				parse(arg, properties);
-
-				int num = boost::lexical_cast<int>(arg);
-
-				// get the content of the inner block
-				std::string content = source.substr(end+1, block_end - (end+1));
-
-				// replace both outer and inner block with content of inner block num times
-				std::string replaceStr;
-				for (int i=0; i<num; ++i)
-				{
-					// replace @shIterator with the current iteration
-					std::string addStr = content;
-
-					while (true)
-					{
-						size_t pos2 = addStr.find("@shIterator");
-						if (pos2 == std::string::npos)
-							break;
-
-						// optional offset parameter.
-						size_t openBracePos = pos2 + std::string("@shIterator").length();
-						if (addStr[openBracePos] == '(')
-						{
-							// get the argument for parsing
-							size_t _start = openBracePos;
-							size_t _end = _start;
-							int _brace_depth = 1;
-							while (_brace_depth > 0)
-							{
-								++_end;
-								if (addStr[_end] == '(')
-									++_brace_depth;
-								else if (addStr[_end] == ')')
-									--_brace_depth;
-							}
-							std::string arg = addStr.substr(_start+1, _end-(_start+1));
-							parse(arg, properties);
-
-							int offset = boost::lexical_cast<int> (arg);
-							addStr.replace(pos2, (_end+1)-pos2, boost::lexical_cast<std::string>(i+offset));
-						}
-						else
-						{
-							addStr.replace(pos2, std::string("@shIterator").length(), boost::lexical_cast<std::string>(i));
-						}
-					}
-
-					replaceStr += addStr;
-				}
-				source.replace(pos, (block_end+std::string("@shEndForeach").length())-pos, replaceStr);
-			}
-			else if (source.size() > pos+1)
-				++pos; // skip
+	void ShaderInstance::expandForeach (const std::string& /*command*/, const MacroExpander::Arguments& args, const MacroExpander::Argument& content, std::string& result,
+		const MacroExpander& expander)
+	{
+		std::string count;
+		expander.expand(args[0].mBegin, args[0].mEnd, count);
+		int num = boost::lexical_cast<int>(count);
+
+		// replace @shIterator with the current iteration in every copy of the block
+		int iteration = 0;
+		MacroExpander iteratorExpander;
+		iteratorExpander.addMacro("shIterator", boost::bind(&expandIterator, _1, _2, _3, boost::cref(iteration), boost::cref(expander)),
+			MacroExpander::ArgumentList_Optional);
+
+		std::string block, copy;
+		for (; iteration < num; ++iteration)
+		{
+			iteratorExpander.expand(content.mBegin, content.mEnd, copy);
+			block += copy;
 		}
 
+		// the copies may contain any of the other macros, e.g. properties with the iteration in their name
+		appendExpanded(block, expander, result);
+	}
+
+	ShaderInstance::ShaderInstance (ShaderSet* parent, const std::string& name, const std::string& permutationKey, PropertySetGet* properties)
+		: mName(name)
+		, mPermutationKey(permutationKey)
+		, mParent(parent)
+		, mSupported(true)
+		, mLanguage(Language_None)
+		, mGlobalSettings(NULL)
+		, mCurrentPassthrough(0)
+		, mCurrentComponent(0)
+	{
+		TraceScope trace (Factory::getInstance().getStatistics().getTracer(), "ShaderInstance");
+		trace.addArgument("permutation", mName);
+		generateSource (properties, mParent->getCurrentGlobalSettings(), Factory::getInstance().getCurrentLanguage());
+		compile ();
 	}
 
-	ShaderInstance::ShaderInstance (ShaderSet* parent, const std::string& name, PropertySetGet* properties)
+	ShaderInstance::ShaderInstance (ShaderSet* parent, const std::string& name, const std::string& permutationKey)
 		: mName(name)
+		, mPermutationKey(permutationKey)
 		, mParent(parent)
 		, mSupported(true)
+		, mLanguage(Language_None)
+		, mGlobalSettings(NULL)
 		, mCurrentPassthrough(0)
 		, mCurrentComponent(0)
 	{
+	}
+
+	void ShaderInstance::generateSource (PropertySetGet* properties, PropertySetGet* globalSettings, Language lang)
+	{
+		mLanguage = lang;
+		mGlobalSettings = globalSettings;
+
 		std::string source = mParent->getSource();
-		int type = mParent->getType();
 		std::string basePath = mParent->getBasePath();
-		size_t pos;
-
-		bool readCache = Factory::getInstance ().getReadSourceCache () && boost::filesystem::exists(
-					Factory::getInstance ().getCacheFolder () + "/" + mName);
-		bool writeCache = Factory::getInstance ().getWriteSourceCache ();
+		const std::string& name = mName;
+		std::string expanded;
 
+		Statistics& statistics = Factory::getInstance ().getStatistics ();
+		TraceScope trace (statistics.getTracer(), "generateSource");
+		trace.addArgument("permutation", mName);
 
-		if (readCache)
+		CacheArchive* sourceCache = Factory::getInstance ().getSourceCache ();
+		std::string cacheName = mParent->getSourceCacheName(mPermutationKey);
+		bool readCache = false;
+		if (sourceCache && Factory::getInstance ().getReadSourceCache ())
 		{
-			std::ifstream ifs( std::string(Factory::getInstance ().getCacheFolder () + "/" + mName).c_str() );
-			std::stringstream ss;
-			ss << ifs.rdbuf();
-			source = ss.str();
+			StatisticsTimer timer (statistics, StatisticsPhase_SourceCacheRead);
+			readCache = sourceCache->find(cacheName, source);
+			statistics.increment(readCache ? StatisticsCounter_SourceCacheHit : StatisticsCounter_SourceCacheMiss);
 		}
-		else
+		bool writeCache = sourceCache && Factory::getInstance ().getWriteSourceCache ();
+
+		// the post processing is split by the cache write, but counted as one phase
+		boost::chrono::nanoseconds postProcessTime (0);
+		boost::chrono::steady_clock::time_point postProcessStart;
+
+		if (!readCache)
 		{
 			std::vector<std::string> definitions;
 
@@ -360,9 +361,12 @@ namespace sh
 				definitions.push_back("SH_VERTEX_SHADER");
 			else
 				definitions.push_back("SH_FRAGMENT_SHADER");
-			definitions.push_back(convertLang(Factory::getInstance().getCurrentLanguage()));
+			definitions.push_back(convertLang(mLanguage));
 
-			parse(source, properties);
+			{
+				StatisticsTimer timer (statistics, StatisticsPhase_MacroParse);
+				parse(source, properties);
+			}
 
 			if (Factory::getInstance ().getShaderDebugOutputEnabled ())
 				writeDebugFile(source, name + ".pre");
@@ -372,292 +376,225 @@ namespace sh
 			// commands are _only executed if the specific code path actually "survives" the compilation.
 			// thus, we run the code through a preprocessor first to remove the parts that are unused because of
 			// unmet #if conditions (or other preprocessor directives).
-			source = Preprocessor::preprocess(source, basePath, definitions, name);
-
-			// parse counter
-			std::map<int, int> counters;
-			while (true)
 			{
-				pos = source.find("@shCounter");
-				if (pos == std::string::npos)
-					break;
-
-				size_t end = source.find(")", pos);
-
-				std::vector<std::string> args = extractMacroArguments (pos, source);
-				assert(args.size());
-
-				int index = boost::lexical_cast<int>(args[0]);
-
-				if (counters.find(index) == counters.end())
-					counters[index] = 0;
-
-				source.replace(pos, (end+1)-pos, boost::lexical_cast<std::string>(counters[index]++));
+				StatisticsTimer timer (statistics, StatisticsPhase_Preprocess);
+				source = Preprocessor::preprocess(source, basePath, definitions, name, Factory::getInstance().getPreprocessorBackend());
 			}
 
-			// parse passthrough declarations
-			while (true)
-			{
-				pos = source.find("@shAllocatePassthrough");
-				if (pos == std::string::npos)
-					break;
-
-				if (mCurrentPassthrough > 7)
-					throw std::runtime_error ("too many passthrough's requested (max 8)");
-
-				std::vector<std::string> args = extractMacroArguments (pos, source);
-				assert(args.size() == 2);
-
-				size_t end = source.find(")", pos);
-
-				Passthrough passthrough;
-
-				passthrough.num_components = boost::lexical_cast<int>(args[0]);
-				assert (passthrough.num_components != 0);
-
-				std::string passthroughName = args[1];
-				passthrough.lang = Factory::getInstance().getCurrentLanguage ();
-				passthrough.component_start = mCurrentComponent;
-				passthrough.passthrough_number = mCurrentPassthrough;
-
-				mPassthroughMap[passthroughName] = passthrough;
-
-				mCurrentComponent += passthrough.num_components;
-				if (mCurrentComponent > 3)
-				{
-					mCurrentComponent -= 4;
-					++mCurrentPassthrough;
-				}
-
-				source.erase(pos, (end+1)-pos);
-			}
+			TraceScope postProcessTrace (statistics.getTracer(), "postProcess");
+			postProcessStart = boost::chrono::steady_clock::now();
 
-			// passthrough assign
-			while (true)
-			{
-				pos = source.find("@shPassthroughAssign");
-				if (pos == std::string::npos)
-					break;
-
-				std::vector<std::string> args = extractMacroArguments (pos, source);
-				assert(args.size() == 2);
+			// parse counters
+			MacroExpander counterExpander;
+			std::map<int, int> counters;
+			counterExpander.addMacro("shCounter", boost::bind(&expandCounter, _1, _2, _3, boost::ref(counters)));
+			counterExpander.expand(source, expanded);
+			source.swap(expanded);
+
+			// parse passthrough declarations. these need to be known before any of the other passthrough macros are expanded
+			MacroExpander declarationExpander;
+			declarationExpander.addMacro("shAllocatePassthrough", boost::bind(&ShaderInstance::allocatePassthrough, this, _1, _2, _3));
+			declarationExpander.expand(source, expanded);
+			source.swap(expanded);
+
+			// passthrough assign, receive, vertex outputs and fragment inputs
+			MacroExpander passthroughExpander;
+			passthroughExpander.addMacro("shPassthroughAssign", boost::bind(&ShaderInstance::expandPassthroughAssign, this, _1, _2, _3));
+			passthroughExpander.addMacro("shPassthroughReceive", boost::bind(&ShaderInstance::expandPassthroughReceive, this, _1, _2, _3));
+			passthroughExpander.addMacro("shPassthroughVertexOutputs", boost::bind(&ShaderInstance::expandPassthroughDeclarations, this, _1, _2, _3),
+				MacroExpander::ArgumentList_None);
+			passthroughExpander.addMacro("shPassthroughFragmentInputs", boost::bind(&ShaderInstance::expandPassthroughDeclarations, this, _1, _2, _3),
+				MacroExpander::ArgumentList_None);
+			passthroughExpander.expand(source, expanded);
+			source.swap(expanded);
+
+			postProcessTime += boost::chrono::steady_clock::now() - postProcessStart;
+		}
 
-				size_t end = source.find(")", pos);
+		// save to cache _here_ - we want to preserve some macros
+		if (writeCache && !readCache)
+		{
+			StatisticsTimer timer (statistics, StatisticsPhase_SourceCacheWrite);
+			sourceCache->insert(cacheName, source);
+		}
 
-				std::string passthroughName = args[0];
-				std::string assignTo = args[1];
+		TraceScope bindingTrace (statistics.getTracer(), "postProcess");
+		postProcessStart = boost::chrono::steady_clock::now();
 
-				assert(mPassthroughMap.find(passthroughName) != mPassthroughMap.end());
-				Passthrough& p = mPassthroughMap[passthroughName];
+		// parse shared parameters, auto constants, uniform properties and texture samplers used,
+		// and convert any left-over @'s to #
+		MacroExpander bindingExpander ('#');
+		bindingExpander.addMacro("shSharedParameter", boost::bind(&ShaderInstance::parseSharedParameter, this, _1, _2, _3));
+		bindingExpander.addMacro("shAutoConstant", boost::bind(&ShaderInstance::parseAutoConstant, this, _1, _2, _3));
+		bindingExpander.addMacro("shUniformProperty", boost::bind(&ShaderInstance::parseUniformProperty, this, _1, _2, _3));
+		bindingExpander.addMacro("shUseSampler", boost::bind(&ShaderInstance::parseUsedSampler, this, _1, _2, _3));
+		bindingExpander.expand(source, expanded);
+		source.swap(expanded);
 
-				source.replace(pos, (end+1)-pos, p.expand_assign(assignTo));
-			}
+		postProcessTime += boost::chrono::steady_clock::now() - postProcessStart;
+		statistics.addTime(StatisticsPhase_PostProcess, static_cast<boost::uint64_t>(postProcessTime.count()));
 
-			// passthrough receive
-			while (true)
-			{
-				pos = source.find("@shPassthroughReceive");
-				if (pos == std::string::npos)
-					break;
+		mSource.swap(source);
+		mGlobalSettings = NULL;
+	}
 
-				std::vector<std::string> args = extractMacroArguments (pos, source);
-				assert(args.size() == 1);
+	void ShaderInstance::compile ()
+	{
+		Platform* platform = Factory::getInstance().getPlatform();
 
-				size_t end = source.find(")", pos);
-				std::string passthroughName = args[0];
+		std::string profile;
+		if (mLanguage == Language_CG)
+			profile = mParent->getCgProfile ();
+		else if (mLanguage == Language_HLSL)
+			profile = mParent->getHlslProfile ();
 
-				assert(mPassthroughMap.find(passthroughName) != mPassthroughMap.end());
-				Passthrough& p = mPassthroughMap[passthroughName];
+		Statistics& statistics = Factory::getInstance().getStatistics();
+		if (Factory::getInstance().getReadMicrocodeCache() && platform->supportsShaderSerialization())
+			statistics.increment(platform->isMicrocodeCached(mName) ? StatisticsCounter_MicrocodeCacheHit : StatisticsCounter_MicrocodeCacheMiss);
 
-				source.replace(pos, (end+1)-pos, p.expand_receive());
-			}
+		StatisticsTimer timer (statistics, StatisticsPhase_CreateGpuProgram);
+		timer.addTraceArgument("permutation", mName);
+		int type = mParent->getType();
+		if (type == GPT_Vertex)
+			mProgram = boost::shared_ptr<GpuProgram>(platform->createGpuProgram(GPT_Vertex, "", mName, profile, mSource, mLanguage));
+		else if (type == GPT_Fragment)
+			mProgram = boost::shared_ptr<GpuProgram>(platform->createGpuProgram(GPT_Fragment, "", mName, profile, mSource, mLanguage));
 
-			// passthrough vertex outputs
-			while (true)
-			{
-				pos = source.find("@shPassthroughVertexOutputs");
-				if (pos == std::string::npos)
-					break;
-
-				std::string result;
-				for (int i = 0; i < mCurrentPassthrough+1; ++i)
-				{
-					// not using newlines here, otherwise the line numbers reported by compiler would be messed up..
-					if (Factory::getInstance().getCurrentLanguage () == Language_CG || Factory::getInstance().getCurrentLanguage () == Language_HLSL)
-						result += ", out float4 passthrough" + boost::lexical_cast<std::string>(i) + " : TEXCOORD" + boost::lexical_cast<std::string>(i);
-
-					/*
-					else
-						result += "out vec4 passthrough" + boost::lexical_cast<std::string>(i) + "; ";
-						*/
-					else
-						result += "varying vec4 passthrough" + boost::lexical_cast<std::string>(i) + "; ";
-				}
-
-				source.replace(pos, std::string("@shPassthroughVertexOutputs").length(), result);
-			}
+		if (Factory::getInstance ().getShaderDebugOutputEnabled ())
+			writeDebugFile(mSource, mName);
 
-			// passthrough fragment inputs
-			while (true)
+		if (!mProgram->getSupported())
+		{
+			std::cerr << "        Full source code below: \n" << mSource << std::endl;
+			mSupported = false;
+		}
+		else
+		{
+			// set auto constants
+			for (AutoConstantMap::iterator it = mAutoConstants.begin(); it != mAutoConstants.end(); ++it)
 			{
-				pos = source.find("@shPassthroughFragmentInputs");
-				if (pos == std::string::npos)
-					break;
-
-				std::string result;
-				for (int i = 0; i < mCurrentPassthrough+1; ++i)
-				{
-					// not using newlines here, otherwise the line numbers reported by compiler would be messed up..
-					if (Factory::getInstance().getCurrentLanguage () == Language_CG || Factory::getInstance().getCurrentLanguage () == Language_HLSL)
-						result += ", in float4 passthrough" + boost::lexical_cast<std::string>(i) + " : TEXCOORD" + boost::lexical_cast<std::string>(i);
-					/*
-					else
-						result += "in vec4 passthrough" + boost::lexical_cast<std::string>(i) + "; ";
-						*/
-					else
-						result += "varying vec4 passthrough" + boost::lexical_cast<std::string>(i) + "; ";
-				}
-
-				source.replace(pos, std::string("@shPassthroughFragmentInputs").length(), result);
+				mProgram->setAutoConstant(it->first, it->second.first, it->second.second);
 			}
 		}
 
-		// save to cache _here_ - we want to preserve some macros
-		if (writeCache && !readCache)
-		{
-			std::ofstream of (std::string(Factory::getInstance ().getCacheFolder () + "/" + mName).c_str(), std::ios_base::out);
-			of.write(source.c_str(), source.size());
-			of.close();
-		}
+		// no longer needed, and we don't want to carry it around when this instance is copied
+		std::string().swap(mSource);
+	}
 
+	void ShaderInstance::allocatePassthrough (const std::string& /*command*/, const MacroExpander::Arguments& args, std::string& /*result*/)
+	{
+		if (mCurrentPassthrough > 7)
+			throw std::runtime_error ("too many passthrough's requested (max 8)");
 
-		// parse shared parameters
-		while (true)
-		{
-			pos = source.find("@shSharedParameter");
-			if (pos == std::string::npos)
-				break;
+		assert(args.size() == 2);
 
-			std::vector<std::string> args = extractMacroArguments (pos, source);
-			assert(args.size());
+		Passthrough passthrough;
 
-			size_t end = source.find(")", pos);
+		passthrough.num_components = boost::lexical_cast<int>(args[0].mBegin, args[0].size());
+		assert (passthrough.num_components != 0);
 
-			mSharedParameters.push_back(args[0]);
+		std::string passthroughName = args[1].str();
+		passthrough.lang = mLanguage;
+		passthrough.component_start = mCurrentComponent;
+		passthrough.passthrough_number = mCurrentPassthrough;
 
-			source.erase(pos, (end+1)-pos);
-		}
+		mPassthroughMap[passthroughName] = passthrough;
 
-		// parse auto constants
-		typedef std::map< std::string, std::pair<std::string, std::string> > AutoConstantMap;
-		AutoConstantMap autoConstants;
-		while (true)
+		mCurrentComponent += passthrough.num_components;
+		if (mCurrentComponent > 3)
 		{
-			pos = source.find("@shAutoConstant");
-			if (pos == std::string::npos)
-				break;
-
-			std::vector<std::string> args = extractMacroArguments (pos, source);
-			assert(args.size() >= 2);
-
-			size_t end = source.find(")", pos);
+			mCurrentComponent -= 4;
+			++mCurrentPassthrough;
+		}
+	}
 
-			std::string autoConstantName, uniformName;
-			std::string extraData;
+	void ShaderInstance::expandPassthroughAssign (const std::string& /*command*/, const MacroExpander::Arguments& args, std::string& result)
+	{
+		assert(args.size() == 2);
 
-			uniformName = args[0];
-			autoConstantName = args[1];
-			if (args.size() > 2)
-				extraData = args[2];
+		std::string passthroughName = args[0].str();
+		std::string assignTo = args[1].str();
 
-			autoConstants[uniformName] = std::make_pair(autoConstantName, extraData);
+		assert(mPassthroughMap.find(passthroughName) != mPassthroughMap.end());
+		Passthrough& p = mPassthroughMap[passthroughName];
 
-			source.erase(pos, (end+1)-pos);
-		}
+		result += p.expand_assign(assignTo);
+	}
 
-		// parse uniform properties
-		while (true)
-		{
-			pos = source.find("@shUniformProperty");
-			if (pos == std::string::npos)
-				break;
-
-			std::vector<std::string> args = extractMacroArguments (pos, source);
-			assert(args.size() == 2);
-
-			size_t start = source.find("(", pos);
-			size_t end = source.find(")", pos);
-			std::string cmd = source.substr(pos, start-pos);
-
-			ValueType vt;
-			if (cmd == "@shUniformProperty4f")
-				vt = VT_Vector4;
-			else if (cmd == "@shUniformProperty3f")
-				vt = VT_Vector3;
-			else if (cmd == "@shUniformProperty2f")
-				vt = VT_Vector2;
-			else if (cmd == "@shUniformProperty1f")
-				vt = VT_Float;
-			else if (cmd == "@shUniformPropertyInt")
-				vt = VT_Int;
-			else
-				throw std::runtime_error ("unsupported command \"" + cmd + "\"");
+	void ShaderInstance::expandPassthroughReceive (const std::string& /*command*/, const MacroExpander::Arguments& args, std::string& result)
+	{
+		assert(args.size() == 1);
 
+		std::string passthroughName = args[0].str();
 
-			std::string propertyName, uniformName;
-			uniformName = args[0];
-			propertyName = args[1];
-			mUniformProperties[uniformName] = std::make_pair(propertyName, vt);
+		assert(mPassthroughMap.find(passthroughName) != mPassthroughMap.end());
+		Passthrough& p = mPassthroughMap[passthroughName];
 
-			source.erase(pos, (end+1)-pos);
-		}
+		result += p.expand_receive();
+	}
 
-		// parse texture samplers used
-		while (true)
+	void ShaderInstance::expandPassthroughDeclarations (const std::string& command, const MacroExpander::Arguments& /*args*/, std::string& result)
+	{
+		bool vertex = (command == "shPassthroughVertexOutputs");
+		for (int i = 0; i < mCurrentPassthrough+1; ++i)
 		{
-			pos = source.find("@shUseSampler");
-			if (pos == std::string::npos)
-				break;
-
-			size_t end = source.find(")", pos);
-
-			mUsedSamplers.push_back(extractMacroArguments (pos, source)[0]);
-			source.erase(pos, (end+1)-pos);
+			// not using newlines here, otherwise the line numbers reported by compiler would be messed up..
+			if (mLanguage == Language_CG || mLanguage == Language_HLSL)
+				result += (vertex ? ", out float4 passthrough" : ", in float4 passthrough") + boost::lexical_cast<std::string>(i) + " : TEXCOORD" + boost::lexical_cast<std::string>(i);
+			else
+				result += "varying vec4 passthrough" + boost::lexical_cast<std::string>(i) + "; ";
 		}
+	}
 
-		// convert any left-over @'s to #
-		boost::algorithm::replace_all(source, "@", "#");
+	void ShaderInstance::parseSharedParameter (const std::string& /*command*/, const MacroExpander::Arguments& args, std::string& /*result*/)
+	{
+		assert(args.size());
 
-		Platform* platform = Factory::getInstance().getPlatform();
+		mSharedParameters.push_back(args[0].str());
+	}
 
-		std::string profile;
-		if (Factory::getInstance ().getCurrentLanguage () == Language_CG)
-			profile = mParent->getCgProfile ();
-		else if (Factory::getInstance ().getCurrentLanguage () == Language_HLSL)
-			profile = mParent->getHlslProfile ();
+	void ShaderInstance::parseAutoConstant (const std::string& /*command*/, const MacroExpander::Arguments& args, std::string& /*result*/)
+	{
+		assert(args.size() >= 2);
 
+		std::string autoConstantName, uniformName;
+		std::string extraData;
 
-		if (type == GPT_Vertex)
-			mProgram = boost::shared_ptr<GpuProgram>(platform->createGpuProgram(GPT_Vertex, "", mName, profile, source, Factory::getInstance().getCurrentLanguage()));
-		else if (type == GPT_Fragment)
-			mProgram = boost::shared_ptr<GpuProgram>(platform->createGpuProgram(GPT_Fragment, "", mName, profile, source, Factory::getInstance().getCurrentLanguage()));
+		uniformName = args[0].str();
+		autoConstantName = args[1].str();
+		if (args.size() > 2)
+			extraData = args[2].str();
 
+		mAutoConstants[uniformName] = std::make_pair(autoConstantName, extraData);
+	}
 
-		if (Factory::getInstance ().getShaderDebugOutputEnabled ())
-			writeDebugFile(source, name);
+	void ShaderInstance::parseUniformProperty (const std::string& command, const MacroExpander::Arguments& args, std::string& /*result*/)
+	{
+		assert(args.size() == 2);
+
+		ValueType vt;
+		if (command == "shUniformProperty4f")
+			vt = VT_Vector4;
+		else if (command == "shUniformProperty3f")
+			vt = VT_Vector3;
+		else if (command == "shUniformProperty2f")
+			vt = VT_Vector2;
+		else if (command == "shUniformProperty1f")
+			vt = VT_Float;
+		else if (command == "shUniformPropertyInt")
+			vt = VT_Int;
+		else
+			throw std::runtime_error ("unsupported command \"@" + command + "\"");
 
-		if (!mProgram->getSupported())
-		{
-			std::cerr << "        Full source code below: \n" << source << std::endl;
-			mSupported = false;
-			return;
-		}
+		std::string propertyName, uniformName;
+		uniformName = args[0].str();
+		propertyName = args[1].str();
+		mUniformProperties[uniformName] = std::make_pair(propertyName, vt);
+	}
 
-		// set auto constants
-		for (AutoConstantMap::iterator it = autoConstants.begin(); it != autoConstants.end(); ++it)
-		{
-			mProgram->setAutoConstant(it->first, it->second.first, it->second.second);
-		}
+	void ShaderInstance::parseUsedSampler (const std::string& /*command*/, const MacroExpander::Arguments& args, std::string& /*result*/)
+	{
+		mUsedSamplers.push_back(args[0].str());
 	}
 
 	std::string ShaderInstance::getName ()
@@ -682,17 +619,4 @@ namespace sh
 			pass->setGpuConstant(mParent->getType(), it->first, it->second.second, properties->getProperty(it->second.first), properties->getContext());
 		}
 	}
-
-	std::vector<std::string> ShaderInstance::extractMacroArguments (size_t pos, const std::string& source)
-	{
-		size_t start = source.find("(", pos);
-		size_t end = source.find(")", pos);
-		std::string args = source.substr(start+1, end-(start+1));
-		std::vector<std::string> results;
-		boost::algorithm::split(results, args, boost::is_any_of(","));
-		std::for_each(results.begin(), results.end(),
-			boost::bind(&boost::trim<std::string>,
-			_1, std::locale() ));
-		return results;
-	}
 }
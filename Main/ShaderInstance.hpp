@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "Platform.hpp"
+#include "MacroExpander.hpp"
 
 namespace sh
 {
@@ -31,10 +32,25 @@ namespace sh
 	class ShaderInstance
 	{
 	public:
-		ShaderInstance (ShaderSet* parent, const std::string& name, PropertySetGet* properties);
+		ShaderInstance (ShaderSet* parent, const std::string& name, const std::string& permutationKey, PropertySetGet* properties);
+		///< generates the source using the current global settings and compiles it right away
+
+		ShaderInstance (ShaderSet* parent, const std::string& name, const std::string& permutationKey);
+		///< only sets up the instance, use generateSource and compile to create the actual shader
+
+		/// Runs the macro parsing, preprocessing and post-processing steps (or reads the result from the source cache). \n
+		/// This only reads \a properties and \a globalSettings, and does not touch the \a Platform,
+		/// so it may be called from a worker thread as long as nobody else is using these property sets.
+		void generateSource (PropertySetGet* properties, PropertySetGet* globalSettings, Language lang);
+
+		/// Creates the GPU program from the generated source. Must be called from the main thread.
+		void compile ();
 
 		std::string getName();
 
+		/// @return the key that identifies this permutation within the shader set, see ShaderSet::buildPermutationKey
+		const std::string& getPermutationKey() const { return mPermutationKey; }
+
 		bool getSupported () const;
 
 		std::vector<std::string> getUsedSamplers();
@@ -45,9 +61,14 @@ namespace sh
 	private:
 		boost::shared_ptr<GpuProgram> mProgram;
 		std::string mName;
+		std::string mPermutationKey;
 		ShaderSet* mParent;
 		bool mSupported; ///< shader compilation was sucessful?
 
+		std::string mSource; ///< generated source, only valid between generateSource and compile
+		Language mLanguage;
+		PropertySetGet* mGlobalSettings; ///< only valid during generateSource
+
 		std::vector<std::string> mUsedSamplers;
 		///< names of the texture samplers that are used by this shader
 
@@ -62,9 +83,27 @@ namespace sh
 
 		PassthroughMap mPassthroughMap;
 
-		std::vector<std::string> extractMacroArguments (size_t pos, const std::string& source); ///< take a macro invocation and return vector of arguments
-
-		void parse (std::string& source, PropertySetGet* properties);
+		typedef std::map< std::string, std::pair<std::string, std::string> > AutoConstantMap;
+		AutoConstantMap mAutoConstants; ///< maps uniform name to auto constant name and extra data
+
+		void parse (std::string& source, PropertySetGet* properties); ///< expand the macros that are handled before preprocessing
+
+		// handlers for the macros that are expanded before preprocessing, \a expander is used for macros in their replacement
+		void expandProperty (const std::string& command, const MacroExpander::Arguments& args, std::string& result,
+			PropertySetGet* properties, const MacroExpander& expander);
+		void expandGlobalSetting (const std::string& command, const MacroExpander::Arguments& args, std::string& result, const MacroExpander& expander);
+		void expandForeach (const std::string& command, const MacroExpander::Arguments& args, const MacroExpander::Argument& content, std::string& result,
+			const MacroExpander& expander);
+
+		// handlers for the macros that are expanded after preprocessing, see MacroExpander::Handler
+		void allocatePassthrough (const std::string& command, const MacroExpander::Arguments& args, std::string& result);
+		void expandPassthroughAssign (const std::string& command, const MacroExpander::Arguments& args, std::string& result);
+		void expandPassthroughReceive (const std::string& command, const MacroExpander::Arguments& args, std::string& result);
+		void expandPassthroughDeclarations (const std::string& command, const MacroExpander::Arguments& args, std::string& result);
+		void parseSharedParameter (const std::string& command, const MacroExpander::Arguments& args, std::string& result);
+		void parseAutoConstant (const std::string& command, const MacroExpander::Arguments& args, std::string& result);
+		void parseUniformProperty (const std::string& command, const MacroExpander::Arguments& args, std::string& result);
+		void parseUsedSampler (const std::string& command, const MacroExpander::Arguments& args, std::string& result);
 	};
 }
 
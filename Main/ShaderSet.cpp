@@ -2,19 +2,194 @@
 
 #include <fstream>
 #include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <set>
+#include <stdexcept>
 
 #include <boost/algorithm/string/predicate.hpp>
-#include <boost/functional/hash.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/filesystem.hpp>
 
 #include "Factory.hpp"
+#include "Hash.hpp"
+#include "CacheArchive.hpp"
+
+namespace
+{
+	bool readFile (const boost::filesystem::path& path, std::string& contents)
+	{
+		std::ifstream stream(path.string().c_str(), std::ifstream::in);
+		if (!stream.is_open())
+			return false;
+		std::stringstream buffer;
+		buffer << stream.rdbuf();
+		contents = buffer.str();
+		return true;
+	}
+
+	/// Add the names and contents of all files included by \a source to \a hash, recursively.
+	/// This is a static scan, so files in disabled \#if blocks are included as well. Files that can't be found are skipped,
+	/// the preprocessor will report them.
+	void hashIncludes (const std::string& source, const boost::filesystem::path& directory, const boost::filesystem::path& basePath,
+		sh::Hash& hash, std::set<std::string>& visited)
+	{
+		std::istringstream stream (source);
+		std::string line;
+		while (std::getline(stream, line))
+		{
+			size_t pos = line.find_first_not_of(" \t");
+			if (pos == std::string::npos || line[pos] != '#')
+				continue;
+			pos = line.find_first_not_of(" \t", pos+1);
+			if (pos == std::string::npos || line.compare(pos, 7, "include") != 0)
+				continue;
+			size_t start = line.find('"', pos+7);
+			if (start == std::string::npos)
+				continue;
+			size_t end = line.find('"', start+1);
+			if (end == std::string::npos)
+				continue;
+			std::string name = line.substr(start+1, end-start-1);
+
+			// same search order as the preprocessor: relative to the including file first, then the include path
+			boost::filesystem::path path = directory / name;
+			if (!boost::filesystem::exists(path))
+				path = basePath / name;
+			if (!boost::filesystem::exists(path))
+				continue;
+
+			std::string canonical = boost::filesystem::canonical(path).string();
+			if (!visited.insert(canonical).second)
+				continue; // only hash each file once, which also takes care of include cycles
+
+			std::string contents;
+			if (!readFile(path, contents))
+				continue;
+
+			// the name as written in the source rather than the path, so that the hash does not depend on the install location
+			hash.add(name);
+			hash.add(contents);
+			hashIncludes(contents, path.parent_path(), basePath, hash, visited);
+		}
+	}
+
+	/// @param includes receives the canonical paths of the included files
+	boost::uint64_t hashSource (const std::string& source, const boost::filesystem::path& basePath, std::set<std::string>& includes)
+	{
+		sh::Hash hash;
+		hash.add(source);
+		hashIncludes(source, basePath, basePath, hash, includes);
+		return hash.get();
+	}
+
+	/// Copy all properties of \a source (including inherited ones) to \a target, resolving linked values using \a context.
+	/// Properties that can't be resolved are skipped, the error is then reported when (and if) the shader actually uses them.
+	void resolveProperties (sh::PropertySetGet* source, sh::PropertySetGet* context, sh::PropertySetGet& target)
+	{
+		if (source->getParent())
+			resolveProperties (source->getParent(), context, target);
+
+		const sh::PropertyMap& properties = source->listProperties();
+		for (sh::PropertyMap::const_iterator it = properties.begin(); it != properties.end(); ++it)
+		{
+			try
+			{
+				std::string value = sh::retrieveValue<sh::StringValue>(source->getProperty(it->first), context).get();
+				target.setProperty(it->first, sh::makeProperty(new sh::StringValue(value)));
+			}
+			catch (std::exception&)
+			{
+			}
+		}
+	}
+
+	/// Append a "name=value" line to a permutation key. Line breaks in the value are escaped, so that the key stays unambiguous.
+	void appendKeyEntry (std::string& key, const std::string& name, const std::string& value)
+	{
+		key += name;
+		key += '=';
+		for (std::string::const_iterator it = value.begin(); it != value.end(); ++it)
+		{
+			if (*it == '\\')
+				key += "\\\\";
+			else if (*it == '\n')
+				key += "\\n";
+			else
+				key += *it;
+		}
+		key += '\n';
+	}
+
+	/// Adds a permutation to the hitch report of the current material request, when it goes out of scope
+	class HitchPermutationScope
+	{
+	public:
+		/// @param report may be NULL, then nothing is recorded
+		HitchPermutationScope (sh::HitchReport* report, const std::string& shaderSet, boost::uint64_t hash)
+			: mReport(report)
+			, mCompiled(false)
+			, mFailed(false)
+		{
+			if (!mReport)
+				return;
+			mName = shaderSet + "_" + boost::lexical_cast<std::string>(hash);
+			mStart = boost::chrono::steady_clock::now();
+		}
+
+		~HitchPermutationScope ()
+		{
+			if (!mReport)
+				return;
+			sh::HitchPermutation permutation;
+			permutation.mName = mName;
+			permutation.mCompiled = mCompiled;
+			permutation.mFailed = mFailed;
+			permutation.mTime = boost::chrono::duration<float, boost::milli>(boost::chrono::steady_clock::now() - mStart).count();
+			mReport->mPermutations.push_back(permutation);
+			if (mCompiled)
+			{
+				++mReport->mCompiledCount;
+				mReport->mCompileTime += permutation.mTime;
+			}
+			if (mFailed)
+				++mReport->mFailedCount;
+			else if (!mCompiled)
+				++mReport->mCachedCount;
+		}
+
+		void setCompiled () { mCompiled = true; }
+		void setFailed (bool failed) { mFailed = failed; }
+
+	private:
+		sh::HitchReport* mReport;
+		std::string mName;
+		bool mCompiled;
+		bool mFailed;
+		boost::chrono::steady_clock::time_point mStart;
+	};
+}
 
 namespace sh
 {
+	void PendingShaderInstance::generate ()
+	{
+		try
+		{
+			mInstance->generateSource(&mProperties, &mGlobalSettings, mLanguage);
+		}
+		catch (std::exception& e)
+		{
+			mError = e.what();
+		}
+	}
+
+	// ------------------------------------------------------------------------------
+
 	ShaderSet::ShaderSet (const std::string& type, const std::string& cgProfile, const std::string& hlslProfile, const std::string& sourceFile, const std::string& basePath,
 						  const std::string& name, PropertySetGet* globalSettingsPtr)
 		: mBasePath(basePath)
+		, mSourceFile(sourceFile)
 		, mName(name)
 		, mCgProfile(cgProfile)
 		, mHlslProfile(hlslProfile)
@@ -24,19 +199,36 @@ namespace sh
 		else // if (type == "fragment")
 			mType = GPT_Fragment;
 
-		std::ifstream stream(sourceFile.c_str(), std::ifstream::in);
-		std::stringstream buffer;
-
 		boost::filesystem::path p (sourceFile);
 		p = p.branch_path();
 		mBasePath = p.string();
 
-		buffer << stream.rdbuf();
-		stream.close();
-		mSource = buffer.str();
+		{
+			StatisticsTimer timer (Factory::getInstance().getStatistics(), StatisticsPhase_SourceLoad);
+			std::ifstream stream(sourceFile.c_str(), std::ifstream::in);
+			std::stringstream buffer;
+			buffer << stream.rdbuf();
+			stream.close();
+			mSource = buffer.str();
+			mContentHash = hashSource(mSource, p, mIncludedFiles);
+		}
 		parse();
 	}
 
+	boost::uint64_t ShaderSet::computeContentHash (const std::string& sourceFile)
+	{
+		std::string source;
+		readFile(sourceFile, source);
+		std::set<std::string> includes;
+		return hashSource(source, boost::filesystem::path(sourceFile).branch_path(), includes);
+	}
+
+	bool ShaderSet::isSameAs (const ShaderSet& other) const
+	{
+		return mType == other.mType && mSourceFile == other.mSourceFile && mBasePath == other.mBasePath
+			&& mCgProfile == other.mCgProfile && mHlslProfile == other.mHlslProfile && mContentHash == other.mContentHash;
+	}
+
 	ShaderSet::~ShaderSet()
 	{
 		for (ShaderInstanceMap::iterator it = mInstances.begin(); it != mInstances.end(); ++it)
@@ -124,43 +316,169 @@ namespace sh
 
 	ShaderInstance* ShaderSet::getInstance (PropertySetGet* properties)
 	{
-		size_t h = buildHash (properties);
-		if (std::find(mFailedToCompile.begin(), mFailedToCompile.end(), h) != mFailedToCompile.end())
+		std::string key = buildPermutationKey (properties);
+		boost::uint64_t h = hashPermutationKey (key);
+		HitchPermutationScope hitch (Factory::getInstance().getCurrentHitchReport(), mName, h);
+
+		if (isFailedPermutation (h, key))
+		{
+			hitch.setFailed(true);
 			return NULL;
-		if (mInstances.find(h) == mInstances.end())
+		}
+
+		ShaderInstanceMap::iterator it = mInstances.find(h);
+		if (it == mInstances.end())
 		{
-			ShaderInstance newInstance(this, mName + "_" + boost::lexical_cast<std::string>(h), properties);
+			hitch.setCompiled();
+			hitch.setFailed(true); // until it succeeded, so that an exception counts as a failure as well
+			ShaderInstance newInstance(this, mName + "_" + boost::lexical_cast<std::string>(h), key, properties);
 			if (!newInstance.getSupported())
 			{
-				mFailedToCompile.push_back(h);
+				addFailedPermutation (h, key);
 				return NULL;
 			}
-			mInstances.insert(std::make_pair(h, newInstance));
+			hitch.setFailed(false);
+			it = mInstances.insert(std::make_pair(h, newInstance)).first;
+			mFailedToGenerate.erase(h);
+		}
+		else
+			checkPermutationKey (it->second.getPermutationKey(), key);
+		return &it->second;
+	}
+
+	PendingShaderInstancePtr ShaderSet::queueInstance (PropertySetGet* properties, bool* ready)
+	{
+		std::string key = buildPermutationKey (properties);
+		boost::uint64_t h = hashPermutationKey (key);
+
+		bool failed = isFailedPermutation (h, key);
+		ShaderInstanceMap::const_iterator existing = mInstances.find(h);
+		std::map<boost::uint64_t, PendingShaderInstancePtr>::const_iterator queued = mPendingInstances.find(h);
+		if (existing != mInstances.end())
+			checkPermutationKey (existing->second.getPermutationKey(), key);
+		if (queued != mPendingInstances.end())
+			checkPermutationKey (queued->second->mInstance->getPermutationKey(), key);
+
+		bool available = failed || existing != mInstances.end() || mFailedToGenerate.find(h) != mFailedToGenerate.end();
+		if (ready)
+			*ready = available;
+		if (available || queued != mPendingInstances.end())
+			return PendingShaderInstancePtr();
+
+		PendingShaderInstancePtr pending (new PendingShaderInstance());
+		pending->mSet = this;
+		pending->mHash = h;
+		pending->mInstance = boost::shared_ptr<ShaderInstance>(new ShaderInstance(this, mName + "_" + boost::lexical_cast<std::string>(h), key));
+		resolveProperties (properties, properties->getContext(), pending->mProperties);
+		resolveProperties (getCurrentGlobalSettings(), NULL, pending->mGlobalSettings);
+		pending->mLanguage = Factory::getInstance().getCurrentLanguage();
+
+		mPendingInstances[h] = pending;
+		return pending;
+	}
+
+	ShaderInstance* ShaderSet::finishInstance (PendingShaderInstancePtr pending)
+	{
+		assert(pending->mSet == this);
+		mPendingInstances.erase(pending->mHash);
+
+		// might have been created synchronously in the meantime
+		ShaderInstanceMap::iterator it = mInstances.find(pending->mHash);
+		if (it != mInstances.end())
+		{
+			checkPermutationKey (it->second.getPermutationKey(), pending->mInstance->getPermutationKey());
+			return &it->second;
+		}
+
+		if (!pending->mError.empty())
+		{
+			// not marked as failed to compile: getInstance generates it again when the material is created, which reports the error to the material
+			std::stringstream msg;
+			msg << "Error while generating shader " << pending->mInstance->getName() << ": " << pending->mError;
+			std::cerr << msg.str() << std::endl;
+			Factory::getInstance().logError(msg.str());
+			mFailedToGenerate.insert(pending->mHash);
+			return NULL;
+		}
+
+		pending->mInstance->compile();
+		if (!pending->mInstance->getSupported())
+		{
+			addFailedPermutation (pending->mHash, pending->mInstance->getPermutationKey());
+			return NULL;
 		}
-		return &mInstances.find(h)->second;
+		return &mInstances.insert(std::make_pair(pending->mHash, *pending->mInstance)).first->second;
 	}
 
-	size_t ShaderSet::buildHash (PropertySetGet* properties)
+	void ShaderSet::discardInstance (PendingShaderInstancePtr pending)
 	{
-		size_t seed = 0;
+		assert(pending->mSet == this);
+		mPendingInstances.erase(pending->mHash);
+	}
+
+	std::string ShaderSet::buildPermutationKey (PropertySetGet* properties)
+	{
+		std::string key;
 		PropertySetGet* currentGlobalSettings = getCurrentGlobalSettings ();
 
 		for (std::vector<std::string>::iterator it = mProperties.begin(); it != mProperties.end(); ++it)
 		{
 			std::string v = retrieveValue<StringValue>(properties->getProperty(*it), properties->getContext()).get();
-			boost::hash_combine(seed, v);
+			appendKeyEntry(key, "property " + *it, v);
 		}
 		for (std::vector <std::string>::iterator it = mGlobalSettings.begin(); it != mGlobalSettings.end(); ++it)
 		{
-			boost::hash_combine(seed, retrieveValue<StringValue>(currentGlobalSettings->getProperty(*it), NULL).get());
+			appendKeyEntry(key, "setting " + *it, retrieveValue<StringValue>(currentGlobalSettings->getProperty(*it), NULL).get());
 		}
 		for (std::vector<std::string>::iterator it = mPropertiesToExist.begin(); it != mPropertiesToExist.end(); ++it)
 		{
 			std::string v = retrieveValue<StringValue>(properties->getProperty(*it), properties->getContext()).get();
-			boost::hash_combine(seed, static_cast<bool>(v != ""));
+			appendKeyEntry(key, "exists " + *it, (v != "") ? "1" : "0");
 		}
-		boost::hash_combine(seed, static_cast<int>(Factory::getInstance().getCurrentLanguage()));
-		return seed;
+		appendKeyEntry(key, "language", boost::lexical_cast<std::string>(static_cast<int>(Factory::getInstance().getCurrentLanguage())));
+		return key;
+	}
+
+	boost::uint64_t ShaderSet::hashPermutationKey (const std::string& key)
+	{
+		Hash hash;
+		hash.add(key);
+		return hash.get();
+	}
+
+	bool ShaderSet::isFailedPermutation (boost::uint64_t hash, const std::string& key)
+	{
+		FailedPermutationMap::const_iterator failed = mFailedToCompile.find(hash);
+		if (failed != mFailedToCompile.end())
+		{
+			checkPermutationKey (failed->second, key);
+			return true;
+		}
+
+		CacheArchive* cache = Factory::getInstance().getFailedPermutationCache();
+		std::string data;
+		if (cache && Factory::getInstance().getReadMicrocodeCache() && cache->find(getFailedPermutationName(key), data))
+		{
+			std::cerr << "Skipping shader " << mName << "_" << hash << ", it failed to compile in a previous run" << std::endl;
+			mFailedToCompile[hash] = key;
+			return true;
+		}
+		return false;
+	}
+
+	void ShaderSet::addFailedPermutation (boost::uint64_t hash, const std::string& key)
+	{
+		mFailedToCompile[hash] = key;
+
+		CacheArchive* cache = Factory::getInstance().getFailedPermutationCache();
+		if (cache && Factory::getInstance().getWriteMicrocodeCache())
+			cache->insert(getFailedPermutationName(key), "");
+	}
+
+	void ShaderSet::checkPermutationKey (const std::string& existingKey, const std::string& key) const
+	{
+		if (existingKey != key)
+			throw std::runtime_error ("Permutation hash collision in shader set \"" + mName + "\":\n" + existingKey + "and\n" + key);
 	}
 
 	PropertySetGet* ShaderSet::getCurrentGlobalSettings() const
@@ -178,6 +496,25 @@ namespace sh
 		return mSource;
 	}
 
+	std::string ShaderSet::getCacheNamePrefix () const
+	{
+		std::stringstream stream;
+		stream << mName << "\n" << std::hex << std::setw(16) << std::setfill('0') << mContentHash << "\n";
+		return stream.str();
+	}
+
+	std::string ShaderSet::getSourceCacheName (const std::string& permutationKey) const
+	{
+		// the archive compares the complete name, so this is only hashed for the index
+		return getCacheNamePrefix() + permutationKey;
+	}
+
+	std::string ShaderSet::getFailedPermutationName (const std::string& permutationKey) const
+	{
+		// whether a shader compiles depends on the profile as well
+		return getSourceCacheName(permutationKey) + "cg profile=" + mCgProfile + "\nhlsl profile=" + mHlslProfile + "\n";
+	}
+
 	std::string ShaderSet::getCgProfile() const
 	{
 		return mCgProfile;
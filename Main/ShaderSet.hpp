@@ -4,6 +4,10 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
 
 #include "ShaderInstance.hpp"
 
@@ -11,7 +15,29 @@ namespace sh
 {
 	class PropertySetGet;
 
-	typedef std::map<size_t, ShaderInstance> ShaderInstanceMap;
+	typedef std::map<boost::uint64_t, ShaderInstance> ShaderInstanceMap;
+	typedef boost::unordered_map<boost::uint64_t, std::string> FailedPermutationMap; ///< permutation hash -> permutation key
+
+	/**
+	 * @brief A shader permutation that has been queued with ShaderSet::queueInstance. \n
+	 * All properties that the source generation depends on are resolved up front, so that
+	 * \a generate can run on a worker thread.
+	 */
+	struct PendingShaderInstance
+	{
+		ShaderSet* mSet;
+		boost::uint64_t mHash; ///< see ShaderSet::hashPermutationKey
+		boost::shared_ptr<ShaderInstance> mInstance;
+
+		PropertySetGet mProperties; ///< resolved copy of the pass' shader properties
+		PropertySetGet mGlobalSettings; ///< resolved copy of the global settings that were active when queueing
+		Language mLanguage;
+
+		std::string mError; ///< set if the source generation failed
+
+		void generate ();
+	};
+	typedef boost::shared_ptr<PendingShaderInstance> PendingShaderInstancePtr;
 
 	/**
 	 * @brief Contains possible shader permutations of a single uber-shader (represented by one source file)
@@ -31,6 +57,43 @@ namespace sh
 		/// so it does not matter if you pass any extra properties that the shader does not care about.
 		ShaderInstance* getInstance (PropertySetGet* properties);
 
+		/// Queue the permutation for the given properties for source generation on a worker thread. \n
+		/// Must be called from the main thread, with the same active configuration & lod level as \a getInstance would be.
+		/// @param ready if not NULL, receives whether \a getInstance can be called for this permutation without waiting for a worker thread,
+		/// i.e. it exists, failed to compile before, or its source generation failed (then \a getInstance reports the error)
+		/// @return the pending permutation, or an empty pointer if it exists already, is queued already, or failed to compile before
+		PendingShaderInstancePtr queueInstance (PropertySetGet* properties, bool* ready = NULL);
+
+		/// Compile a permutation returned by \a queueInstance after PendingShaderInstance::generate has finished,
+		/// and add it to this set. Must be called from the main thread.
+		/// @return the new instance, or NULL if the generation or compilation failed
+		ShaderInstance* finishInstance (PendingShaderInstancePtr pending);
+
+		/// Forget about a permutation returned by \a queueInstance, without compiling it.
+		void discardInstance (PendingShaderInstancePtr pending);
+
+		/// @return hash of the source and all files it includes (directly or indirectly)
+		boost::uint64_t getContentHash () const { return mContentHash; }
+
+		/// @return the start of the names of the cache entries of this shader set (source and failed permutation cache).
+		/// It contains the content hash, so entries with another prefix are outdated.
+		std::string getCacheNamePrefix () const;
+
+		/// @return true if \a other was created from the same definition and the same content, so that its permutations are the same
+		bool isSameAs (const ShaderSet& other) const;
+
+		std::string getSourceFile () const { return mSourceFile; }
+
+		/// @return canonical paths of all files that the source includes (directly or indirectly), as found for \a getContentHash
+		const std::set<std::string>& getIncludedFiles () const { return mIncludedFiles; }
+
+		/// Compute the same hash as \a getContentHash for a shader file, without creating a shader set.
+		static boost::uint64_t computeContentHash (const std::string& sourceFile);
+
+		/// @return 64-bit FNV-1a hash (see \a Hash) of a key returned by \a buildPermutationKey. \n
+		/// Used to name the shader instances, it is the same on every platform and compiler.
+		static boost::uint64_t hashPermutationKey (const std::string& key);
+
 	private:
 		PropertySetGet* getCurrentGlobalSettings() const;
 		std::string getBasePath() const;
@@ -39,17 +102,32 @@ namespace sh
 		std::string getHlslProfile() const;
 		int getType() const;
 
+		/// @return name of the entry in the source cache for the given permutation key.
+		/// The name contains the content hash, so that a stale source is never read from the cache,
+		/// and the complete permutation key, so that a hash collision can not return the wrong source.
+		std::string getSourceCacheName (const std::string& permutationKey) const;
+
+		/// @return name of the entry in the failed permutation cache, like \a getSourceCacheName but including the profiles
+		std::string getFailedPermutationName (const std::string& permutationKey) const;
+
 		friend class ShaderInstance;
 
 	private:
 		GpuProgramType mType;
 		std::string mSource;
 		std::string mBasePath;
+		std::string mSourceFile;
+		std::set<std::string> mIncludedFiles;
 		std::string mCgProfile;
 		std::string mHlslProfile;
 		std::string mName;
+		boost::uint64_t mContentHash;
+
+		FailedPermutationMap mFailedToCompile;
 
-		std::vector <size_t> mFailedToCompile;
+		/// permutations whose source generation failed on a worker thread. \a queueInstance reports them as ready,
+		/// so that \a getInstance generates them again and the error is reported to the material as usual
+		std::set<boost::uint64_t> mFailedToGenerate;
 
 		std::vector <std::string> mGlobalSettings; ///< names of the global settings that affect the shader source
 		std::vector <std::string> mProperties; ///< names of the per-material properties that affect the shader source
@@ -60,9 +138,22 @@ namespace sh
 
 		ShaderInstanceMap mInstances; ///< maps permutation ID (generated from the properties) to \a ShaderInstance
 
+		std::map<boost::uint64_t, PendingShaderInstancePtr> mPendingInstances; ///< permutations that were queued, but not finished yet
+
 		void parse(); ///< find out which properties and global settings affect the shader source
 
-		size_t buildHash (PropertySetGet* properties);
+		/// @return a text that uniquely identifies the permutation for the given properties: the values of all
+		/// properties and global settings that affect the shader source, and the current language.
+		std::string buildPermutationKey (PropertySetGet* properties);
+
+		/// @return did this permutation fail to compile, in this or (if the microcode cache is read) a previous run?
+		bool isFailedPermutation (boost::uint64_t hash, const std::string& key);
+
+		/// Remember that this permutation failed to compile, and save it to the failed permutation cache.
+		void addFailedPermutation (boost::uint64_t hash, const std::string& key);
+
+		/// Throw an exception if \a key is not the same as \a existingKey, i.e. two different permutations have the same hash.
+		void checkPermutationKey (const std::string& existingKey, const std::string& key) const;
 	};
 }
 
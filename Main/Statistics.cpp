@@ -0,0 +1,81 @@
+#include "Statistics.hpp"
+
+namespace sh
+{
+	Statistics::Statistics ()
+		: mTracer(NULL)
+	{
+		reset();
+	}
+
+	void Statistics::addTime (StatisticsPhase phase, boost::uint64_t nanoseconds)
+	{
+		mPhaseCounts[phase].fetch_add(1, boost::memory_order_relaxed);
+		mPhaseTimes[phase].fetch_add(nanoseconds, boost::memory_order_relaxed);
+	}
+
+	void Statistics::increment (StatisticsCounter counter, boost::uint64_t amount)
+	{
+		mCounters[counter].fetch_add(amount, boost::memory_order_relaxed);
+	}
+
+	boost::uint64_t Statistics::getCount (StatisticsPhase phase) const
+	{
+		return mPhaseCounts[phase].load(boost::memory_order_relaxed);
+	}
+
+	boost::uint64_t Statistics::getTime (StatisticsPhase phase) const
+	{
+		return mPhaseTimes[phase].load(boost::memory_order_relaxed);
+	}
+
+	boost::uint64_t Statistics::getCount (StatisticsCounter counter) const
+	{
+		return mCounters[counter].load(boost::memory_order_relaxed);
+	}
+
+	void Statistics::reset ()
+	{
+		for (int i=0; i<StatisticsPhase_Count; ++i)
+		{
+			mPhaseCounts[i].store(0, boost::memory_order_relaxed);
+			mPhaseTimes[i].store(0, boost::memory_order_relaxed);
+		}
+		for (int i=0; i<StatisticsCounter_Count; ++i)
+			mCounters[i].store(0, boost::memory_order_relaxed);
+	}
+
+	const char* Statistics::getName (StatisticsPhase phase)
+	{
+		switch (phase)
+		{
+		case StatisticsPhase_ScriptParse: return "scriptParse";
+		case StatisticsPhase_SourceLoad: return "sourceLoad";
+		case StatisticsPhase_MacroParse: return "macroParse";
+		case StatisticsPhase_Preprocess: return "preprocess";
+		case StatisticsPhase_PostProcess: return "postProcess";
+		case StatisticsPhase_CreateGpuProgram: return "createGpuProgram";
+		case StatisticsPhase_SourceCacheRead: return "sourceCacheRead";
+		case StatisticsPhase_SourceCacheWrite: return "sourceCacheWrite";
+		case StatisticsPhase_CreateForConfiguration: return "createForConfiguration";
+		case StatisticsPhase_DestroyAll: return "destroyAll";
+		default: return "unknown";
+		}
+	}
+
+	const char* Statistics::getName (StatisticsCounter counter)
+	{
+		switch (counter)
+		{
+		case StatisticsCounter_SourceCacheHit: return "sourceCacheHit";
+		case StatisticsCounter_SourceCacheMiss: return "sourceCacheMiss";
+		case StatisticsCounter_MicrocodeCacheHit: return "microcodeCacheHit";
+		case StatisticsCounter_MicrocodeCacheMiss: return "microcodeCacheMiss";
+		case StatisticsCounter_ScriptSnapshotHit: return "scriptSnapshotHit";
+		case StatisticsCounter_ScriptSnapshotMiss: return "scriptSnapshotMiss";
+		case StatisticsCounter_MaterialReload: return "materialReload";
+		case StatisticsCounter_ShaderSetReload: return "shaderSetReload";
+		default: return "unknown";
+		}
+	}
+}
@@ -0,0 +1,112 @@
+#ifndef SH_STATISTICS_H
+#define SH_STATISTICS_H
+
+#include <boost/atomic.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "Tracer.hpp"
+
+namespace sh
+{
+	/// Phases of material and shader creation that are timed by \a Statistics
+	enum StatisticsPhase
+	{
+		StatisticsPhase_ScriptParse, ///< loading and parsing of the .mat, .shaderset, .configuration and .lod files
+		StatisticsPhase_SourceLoad, ///< reading and hashing the source of a shader set
+		StatisticsPhase_MacroParse, ///< expanding the @shProperty, @shGlobalSetting and @shForeach macros
+		StatisticsPhase_Preprocess, ///< Preprocessor::preprocess
+		StatisticsPhase_PostProcess, ///< expanding the counter, passthrough and binding macros after preprocessing
+		StatisticsPhase_CreateGpuProgram, ///< Platform::createGpuProgram (compiling the shader)
+		StatisticsPhase_SourceCacheRead,
+		StatisticsPhase_SourceCacheWrite,
+		StatisticsPhase_CreateForConfiguration, ///< MaterialInstance::createForConfiguration, includes the shader creation
+		StatisticsPhase_DestroyAll, ///< MaterialInstance::destroyAll
+		StatisticsPhase_Count
+	};
+
+	/// Events that are counted by \a Statistics
+	enum StatisticsCounter
+	{
+		StatisticsCounter_SourceCacheHit,
+		StatisticsCounter_SourceCacheMiss,
+		StatisticsCounter_MicrocodeCacheHit, ///< only counted if the microcode cache is read and the platform supports it
+		StatisticsCounter_MicrocodeCacheMiss,
+		StatisticsCounter_ScriptSnapshotHit, ///< script files whose nodes were read from the snapshot
+		StatisticsCounter_ScriptSnapshotMiss, ///< script files that had to be parsed, only counted if the snapshot is used
+		StatisticsCounter_MaterialReload, ///< materials that were updated by Factory::reloadScriptFile, without the materials derived from them
+		StatisticsCounter_ShaderSetReload, ///< shader sets that were created, replaced or removed by Factory::reloadShaders
+		StatisticsCounter_Count
+	};
+
+	/**
+	 * @brief Counters and cumulative times of the phases of material and shader creation, see \a Factory::getStatistics
+	 * @note All methods are thread safe and lock free, so the statistics are always collected. The time of a phase
+	 * includes the time of the phases that it calls (e.g. createForConfiguration includes createGpuProgram).
+	 * If a \a Tracer is set and enabled, every timed phase is also written as a trace event.
+	 */
+	class Statistics : private boost::noncopyable
+	{
+	public:
+		Statistics ();
+
+		void addTime (StatisticsPhase phase, boost::uint64_t nanoseconds);
+		void increment (StatisticsCounter counter, boost::uint64_t amount = 1);
+
+		/// @return how often the phase was entered
+		boost::uint64_t getCount (StatisticsPhase phase) const;
+
+		/// @return time spent in the phase, in nanoseconds
+		boost::uint64_t getTime (StatisticsPhase phase) const;
+
+		boost::uint64_t getCount (StatisticsCounter counter) const;
+
+		/// Set all counters and times to 0.
+		void reset ();
+
+		static const char* getName (StatisticsPhase phase);
+		static const char* getName (StatisticsCounter counter);
+
+		/// @param tracer may be NULL
+		void setTracer (Tracer* tracer) { mTracer = tracer; }
+		Tracer* getTracer () { return mTracer; }
+
+	private:
+		Tracer* mTracer;
+		boost::atomic<boost::uint64_t> mPhaseCounts[StatisticsPhase_Count];
+		boost::atomic<boost::uint64_t> mPhaseTimes[StatisticsPhase_Count];
+		boost::atomic<boost::uint64_t> mCounters[StatisticsCounter_Count];
+	};
+
+	/// Adds the time between construction and destruction to a phase of \a Statistics, and to the trace
+	class StatisticsTimer : private boost::noncopyable
+	{
+	public:
+		StatisticsTimer (Statistics& statistics, StatisticsPhase phase)
+			: mStatistics(statistics)
+			, mPhase(phase)
+			, mTrace(statistics.getTracer(), Statistics::getName(phase))
+			, mStart(boost::chrono::steady_clock::now())
+		{
+		}
+
+		~StatisticsTimer ()
+		{
+			boost::chrono::nanoseconds duration = boost::chrono::steady_clock::now() - mStart;
+			mStatistics.addTime(mPhase, static_cast<boost::uint64_t>(duration.count()));
+		}
+
+		/// Tag the trace event of this phase, does nothing if tracing is disabled
+		void addTraceArgument (const char* name, const std::string& value) { mTrace.addArgument(name, value); }
+		void addTraceArgument (const char* name, int value) { mTrace.addArgument(name, value); }
+
+	private:
+		Statistics& mStatistics;
+		StatisticsPhase mPhase;
+		TraceScope mTrace;
+		boost::chrono::steady_clock::time_point mStart;
+	};
+}
+
+#endif
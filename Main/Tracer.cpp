@@ -0,0 +1,114 @@
+#include "Tracer.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+
+namespace
+{
+	void appendJsonString (std::string& out, const std::string& str)
+	{
+		out += '"';
+		for (std::string::const_iterator it = str.begin(); it != str.end(); ++it)
+		{
+			unsigned char c = static_cast<unsigned char>(*it);
+			if (c == '"' || c == '\\')
+			{
+				out += '\\';
+				out += *it;
+			}
+			else if (c < 0x20)
+			{
+				char escaped[8];
+				std::sprintf(escaped, "\\u%04x", c);
+				out += escaped;
+			}
+			else
+				out += *it;
+		}
+		out += '"';
+	}
+
+	/// @return microseconds, with nanosecond precision
+	std::string formatMicroseconds (boost::chrono::nanoseconds duration)
+	{
+		char buffer[32];
+		std::sprintf(buffer, "%.3f", duration.count() / 1000.0);
+		return buffer;
+	}
+}
+
+namespace sh
+{
+	Tracer::Tracer ()
+		: mEnabled(false)
+		, mFirstEvent(true)
+	{
+	}
+
+	Tracer::~Tracer ()
+	{
+		stop();
+	}
+
+	void Tracer::start (const std::string& file)
+	{
+		stop();
+
+		boost::mutex::scoped_lock lock(mMutex);
+		mFile.open(file.c_str(), std::ios::out | std::ios::trunc);
+		if (!mFile.is_open())
+			throw std::runtime_error ("unable to open trace file " + file);
+		mFile << "[\n";
+		mStart = boost::chrono::steady_clock::now();
+		mFirstEvent = true;
+		mThreadIds.clear();
+		mEnabled.store(true);
+	}
+
+	void Tracer::stop ()
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+		if (!mEnabled.load())
+			return;
+		mEnabled.store(false);
+		mFile << "\n]\n";
+		mFile.close();
+	}
+
+	void Tracer::addEvent (const char* name, boost::chrono::steady_clock::time_point start, boost::chrono::steady_clock::time_point end,
+		const Arguments& arguments)
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+		if (!mEnabled.load())
+			return;
+
+		// the thread ids are assigned in order of appearance, the main thread (which usually starts the trace) is 1
+		ThreadIdMap::const_iterator thread = mThreadIds.find(boost::this_thread::get_id());
+		if (thread == mThreadIds.end())
+			thread = mThreadIds.insert(std::make_pair(boost::this_thread::get_id(), static_cast<int>(mThreadIds.size()) + 1)).first;
+
+		std::string event = mFirstEvent ? "" : ",\n";
+		event += "{\"name\":";
+		appendJsonString(event, name);
+		event += ",\"cat\":\"shiny\",\"ph\":\"X\",\"ts\":" + formatMicroseconds(start - mStart)
+			+ ",\"dur\":" + formatMicroseconds(end - start)
+			+ ",\"pid\":1,\"tid\":" + boost::lexical_cast<std::string>(thread->second);
+		if (!arguments.empty())
+		{
+			event += ",\"args\":{";
+			for (Arguments::const_iterator it = arguments.begin(); it != arguments.end(); ++it)
+			{
+				if (it != arguments.begin())
+					event += ',';
+				appendJsonString(event, it->first);
+				event += ':';
+				appendJsonString(event, it->second);
+			}
+			event += '}';
+		}
+		event += '}';
+
+		mFile << event;
+		mFirstEvent = false;
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef SH_TRACER_H
+#define SH_TRACER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+
+#include <boost/atomic.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace sh
+{
+	/**
+	 * @brief Writes the duration of material and shader work as Chrome trace events (JSON), which can be opened in
+	 * chrome://tracing or Perfetto. Disabled until \a start is called, see \a Factory::startTrace.
+	 * @note All methods are thread safe. Events are written as they finish, so the file can be inspected while the program is running
+	 * (the viewers accept a missing closing bracket).
+	 */
+	class Tracer : private boost::noncopyable
+	{
+	public:
+		typedef std::vector< std::pair<std::string, std::string> > Arguments;
+
+		Tracer ();
+
+		/// @note stops the trace
+		~Tracer ();
+
+		/// Start writing events to \a file, replacing its contents. Stops a trace that is already running.
+		/// @note throws if the file can't be opened
+		void start (const std::string& file);
+
+		/// Finish the trace file, does nothing if no trace is running.
+		void stop ();
+
+		bool isEnabled () const { return mEnabled.load(boost::memory_order_relaxed); }
+
+		/// Write a complete event, does nothing if no trace is running.
+		void addEvent (const char* name, boost::chrono::steady_clock::time_point start, boost::chrono::steady_clock::time_point end,
+			const Arguments& arguments);
+
+	private:
+		boost::atomic<bool> mEnabled;
+		boost::mutex mMutex;
+		std::ofstream mFile;
+		boost::chrono::steady_clock::time_point mStart;
+		bool mFirstEvent;
+
+		typedef std::map<boost::thread::id, int> ThreadIdMap;
+		ThreadIdMap mThreadIds; ///< small numbers are easier to read in the viewers
+	};
+
+	/// Adds an event for the time between construction and destruction to a \a Tracer, if it is enabled
+	class TraceScope : private boost::noncopyable
+	{
+	public:
+		/// @param tracer may be NULL
+		/// @param name must stay valid until the scope ends (usually a string literal)
+		TraceScope (Tracer* tracer, const char* name)
+			: mTracer((tracer && tracer->isEnabled()) ? tracer : NULL)
+			, mName(name)
+		{
+			if (mTracer)
+				mStart = boost::chrono::steady_clock::now();
+		}
+
+		~TraceScope ()
+		{
+			if (mTracer)
+				mTracer->addEvent(mName, mStart, boost::chrono::steady_clock::now(), mArguments);
+		}
+
+		void addArgument (const char* name, const std::string& value)
+		{
+			if (mTracer)
+				mArguments.push_back(std::make_pair(std::string(name), value));
+		}
+
+		void addArgument (const char* name, int value)
+		{
+			if (mTracer)
+				mArguments.push_back(std::make_pair(std::string(name), boost::lexical_cast<std::string>(value)));
+		}
+
+	private:
+		Tracer* mTracer; ///< NULL if tracing was disabled when the scope started
+		const char* mName;
+		boost::chrono::steady_clock::time_point mStart;
+		Tracer::Arguments mArguments;
+	};
+}
+
+#endif
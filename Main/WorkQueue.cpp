@@ -0,0 +1,84 @@
+#include "WorkQueue.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include <boost/bind.hpp>
+
+namespace sh
+{
+	WorkQueue::WorkQueue (unsigned int threadCount)
+		: mThreadCount(threadCount)
+		, mActiveJobs(0)
+		, mStop(false)
+	{
+		if (mThreadCount == 0)
+			mThreadCount = std::max(1u, boost::thread::hardware_concurrency());
+
+		for (unsigned int i=0; i<mThreadCount; ++i)
+			mThreads.create_thread(boost::bind(&WorkQueue::run, this));
+	}
+
+	WorkQueue::~WorkQueue ()
+	{
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			mStop = true;
+		}
+		mJobAvailable.notify_all();
+		mThreads.join_all();
+	}
+
+	void WorkQueue::push (const Job& job)
+	{
+		{
+			boost::mutex::scoped_lock lock(mMutex);
+			mJobs.push_back(job);
+		}
+		mJobAvailable.notify_one();
+	}
+
+	void WorkQueue::wait ()
+	{
+		boost::mutex::scoped_lock lock(mMutex);
+		while (!mJobs.empty() || mActiveJobs > 0)
+			mIdle.wait(lock);
+	}
+
+	void WorkQueue::run ()
+	{
+		while (true)
+		{
+			Job job;
+			{
+				boost::mutex::scoped_lock lock(mMutex);
+				// finish the remaining jobs before stopping
+				while (mJobs.empty() && !mStop)
+					mJobAvailable.wait(lock);
+				if (mJobs.empty())
+					return;
+
+				job = mJobs.front();
+				mJobs.pop_front();
+				++mActiveJobs;
+			}
+
+			try
+			{
+				job();
+			}
+			catch (std::exception& e)
+			{
+				std::cerr << "sh::WorkQueue: Unhandled exception in job: " << e.what() << std::endl;
+			}
+
+			{
+				boost::mutex::scoped_lock lock(mMutex);
+				--mActiveJobs;
+				if (mJobs.empty() && mActiveJobs == 0)
+					mIdle.notify_all();
+			}
+		}
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef SH_WORKQUEUE_H
+#define SH_WORKQUEUE_H
+
+#include <deque>
+
+#include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace sh
+{
+	/**
+	 * @brief A pool of worker threads that execute queued jobs in FIFO order
+	 * @note Jobs must not touch any state that is shared with the main thread (e.g. the \a Factory or \a Platform),
+	 * unless it is protected separately.
+	 */
+	class WorkQueue
+	{
+	public:
+		typedef boost::function<void ()> Job;
+
+		/// @param threadCount number of worker threads, 0 to use the number of hardware threads
+		WorkQueue (unsigned int threadCount);
+
+		/// @note waits for all queued jobs to finish
+		~WorkQueue ();
+
+		void push (const Job& job);
+
+		/// Blocks until all jobs that were pushed so far have finished.
+		void wait ();
+
+		unsigned int getThreadCount () const { return mThreadCount; }
+
+	private:
+		void run ();
+
+		boost::thread_group mThreads;
+		unsigned int mThreadCount;
+
+		boost::mutex mMutex;
+		boost::condition_variable mJobAvailable;
+		boost::condition_variable mIdle;
+
+		std::deque<Job> mJobs;
+		unsigned int mActiveJobs;
+		bool mStop;
+	};
+}
+
+#endif
@@ -0,0 +1,40 @@
+#include "NullCallLog.hpp"
+
+namespace sh
+{
+	NullCallLog::NullCallLog ()
+		: mEnabled(true)
+	{
+	}
+
+	NullCall& NullCallLog::add (const std::string& object, const std::string& function)
+	{
+		if (!mEnabled)
+		{
+			mDiscarded.mArguments.clear();
+			return mDiscarded;
+		}
+
+		mCalls.push_back(NullCall());
+		NullCall& call = mCalls.back();
+		call.mObject = object;
+		call.mFunction = function;
+		return call;
+	}
+
+	unsigned int NullCallLog::count (const std::string& function) const
+	{
+		unsigned int result = 0;
+		for (std::vector<NullCall>::const_iterator it = mCalls.begin(); it != mCalls.end(); ++it)
+		{
+			if (it->mFunction == function)
+				++result;
+		}
+		return result;
+	}
+
+	void NullCallLog::clear ()
+	{
+		mCalls.clear();
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef SH_NULLCALLLOG_H
+#define SH_NULLCALLLOG_H
+
+#include <string>
+#include <vector>
+
+namespace sh
+{
+	struct NullCall
+	{
+		std::string mObject; ///< name of the object that received the call, e.g. the material or program name
+		std::string mFunction;
+		std::vector<std::string> mArguments;
+	};
+
+	/**
+	 * @brief The calls that the objects of a \a NullPlatform received, in the order they were made.
+	 * @note Not thread safe, the Factory only calls into the platform from the main thread.
+	 */
+	class NullCallLog
+	{
+	public:
+		NullCallLog ();
+
+		/// Append a call, the caller adds the arguments to the returned record.
+		/// @note if the log is disabled, the record is not kept
+		NullCall& add (const std::string& object, const std::string& function);
+
+		const std::vector<NullCall>& getCalls () const { return mCalls; }
+
+		/// @return number of calls to the given function
+		unsigned int count (const std::string& function) const;
+
+		void clear ();
+
+		/// Recording can be disabled e.g. for benchmarks, where the log would only grow. The default is enabled.
+		void setEnabled (bool enabled) { mEnabled = enabled; }
+		bool getEnabled () const { return mEnabled; }
+
+	private:
+		std::vector<NullCall> mCalls;
+		NullCall mDiscarded;
+		bool mEnabled;
+	};
+}
+
+#endif
@@ -0,0 +1,38 @@
+#include "NullGpuProgram.hpp"
+
+#include "NullCallLog.hpp"
+
+namespace sh
+{
+	NullGpuProgram::NullGpuProgram (GpuProgramType type, const std::string& compileArguments, const std::string& name,
+		const std::string& profile, const std::string& source, Language lang, NullCallLog* log)
+		: mType(type)
+		, mCompileArguments(compileArguments)
+		, mName(name)
+		, mProfile(profile)
+		, mSource(source)
+		, mLanguage(lang)
+		, mLog(log)
+	{
+	}
+
+	bool NullGpuProgram::getSupported ()
+	{
+		mLog->add(mName, "getSupported");
+		return true;
+	}
+
+	void NullGpuProgram::setAutoConstant (const std::string& name, const std::string& autoConstantName, const std::string& extraInfo)
+	{
+		NullCall& call = mLog->add(mName, "setAutoConstant");
+		call.mArguments.push_back(name);
+		call.mArguments.push_back(autoConstantName);
+		call.mArguments.push_back(extraInfo);
+
+		NullAutoConstant constant;
+		constant.mName = name;
+		constant.mAutoConstantName = autoConstantName;
+		constant.mExtraInfo = extraInfo;
+		mAutoConstants.push_back(constant);
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef SH_NULLGPUPROGRAM_H
+#define SH_NULLGPUPROGRAM_H
+
+#include <string>
+#include <vector>
+
+#include "../../Main/Platform.hpp"
+
+namespace sh
+{
+	class NullCallLog;
+
+	struct NullAutoConstant
+	{
+		std::string mName;
+		std::string mAutoConstantName;
+		std::string mExtraInfo;
+	};
+
+	/// A program that is never compiled, it only keeps the source and the auto constants.
+	class NullGpuProgram : public GpuProgram
+	{
+	public:
+		NullGpuProgram (GpuProgramType type, const std::string& compileArguments, const std::string& name,
+			const std::string& profile, const std::string& source, Language lang, NullCallLog* log);
+
+		virtual bool getSupported ();
+
+		virtual void setAutoConstant (const std::string& name, const std::string& autoConstantName, const std::string& extraInfo = "");
+
+		GpuProgramType getType () const { return mType; }
+		const std::string& getCompileArguments () const { return mCompileArguments; }
+		const std::string& getName () const { return mName; }
+		const std::string& getProfile () const { return mProfile; }
+		const std::string& getSource () const { return mSource; }
+		Language getLanguage () const { return mLanguage; }
+		const std::vector<NullAutoConstant>& getAutoConstants () const { return mAutoConstants; }
+
+	private:
+		GpuProgramType mType;
+		std::string mCompileArguments;
+		std::string mName;
+		std::string mProfile;
+		std::string mSource;
+		Language mLanguage;
+
+		std::vector<NullAutoConstant> mAutoConstants;
+
+		NullCallLog* mLog;
+	};
+}
+
+#endif
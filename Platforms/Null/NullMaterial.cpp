@@ -0,0 +1,107 @@
+#include "NullMaterial.hpp"
+
+#include <sstream>
+
+#include <boost/lexical_cast.hpp>
+
+#include "NullPass.hpp"
+#include "NullCallLog.hpp"
+
+namespace sh
+{
+	NullMaterial::NullMaterial (const std::string& name, NullCallLog* log)
+		: mName(name)
+		, mLog(log)
+	{
+	}
+
+	boost::shared_ptr<Pass> NullMaterial::createPass (const std::string& configuration, unsigned short lodIndex)
+	{
+		NullCall& call = mLog->add(mName, "createPass");
+		call.mArguments.push_back(configuration);
+		call.mArguments.push_back(boost::lexical_cast<std::string>(lodIndex));
+
+		NullPassList& passes = mTechniques[std::make_pair(configuration, lodIndex)];
+
+		std::stringstream object;
+		object << mName << "/" << configuration << "/" << lodIndex << "/" << passes.size();
+
+		boost::shared_ptr<NullPass> pass (new NullPass (configuration, lodIndex, object.str(), mLog));
+		passes.push_back(pass);
+		return pass;
+	}
+
+	bool NullMaterial::createConfiguration (const std::string& name, unsigned short lodIndex)
+	{
+		NullCall& call = mLog->add(mName, "createConfiguration");
+		call.mArguments.push_back(name);
+		call.mArguments.push_back(boost::lexical_cast<std::string>(lodIndex));
+
+		return mTechniques.insert(std::make_pair(std::make_pair(name, lodIndex), NullPassList())).second;
+	}
+
+	bool NullMaterial::isUnreferenced ()
+	{
+		mLog->add(mName, "isUnreferenced");
+		return false;
+	}
+
+	void NullMaterial::unreferenceTextures ()
+	{
+		mLog->add(mName, "unreferenceTextures");
+	}
+
+	void NullMaterial::ensureLoaded ()
+	{
+		mLog->add(mName, "ensureLoaded");
+	}
+
+	void NullMaterial::removeAll ()
+	{
+		mLog->add(mName, "removeAll");
+		mTechniques.clear();
+	}
+
+	void NullMaterial::retireAll ()
+	{
+		mLog->add(mName, "retireAll");
+		mTechniques.clear();
+	}
+
+	void NullMaterial::setLodLevels (const std::string& lodLevels)
+	{
+		mLog->add(mName, "setLodLevels").mArguments.push_back(lodLevels);
+		mLodLevels = lodLevels;
+	}
+
+	void NullMaterial::setShadowCasterMaterial (const std::string& name)
+	{
+		mLog->add(mName, "setShadowCasterMaterial").mArguments.push_back(name);
+		mShadowCasterMaterial = name;
+	}
+
+	bool NullMaterial::hasConfiguration (const std::string& configuration, unsigned short lodIndex) const
+	{
+		return mTechniques.find(std::make_pair(configuration, lodIndex)) != mTechniques.end();
+	}
+
+	const NullPassList& NullMaterial::getPasses (const std::string& configuration, unsigned short lodIndex) const
+	{
+		static const NullPassList empty;
+		TechniqueMap::const_iterator it = mTechniques.find(std::make_pair(configuration, lodIndex));
+		if (it == mTechniques.end())
+			return empty;
+		return it->second;
+	}
+
+	std::vector<unsigned short> NullMaterial::getLodIndices (const std::string& configuration) const
+	{
+		std::vector<unsigned short> result;
+		for (TechniqueMap::const_iterator it = mTechniques.begin(); it != mTechniques.end(); ++it)
+		{
+			if (it->first.first == configuration)
+				result.push_back(it->first.second);
+		}
+		return result;
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef SH_NULLMATERIAL_H
+#define SH_NULLMATERIAL_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../Main/Platform.hpp"
+
+namespace sh
+{
+	class NullPass;
+	class NullCallLog;
+
+	typedef std::vector<boost::shared_ptr<NullPass> > NullPassList;
+
+	/// Keeps the passes of each configuration and lod level, in the order they were created.
+	class NullMaterial : public Material
+	{
+	public:
+		NullMaterial (const std::string& name, NullCallLog* log);
+
+		virtual boost::shared_ptr<Pass> createPass (const std::string& configuration, unsigned short lodIndex);
+		virtual bool createConfiguration (const std::string& name, unsigned short lodIndex);
+
+		virtual bool isUnreferenced();
+		virtual void unreferenceTextures();
+		virtual void ensureLoaded();
+
+		virtual void removeAll ();
+		virtual void retireAll ();
+
+		virtual void setLodLevels (const std::string& lodLevels);
+		virtual void setShadowCasterMaterial (const std::string& name);
+
+		const std::string& getName () const { return mName; }
+
+		bool hasConfiguration (const std::string& configuration, unsigned short lodIndex) const;
+
+		/// @return the passes of this configuration, or an empty list if it was not created
+		const NullPassList& getPasses (const std::string& configuration, unsigned short lodIndex) const;
+
+		/// @return the lod levels that were created for this configuration, in ascending order
+		std::vector<unsigned short> getLodIndices (const std::string& configuration) const;
+
+		const std::string& getLodLevels () const { return mLodLevels; }
+		const std::string& getShadowCasterMaterial () const { return mShadowCasterMaterial; }
+
+	private:
+		typedef std::map<std::pair<std::string, unsigned short>, NullPassList> TechniqueMap;
+
+		std::string mName;
+		TechniqueMap mTechniques;
+
+		std::string mLodLevels;
+		std::string mShadowCasterMaterial;
+
+		NullCallLog* mLog;
+	};
+}
+
+#endif
@@ -0,0 +1,97 @@
+#include "NullPass.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+#include "NullTextureUnitState.hpp"
+#include "NullCallLog.hpp"
+
+namespace sh
+{
+	NullPass::NullPass (const std::string& configuration, unsigned short lodIndex, const std::string& object, NullCallLog* log)
+		: mConfiguration(configuration)
+		, mLodIndex(lodIndex)
+		, mObject(object)
+		, mLog(log)
+	{
+	}
+
+	boost::shared_ptr<TextureUnitState> NullPass::createTextureUnitState (const std::string& name)
+	{
+		mLog->add(mObject, "createTextureUnitState").mArguments.push_back(name);
+
+		boost::shared_ptr<NullTextureUnitState> textureUnit (new NullTextureUnitState (name, mObject + "/" + name, mLog));
+		mTextureUnits.push_back(textureUnit);
+		return textureUnit;
+	}
+
+	void NullPass::assignProgram (GpuProgramType type, const std::string& name)
+	{
+		NullCall& call = mLog->add(mObject, "assignProgram");
+		call.mArguments.push_back(boost::lexical_cast<std::string>(type));
+		call.mArguments.push_back(name);
+
+		mPrograms[type] = name;
+	}
+
+	std::string NullPass::getProgram (GpuProgramType type) const
+	{
+		std::map<GpuProgramType, std::string>::const_iterator it = mPrograms.find(type);
+		if (it == mPrograms.end())
+			return "";
+		return it->second;
+	}
+
+	bool NullPass::setPropertyOverride (const std::string &name, PropertyValuePtr& value, PropertySetGet* context)
+	{
+		std::string stringValue = retrieveValue<StringValue>(value, context).get();
+		NullCall& call = mLog->add(mObject, "setProperty");
+		call.mArguments.push_back(name);
+		call.mArguments.push_back(stringValue);
+
+		if (name == "vertex_program" || name == "fragment_program")
+			return true; // handled already
+
+		mProperties[name] = stringValue;
+		return true;
+	}
+
+	void NullPass::setGpuConstant (int type, const std::string& name, ValueType vt, PropertyValuePtr value, PropertySetGet* context)
+	{
+		NullGpuConstant constant;
+		constant.mProgramType = type;
+		constant.mName = name;
+		constant.mValueType = vt;
+		constant.mValue = retrieveValue<StringValue>(value, context).get();
+
+		NullCall& call = mLog->add(mObject, "setGpuConstant");
+		call.mArguments.push_back(boost::lexical_cast<std::string>(type));
+		call.mArguments.push_back(name);
+		call.mArguments.push_back(boost::lexical_cast<std::string>(vt));
+		call.mArguments.push_back(constant.mValue);
+
+		mGpuConstants.push_back(constant);
+	}
+
+	void NullPass::addSharedParameter (int type, const std::string& name)
+	{
+		NullCall& call = mLog->add(mObject, "addSharedParameter");
+		call.mArguments.push_back(boost::lexical_cast<std::string>(type));
+		call.mArguments.push_back(name);
+
+		mSharedParameters.push_back(std::make_pair(type, name));
+	}
+
+	void NullPass::setTextureUnitIndex (int programType, const std::string& name, int index)
+	{
+		NullCall& call = mLog->add(mObject, "setTextureUnitIndex");
+		call.mArguments.push_back(boost::lexical_cast<std::string>(programType));
+		call.mArguments.push_back(name);
+		call.mArguments.push_back(boost::lexical_cast<std::string>(index));
+
+		NullTextureUnitIndex textureUnitIndex;
+		textureUnitIndex.mProgramType = programType;
+		textureUnitIndex.mName = name;
+		textureUnitIndex.mIndex = index;
+		mTextureUnitIndices.push_back(textureUnitIndex);
+	}
+}
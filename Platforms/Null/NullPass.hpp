@@ -0,0 +1,78 @@
+#ifndef SH_NULLPASS_H
+#define SH_NULLPASS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../Main/Platform.hpp"
+
+namespace sh
+{
+	class NullTextureUnitState;
+	class NullCallLog;
+
+	struct NullGpuConstant
+	{
+		int mProgramType;
+		std::string mName;
+		ValueType mValueType;
+		std::string mValue;
+	};
+
+	struct NullTextureUnitIndex
+	{
+		int mProgramType;
+		std::string mName;
+		int mIndex;
+	};
+
+	/// Records the programs, constants and texture units that are assigned to it.
+	class NullPass : public Pass
+	{
+	public:
+		/// @param object name to record the calls with
+		NullPass (const std::string& configuration, unsigned short lodIndex, const std::string& object, NullCallLog* log);
+
+		virtual boost::shared_ptr<TextureUnitState> createTextureUnitState (const std::string& name);
+		virtual void assignProgram (GpuProgramType type, const std::string& name);
+
+		virtual void setGpuConstant (int type, const std::string& name, ValueType vt, PropertyValuePtr value, PropertySetGet* context);
+
+		virtual void addSharedParameter (int type, const std::string& name);
+		virtual void setTextureUnitIndex (int programType, const std::string& name, int index);
+
+		const std::string& getConfiguration () const { return mConfiguration; }
+		unsigned short getLodIndex () const { return mLodIndex; }
+
+		/// @return name of the program of the given type, or an empty string if none was assigned
+		std::string getProgram (GpuProgramType type) const;
+
+		const std::vector<NullGpuConstant>& getGpuConstants () const { return mGpuConstants; }
+		const std::vector<std::pair<int, std::string> >& getSharedParameters () const { return mSharedParameters; }
+		const std::vector<NullTextureUnitIndex>& getTextureUnitIndices () const { return mTextureUnitIndices; }
+		const std::vector<boost::shared_ptr<NullTextureUnitState> >& getTextureUnits () const { return mTextureUnits; }
+
+		/// @return all properties that were set, except for the programs
+		const std::map<std::string, std::string>& getProperties () const { return mProperties; }
+
+	private:
+		std::string mConfiguration;
+		unsigned short mLodIndex;
+
+		std::map<GpuProgramType, std::string> mPrograms;
+		std::vector<NullGpuConstant> mGpuConstants;
+		std::vector<std::pair<int, std::string> > mSharedParameters; ///< program type, parameter name
+		std::vector<NullTextureUnitIndex> mTextureUnitIndices;
+		std::vector<boost::shared_ptr<NullTextureUnitState> > mTextureUnits;
+		std::map<std::string, std::string> mProperties;
+
+		std::string mObject;
+		NullCallLog* mLog;
+
+	protected:
+		virtual bool setPropertyOverride (const std::string &name, PropertyValuePtr& value, PropertySetGet* context);
+	};
+}
+
+#endif
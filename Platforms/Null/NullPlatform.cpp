@@ -0,0 +1,106 @@
+#include "NullPlatform.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+#include "NullGpuProgram.hpp"
+#include "NullMaterial.hpp"
+
+namespace sh
+{
+	NullPlatform::NullPlatform (const std::string& basePath)
+		: Platform(basePath)
+	{
+	}
+
+	NullPlatform::~NullPlatform ()
+	{
+	}
+
+	MaterialInstance* NullPlatform::requestMaterial (const std::string& name, const std::string& configuration, unsigned short lodIndex)
+	{
+		return fireMaterialRequested (name, configuration, lodIndex);
+	}
+
+	NullGpuProgram* NullPlatform::getGpuProgram (const std::string& name) const
+	{
+		NullGpuProgramMap::const_iterator it = mGpuPrograms.find(name);
+		if (it == mGpuPrograms.end())
+			return NULL;
+		return it->second.get();
+	}
+
+	NullMaterial* NullPlatform::getMaterial (const std::string& name) const
+	{
+		NullMaterialMap::const_iterator it = mMaterials.find(name);
+		if (it == mMaterials.end())
+			return NULL;
+		return it->second.get();
+	}
+
+	const std::string& NullPlatform::getDefaultSchemeName ()
+	{
+		// same as Ogre's default scheme, so that material files can be shared
+		static const std::string name = "Default";
+		return name;
+	}
+
+	bool NullPlatform::supportsMaterialLookup ()
+	{
+		// requestMaterial goes through Factory::requestMaterial, which creates the material if necessary
+		return true;
+	}
+
+	bool NullPlatform::isProfileSupported (const std::string& profile)
+	{
+		mCallLog.add("platform", "isProfileSupported").mArguments.push_back(profile);
+		return true;
+	}
+
+	bool NullPlatform::isDefaultMaterialSchemeName(const std::string& name) const
+	{
+		return name == getDefaultSchemeName();
+	}
+
+	boost::shared_ptr<Material> NullPlatform::createMaterial (const std::string& name)
+	{
+		mCallLog.add("platform", "createMaterial").mArguments.push_back(name);
+
+		boost::shared_ptr<NullMaterial> material (new NullMaterial(name, &mCallLog));
+		mMaterials[name] = material;
+		return material;
+	}
+
+	boost::shared_ptr<GpuProgram> NullPlatform::createGpuProgram (
+		GpuProgramType type,
+		const std::string& compileArguments,
+		const std::string& name, const std::string& profile,
+		const std::string& source, Language lang)
+	{
+		NullCall& call = mCallLog.add("platform", "createGpuProgram");
+		call.mArguments.push_back(boost::lexical_cast<std::string>(type));
+		call.mArguments.push_back(compileArguments);
+		call.mArguments.push_back(name);
+		call.mArguments.push_back(profile);
+		call.mArguments.push_back(boost::lexical_cast<std::string>(lang));
+
+		boost::shared_ptr<NullGpuProgram> program (new NullGpuProgram(type, compileArguments, name, profile, source, lang, &mCallLog));
+		mGpuPrograms[name] = program;
+		return program;
+	}
+
+	void NullPlatform::destroyGpuProgram (const std::string& name)
+	{
+		mCallLog.add("platform", "destroyGpuProgram").mArguments.push_back(name);
+		mGpuPrograms.erase(name);
+	}
+
+	void NullPlatform::setSharedParameter (const std::string& name, PropertyValuePtr value)
+	{
+		std::string stringValue = retrieveValue<StringValue>(value, NULL).get();
+		NullCall& call = mCallLog.add("platform", "setSharedParameter");
+		call.mArguments.push_back(name);
+		call.mArguments.push_back(stringValue);
+
+		mSharedParameters[name] = stringValue;
+	}
+}
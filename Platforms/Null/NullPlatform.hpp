@@ -0,0 +1,96 @@
+#ifndef SH_NULLPLATFORM_H
+#define SH_NULLPLATFORM_H
+
+/**
+ * @addtogroup Platforms
+ * @{
+ */
+
+/**
+ * @addtogroup Null
+ * A platform without any rendering backend, for tools and tests that only need the material system. \n
+ * Programs are never compiled, everything the Factory sets up is kept in memory so that it can be inspected:
+ * the current state through the NullMaterial / NullPass / NullGpuProgram objects, and every call that the
+ * platform and its objects received through the call log.
+ * @{
+ */
+
+#include <map>
+
+#include "../../Main/Platform.hpp"
+
+#include "NullCallLog.hpp"
+
+namespace sh
+{
+	class NullGpuProgram;
+	class NullMaterial;
+
+	typedef std::map<std::string, boost::shared_ptr<NullGpuProgram> > NullGpuProgramMap;
+	typedef std::map<std::string, boost::shared_ptr<NullMaterial> > NullMaterialMap;
+
+	class NullPlatform : public Platform
+	{
+	public:
+		NullPlatform (const std::string& basePath);
+		virtual ~NullPlatform ();
+
+		/// Create the given configuration of a material, like a renderer would when the material is first used.
+		/// Materials that were not created yet (see Factory::setLazyMaterialLoading) are created first.
+		/// @return the material instance, or NULL if it could not be created
+		MaterialInstance* requestMaterial (const std::string& name, const std::string& configuration, unsigned short lodIndex = 0);
+
+		/// @return the programs that currently exist, by name
+		const NullGpuProgramMap& getGpuPrograms () const { return mGpuPrograms; }
+
+		/// @return the program with this name, or NULL if it does not exist
+		NullGpuProgram* getGpuProgram (const std::string& name) const;
+
+		/// @return all materials that were created, by name
+		const NullMaterialMap& getMaterials () const { return mMaterials; }
+
+		/// @return the material with this name, or NULL if it was not created
+		NullMaterial* getMaterial (const std::string& name) const;
+
+		/// @return the current value of every shared parameter that was set
+		const std::map<std::string, std::string>& getSharedParameters () const { return mSharedParameters; }
+
+		/// @return the calls that the platform and the objects it created received
+		NullCallLog& getCallLog () { return mCallLog; }
+
+		/// @return name of the default configuration (the default material scheme)
+		static const std::string& getDefaultSchemeName ();
+
+	private:
+		virtual bool supportsMaterialLookup ();
+
+		virtual bool isProfileSupported (const std::string& profile);
+
+		virtual bool isDefaultMaterialSchemeName(const std::string& name) const;
+
+		virtual boost::shared_ptr<Material> createMaterial (const std::string& name);
+
+		virtual boost::shared_ptr<GpuProgram> createGpuProgram (
+			GpuProgramType type,
+			const std::string& compileArguments,
+			const std::string& name, const std::string& profile,
+			const std::string& source, Language lang);
+
+		virtual void destroyGpuProgram (const std::string& name);
+
+		virtual void setSharedParameter (const std::string& name, PropertyValuePtr value);
+
+		NullCallLog mCallLog; ///< @note declared first, so that it outlives the objects that record into it
+
+		NullGpuProgramMap mGpuPrograms;
+		NullMaterialMap mMaterials;
+		std::map<std::string, std::string> mSharedParameters;
+	};
+}
+
+/**
+ * @}
+ * @}
+ */
+
+#endif
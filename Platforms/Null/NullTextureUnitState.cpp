@@ -0,0 +1,36 @@
+#include "NullTextureUnitState.hpp"
+
+#include "NullCallLog.hpp"
+
+namespace sh
+{
+	NullTextureUnitState::NullTextureUnitState (const std::string& name, const std::string& object, NullCallLog* log)
+		: TextureUnitState()
+		, mName(name)
+		, mObject(object)
+		, mLog(log)
+	{
+	}
+
+	bool NullTextureUnitState::setPropertyOverride (const std::string &name, PropertyValuePtr& value, PropertySetGet* context)
+	{
+		std::string stringValue = retrieveValue<StringValue>(value, context).get();
+		NullCall& call = mLog->add(mObject, "setProperty");
+		call.mArguments.push_back(name);
+		call.mArguments.push_back(stringValue);
+
+		if (name == "texture_alias")
+			return TextureUnitState::setPropertyOverride (name, value, context);
+		else if (name == "direct_texture")
+			setTextureName (stringValue);
+
+		mProperties[name] = stringValue;
+		return true;
+	}
+
+	void NullTextureUnitState::setTextureName (const std::string& textureName)
+	{
+		mLog->add(mObject, "setTextureName").mArguments.push_back(textureName);
+		mTextureName = textureName;
+	}
+}
@@ -0,0 +1,40 @@
+#ifndef SH_NULLTEXTUREUNITSTATE_H
+#define SH_NULLTEXTUREUNITSTATE_H
+
+#include <map>
+#include <string>
+
+#include "../../Main/Platform.hpp"
+
+namespace sh
+{
+	class NullCallLog;
+
+	class NullTextureUnitState : public TextureUnitState
+	{
+	public:
+		/// @param object name to record the calls with
+		NullTextureUnitState (const std::string& name, const std::string& object, NullCallLog* log);
+
+		virtual void setTextureName (const std::string& textureName);
+
+		const std::string& getName () const { return mName; }
+		const std::string& getTextureName () const { return mTextureName; }
+
+		/// @return all properties that were set, except for texture_alias (see getTextureName)
+		const std::map<std::string, std::string>& getProperties () const { return mProperties; }
+
+	private:
+		std::string mName;
+		std::string mTextureName;
+		std::map<std::string, std::string> mProperties;
+
+		std::string mObject;
+		NullCallLog* mLog;
+
+	protected:
+		virtual bool setPropertyOverride (const std::string &name, PropertyValuePtr& value, PropertySetGet* context);
+	};
+}
+
+#endif
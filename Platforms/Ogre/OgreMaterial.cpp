@@ -11,6 +11,7 @@
 namespace sh
 {
 	static const std::string sDefaultTechniqueName = "SH_DefaultTechnique";
+	static const std::string sRetiredSchemePrefix = "SH_Retired_";
 
 	OgreMaterial::OgreMaterial (const std::string& name, const std::string& resourceGroup)
 		: Material()
@@ -60,6 +61,40 @@ namespace sh
 		mMaterial->compile();
 	}
 
+	void OgreMaterial::retireAll ()
+	{
+		if (mMaterial.isNull())
+			return;
+
+		// techniques that were retired before are outdated now if their configuration has been created again
+		for (int i=mMaterial->getNumTechniques()-1; i>=0; --i)
+		{
+			Ogre::Technique* t = mMaterial->getTechnique(i);
+			if (t->getSchemeName().compare(0, sRetiredSchemePrefix.size(), sRetiredSchemePrefix) == 0
+					&& findOgreTechniqueForConfiguration(t->getSchemeName().substr(sRetiredSchemePrefix.size()), t->getLodIndex()))
+				mMaterial->removeTechnique(i);
+		}
+
+		// move the remaining techniques out of the way, they can still be used as placeholders
+		for (int i=0; i<mMaterial->getNumTechniques(); ++i)
+		{
+			Ogre::Technique* t = mMaterial->getTechnique(i);
+			if (t->getSchemeName() != sDefaultTechniqueName
+					&& t->getSchemeName().compare(0, sRetiredSchemePrefix.size(), sRetiredSchemePrefix) != 0)
+				t->setSchemeName (sRetiredSchemePrefix + t->getSchemeName());
+		}
+		mMaterial->compile();
+	}
+
+	void OgreMaterial::removeTechnique (const std::string& schemeName, unsigned short lodIndex)
+	{
+		for (int i=mMaterial->getNumTechniques()-1; i>=0; --i)
+		{
+			if (mMaterial->getTechnique(i)->getSchemeName() == schemeName && mMaterial->getTechnique(i)->getLodIndex() == lodIndex)
+				mMaterial->removeTechnique(i);
+		}
+	}
+
 	void OgreMaterial::setLodLevels (const std::string& lodLevels)
 	{
 		OgreMaterialSerializer& s = OgrePlatform::getSerializer();
@@ -75,6 +110,9 @@ namespace sh
 				return false;
 		}
 
+		// the placeholder is not needed anymore
+		removeTechnique (sRetiredSchemePrefix + name, lodIndex);
+
 		Ogre::Technique* t = mMaterial->createTechnique();
 		t->setSchemeName (name);
 		t->setLodIndex (lodIndex);
@@ -91,7 +129,7 @@ namespace sh
 		return mMaterial;
 	}
 
-	Ogre::Technique* OgreMaterial::getOgreTechniqueForConfiguration (const std::string& configurationName, unsigned short lodIndex)
+	Ogre::Technique* OgreMaterial::findOgreTechniqueForConfiguration (const std::string& configurationName, unsigned short lodIndex)
 	{
 		for (int i=0; i<mMaterial->getNumTechniques(); ++i)
 		{
@@ -100,6 +138,19 @@ namespace sh
 				return mMaterial->getTechnique(i);
 			}
 		}
+		return NULL;
+	}
+
+	Ogre::Technique* OgreMaterial::getRetiredTechnique (const std::string& configurationName, unsigned short lodIndex)
+	{
+		return findOgreTechniqueForConfiguration (sRetiredSchemePrefix + configurationName, lodIndex);
+	}
+
+	Ogre::Technique* OgreMaterial::getOgreTechniqueForConfiguration (const std::string& configurationName, unsigned short lodIndex)
+	{
+		Ogre::Technique* t = findOgreTechniqueForConfiguration (configurationName, lodIndex);
+		if (t)
+			return t;
 
 		// Prepare and throw error message
 		std::stringstream message;
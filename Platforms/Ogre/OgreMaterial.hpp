@@ -24,6 +24,7 @@ namespace sh
 		virtual void ensureLoaded();
 
 		virtual void removeAll ();
+		virtual void retireAll ();
 
 		Ogre::MaterialPtr getOgreMaterial();
 
@@ -31,9 +32,17 @@ namespace sh
 
 		Ogre::Technique* getOgreTechniqueForConfiguration (const std::string& configurationName, unsigned short lodIndex = 0);
 
+		/// @return the technique for this configuration, or NULL if it was not created (yet)
+		Ogre::Technique* findOgreTechniqueForConfiguration (const std::string& configurationName, unsigned short lodIndex = 0);
+
+		/// @return the technique that was used for this configuration before retireAll was called, or NULL if there is none
+		Ogre::Technique* getRetiredTechnique (const std::string& configurationName, unsigned short lodIndex = 0);
+
 		virtual void setShadowCasterMaterial (const std::string& name);
 
 	private:
+		void removeTechnique (const std::string& schemeName, unsigned short lodIndex);
+
 		Ogre::MaterialPtr mMaterial;
 		std::string mName;
 
@@ -83,11 +83,33 @@ namespace sh
 		#endif
 	}
 
+	bool OgrePlatform::isMicrocodeCached (const std::string& name)
+	{
+		#if OGRE_VERSION >= (1 << 16 | 9 << 8 | 0)
+		return Ogre::GpuProgramManager::getSingleton().isMicrocodeAvailableInCache(name);
+		#else
+		return false;
+		#endif
+	}
+
 	bool OgrePlatform::supportsMaterialQueuedListener ()
 	{
 		return true;
 	}
 
+	bool OgrePlatform::supportsMaterialLookup ()
+	{
+		return true;
+	}
+
+	Ogre::MaterialPtr OgrePlatform::getMaterial (const std::string& name)
+	{
+		Ogre::MaterialPtr material = Ogre::MaterialManager::getSingleton().getByName(name);
+		if (material.isNull() && fireMaterialLookup(name))
+			material = Ogre::MaterialManager::getSingleton().getByName(name);
+		return material;
+	}
+
 	boost::shared_ptr<Material> OgrePlatform::createMaterial (const std::string& name)
 	{
 		OgreMaterial* material = new OgreMaterial(name, mResourceGroup);
@@ -117,12 +139,34 @@ namespace sh
 		if (m)
 		{
 			OgreMaterial* _m = static_cast<OgreMaterial*>(m->getMaterial());
-			return _m->getOgreTechniqueForConfiguration (schemeName, lodIndex);
+			Ogre::Technique* t = _m->findOgreTechniqueForConfiguration (schemeName, lodIndex);
+			if (!t)
+				t = getPlaceholderTechnique (originalMaterial, _m, schemeName, lodIndex); // still being created in the background
+			return t;
 		}
 		else
 			return 0; // material does not belong to us
 	}
 
+	Ogre::Technique* OgrePlatform::getPlaceholderTechnique (Ogre::Material* originalMaterial, OgreMaterial* material,
+		const std::string& schemeName, unsigned short lodIndex)
+	{
+		// prefer whatever was rendered before the material was invalidated
+		Ogre::Technique* t = material->getRetiredTechnique (schemeName, lodIndex);
+		if (t)
+			return t;
+
+		std::string placeholder = mFactory->getPlaceholderMaterial();
+		if (placeholder.empty() || placeholder == originalMaterial->getName())
+			return 0;
+
+		Ogre::MaterialPtr placeholderMaterial = Ogre::MaterialManager::getSingleton().getByName(placeholder);
+		if (placeholderMaterial.isNull())
+			return 0;
+		placeholderMaterial->load();
+		return placeholderMaterial->getBestTechnique(lodIndex);
+	}
+
 	void OgrePlatform::serializeShaders (const std::string& file)
 	{
 		#if OGRE_VERSION >= (1 << 16 | 9 << 8 | 0)
@@ -20,6 +20,7 @@
 namespace sh
 {
 	class OgreMaterialSerializer;
+	class OgreMaterial;
 
 	class OgrePlatform : public Platform, public Ogre::MaterialManager::Listener
 	{
@@ -33,7 +34,15 @@ namespace sh
 
 		static OgreMaterialSerializer& getSerializer();
 
+		/// @return the Ogre material with this name, after creating it if it was not used yet (see Factory::setLazyMaterialLoading).
+		/// Use this instead of Ogre::MaterialManager::getByName to assign materials, Ogre has no way to ask for unknown material names.
+		Ogre::MaterialPtr getMaterial (const std::string& name);
+
 	private:
+		/// technique to render with while the material is being created in the background
+		Ogre::Technique* getPlaceholderTechnique (Ogre::Material* originalMaterial, OgreMaterial* material,
+			const std::string& schemeName, unsigned short lodIndex);
+
 		virtual bool isProfileSupported (const std::string& profile);
 
 		virtual void serializeShaders (const std::string& file);
@@ -58,7 +67,9 @@ namespace sh
 
 	protected:
 		virtual bool supportsShaderSerialization ();
+		virtual bool isMicrocodeCached (const std::string& name);
 		virtual bool supportsMaterialQueuedListener ();
+		virtual bool supportsMaterialLookup ();
 
 		std::string mResourceGroup;
 
@@ -0,0 +1,432 @@
+/**
+ * shiny-bake: generates the shader permutations of all materials offline, so that the source cache
+ * does not have to be filled by running the game.
+ *
+ * Usage:
+ *   shiny-bake [options] <base path> <cache folder>
+ *     --language <glsl|glsles|cg|hlsl>   language to generate for, may be repeated (default: all)
+ *     --configuration <name>              configuration to generate for, may be repeated (default: all, including "Default")
+ *     --setting <name>=<value>            set a global setting, may be repeated
+ *     --settings-file <file>              read global settings from a file with one <name>=<value> per line
+ *     --shard <i>/<n>                     only generate every n-th material configuration, starting with the i-th (0 based)
+ *     --builtin-preprocessor              use the built-in preprocessor instead of boost::wave
+ *
+ *   shiny-bake --merge <cache folder> <shard cache folder>...
+ *     merges the results of several shards into one cache folder
+ *
+ *   shiny-bake --compare-preprocessors [options] <base path>
+ *     generates the same permutations (with the --language, --configuration and --setting options above), but runs every
+ *     shader source through both the built-in preprocessor and boost::wave instead of writing a cache. Fails on the first
+ *     source where the output is not exactly the same. Sources that the built-in preprocessor does not support are counted,
+ *     but are not a failure, since boost::wave handles them in normal use.
+ *
+ * The generated sources are stored in the source cache of the cache folder, the programs, constants and texture units
+ * that every material configuration uses are listed in a manifest next to it. When splitting the work with --shard,
+ * every process needs its own cache folder, since the cache files are not shared between processes.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/filesystem.hpp>
+
+#include "../../Main/Factory.hpp"
+#include "../../Main/CacheArchive.hpp"
+#include "../../Main/Preprocessor.hpp"
+#include "../../Platforms/Null/NullPlatform.hpp"
+#include "../../Platforms/Null/NullMaterial.hpp"
+#include "../../Platforms/Null/NullPass.hpp"
+#include "../../Platforms/Null/NullGpuProgram.hpp"
+#include "../../Platforms/Null/NullTextureUnitState.hpp"
+
+#include "../Common/Arguments.hpp"
+
+namespace
+{
+	using sh::tools::getLanguageName;
+
+	const std::string sManifestName = "bakeManifest.txt";
+
+	/// manifest block header -> block, so that the manifest is sorted and programs are only listed once
+	typedef std::map<std::string, std::string> Manifest;
+
+	struct Options
+	{
+		std::string mBasePath;
+		std::string mCacheFolder;
+		std::vector<sh::Language> mLanguages;
+		std::vector<std::string> mConfigurations;
+		std::vector<std::pair<std::string, std::string> > mSettings;
+		unsigned int mShardIndex;
+		unsigned int mShardCount;
+		bool mBuiltinPreprocessor;
+		bool mComparePreprocessors;
+
+		Options () : mShardIndex(0), mShardCount(1), mBuiltinPreprocessor(false), mComparePreprocessors(false) {}
+	};
+
+	void printUsage ()
+	{
+		std::cerr << "Usage: shiny-bake [options] <base path> <cache folder>\n"
+			<< "  --language <glsl|glsles|cg|hlsl>   language to generate for, may be repeated (default: all)\n"
+			<< "  --configuration <name>              configuration to generate for, may be repeated (default: all)\n"
+			<< "  --setting <name>=<value>            set a global setting, may be repeated\n"
+			<< "  --settings-file <file>              read global settings from a file with one <name>=<value> per line\n"
+			<< "  --shard <i>/<n>                     only generate every n-th material configuration, starting with the i-th\n"
+			<< "  --builtin-preprocessor              use the built-in preprocessor instead of boost::wave\n"
+			<< "       shiny-bake --merge <cache folder> <shard cache folder>...\n"
+			<< "  merge the results of several shards into one cache folder\n"
+			<< "       shiny-bake --compare-preprocessors [options] <base path>\n"
+			<< "  compare the output of the built-in preprocessor and boost::wave for every permutation" << std::endl;
+	}
+
+	const char* getProgramTypeName (int type)
+	{
+		return (type == sh::GPT_Vertex) ? "vertex" : "fragment";
+	}
+
+	void parseShard (const std::string& shard, Options& options)
+	{
+		size_t slash = shard.find('/');
+		try
+		{
+			if (slash == std::string::npos)
+				throw boost::bad_lexical_cast();
+			options.mShardIndex = boost::lexical_cast<unsigned int>(shard.substr(0, slash));
+			options.mShardCount = boost::lexical_cast<unsigned int>(shard.substr(slash+1));
+		}
+		catch (boost::bad_lexical_cast&)
+		{
+			throw std::runtime_error ("invalid shard \"" + shard + "\", expected <i>/<n>");
+		}
+		if (options.mShardCount == 0 || options.mShardIndex >= options.mShardCount)
+			throw std::runtime_error ("invalid shard \"" + shard + "\", expected 0 <= i < n");
+	}
+
+	void readManifest (const std::string& path, Manifest& manifest)
+	{
+		std::ifstream stream (path.c_str());
+		if (!stream.is_open())
+			throw std::runtime_error ("unable to open " + path);
+
+		std::string line, header;
+		while (std::getline(stream, line))
+		{
+			if (line.empty())
+				continue;
+			if (line[0] != '\t')
+			{
+				header = line;
+				manifest[header] = "";
+			}
+			else if (!header.empty())
+				manifest[header] += line + "\n";
+		}
+	}
+
+	void writeManifest (const std::string& path, const Manifest& manifest)
+	{
+		std::ofstream stream (path.c_str());
+		for (Manifest::const_iterator it = manifest.begin(); it != manifest.end(); ++it)
+			stream << it->first << "\n" << it->second;
+		if (!stream)
+			throw std::runtime_error ("unable to write " + path);
+	}
+
+	void addProgram (const sh::NullGpuProgram& program, Manifest& manifest)
+	{
+		std::stringstream block;
+		block << "\ttype " << getProgramTypeName(program.getType()) << "\n"
+			<< "\tlanguage " << getLanguageName(program.getLanguage()) << "\n"
+			<< "\tprofile " << program.getProfile() << "\n";
+		const std::vector<sh::NullAutoConstant>& autoConstants = program.getAutoConstants();
+		for (std::vector<sh::NullAutoConstant>::const_iterator it = autoConstants.begin(); it != autoConstants.end(); ++it)
+			block << "\tauto_constant " << it->mName << " " << it->mAutoConstantName << " " << it->mExtraInfo << "\n";
+
+		manifest["program " + program.getName()] = block.str();
+	}
+
+	void addMaterial (const sh::NullPlatform& platform, const sh::NullMaterial& material,
+		const std::string& configuration, sh::Language lang, Manifest& manifest)
+	{
+		std::vector<unsigned short> lodIndices = material.getLodIndices(configuration);
+		for (std::vector<unsigned short>::const_iterator lodIt = lodIndices.begin(); lodIt != lodIndices.end(); ++lodIt)
+		{
+			std::stringstream block;
+			const sh::NullPassList& passes = material.getPasses(configuration, *lodIt);
+			for (size_t i=0; i<passes.size(); ++i)
+			{
+				const sh::NullPass& pass = *passes[i];
+				block << "\tpass " << i << "\n";
+
+				for (int type = sh::GPT_Vertex; type <= sh::GPT_Fragment; ++type)
+				{
+					std::string name = pass.getProgram(static_cast<sh::GpuProgramType>(type));
+					if (name.empty())
+						continue;
+					block << "\t\t" << getProgramTypeName(type) << "_program " << name << "\n";
+
+					sh::NullGpuProgram* program = platform.getGpuProgram(name);
+					if (program)
+						addProgram(*program, manifest);
+				}
+
+				const std::vector<sh::NullGpuConstant>& constants = pass.getGpuConstants();
+				for (std::vector<sh::NullGpuConstant>::const_iterator it = constants.begin(); it != constants.end(); ++it)
+					block << "\t\tconstant " << getProgramTypeName(it->mProgramType) << " " << it->mName << " " << it->mValue << "\n";
+
+				const std::vector<std::pair<int, std::string> >& sharedParameters = pass.getSharedParameters();
+				for (std::vector<std::pair<int, std::string> >::const_iterator it = sharedParameters.begin(); it != sharedParameters.end(); ++it)
+					block << "\t\tshared_parameter " << getProgramTypeName(it->first) << " " << it->second << "\n";
+
+				const std::vector<boost::shared_ptr<sh::NullTextureUnitState> >& textureUnits = pass.getTextureUnits();
+				for (std::vector<boost::shared_ptr<sh::NullTextureUnitState> >::const_iterator it = textureUnits.begin(); it != textureUnits.end(); ++it)
+					block << "\t\ttexture_unit " << (*it)->getName() << " " << (*it)->getTextureName() << "\n";
+
+				const std::vector<sh::NullTextureUnitIndex>& indices = pass.getTextureUnitIndices();
+				for (std::vector<sh::NullTextureUnitIndex>::const_iterator it = indices.begin(); it != indices.end(); ++it)
+					block << "\t\ttexture_unit_index " << getProgramTypeName(it->mProgramType) << " " << it->mName << " " << it->mIndex << "\n";
+			}
+
+			std::stringstream header;
+			header << "material " << material.getName() << " configuration " << configuration
+				<< " lod " << *lodIt << " language " << getLanguageName(lang);
+			manifest[header.str()] = block.str();
+		}
+	}
+
+	int merge (const std::string& cacheFolder, const std::vector<std::string>& shardFolders)
+	{
+		boost::filesystem::create_directories(cacheFolder);
+
+		const char* archiveNames[] = { "sourceCache", "failedPermutations" };
+		for (size_t i=0; i<sizeof(archiveNames)/sizeof(archiveNames[0]); ++i)
+		{
+			sh::CacheArchive archive (cacheFolder + "/" + archiveNames[i]);
+			for (std::vector<std::string>::const_iterator it = shardFolders.begin(); it != shardFolders.end(); ++it)
+			{
+				sh::CacheArchive shard (*it + "/" + archiveNames[i]);
+				archive.merge(shard);
+			}
+		}
+
+		Manifest manifest;
+		std::string manifestPath = cacheFolder + "/" + sManifestName;
+		if (boost::filesystem::exists(manifestPath))
+			readManifest(manifestPath, manifest);
+		for (std::vector<std::string>::const_iterator it = shardFolders.begin(); it != shardFolders.end(); ++it)
+			readManifest(*it + "/" + sManifestName, manifest);
+		writeManifest(manifestPath, manifest);
+
+		std::cout << "Merged " << shardFolders.size() << " shards into " << cacheFolder << std::endl;
+		return 0;
+	}
+
+	std::vector<std::string> getConfigurations (const Options& options, sh::Factory& factory)
+	{
+		std::vector<std::string> configurations = options.mConfigurations;
+		if (configurations.empty())
+		{
+			configurations.push_back(sh::NullPlatform::getDefaultSchemeName());
+			factory.listConfigurationNames(configurations);
+		}
+		return configurations;
+	}
+
+	int bake (const Options& options)
+	{
+		boost::filesystem::create_directories(options.mCacheFolder);
+
+		sh::NullPlatform* platform = new sh::NullPlatform(options.mBasePath);
+		platform->setCacheFolder(options.mCacheFolder);
+
+		std::string errors;
+		unsigned int count = 0;
+		Manifest manifest;
+		{
+			sh::Factory factory (platform);
+			factory.setReadSourceCache(true);
+			factory.setWriteSourceCache(true);
+			if (options.mBuiltinPreprocessor)
+				factory.setPreprocessorBackend(sh::PreprocessorBackend_Builtin);
+			for (size_t i=0; i<options.mSettings.size(); ++i)
+				factory.setGlobalSetting(options.mSettings[i].first, options.mSettings[i].second);
+
+			factory.setCurrentLanguage(options.mLanguages.front());
+			factory.loadAllFiles();
+
+			std::vector<std::string> materials;
+			factory.listMaterials(materials);
+
+			std::vector<std::string> configurations = getConfigurations(options, factory);
+
+			// the index of a material configuration decides which shard it belongs to, so the order has to be the same for every shard
+			unsigned int index = 0;
+			for (std::vector<sh::Language>::const_iterator langIt = options.mLanguages.begin(); langIt != options.mLanguages.end(); ++langIt)
+			{
+				factory.setCurrentLanguage(*langIt);
+				for (std::vector<std::string>::const_iterator it = materials.begin(); it != materials.end(); ++it)
+				{
+					for (std::vector<std::string>::const_iterator configIt = configurations.begin(); configIt != configurations.end(); ++configIt, ++index)
+					{
+						if (index % options.mShardCount != options.mShardIndex)
+							continue;
+
+						// this creates all lod levels of the configuration
+						if (!platform->requestMaterial(*it, *configIt))
+							continue;
+						++count;
+
+						sh::NullMaterial* material = platform->getMaterial(*it);
+						if (material)
+							addMaterial(*platform, *material, *configIt, *langIt, manifest);
+					}
+				}
+			}
+
+			errors = factory.getErrorLog();
+		}
+
+		writeManifest(options.mCacheFolder + "/" + sManifestName, manifest);
+
+		std::cout << "Baked " << count << " material configurations into " << options.mCacheFolder << std::endl;
+		if (!errors.empty())
+		{
+			std::cerr << "Errors:\n" << errors << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	int comparePreprocessors (const Options& options)
+	{
+		sh::NullPlatform* platform = new sh::NullPlatform(options.mBasePath);
+
+		// identical sources are only compared once, thanks to the preprocess cache
+		unsigned int sourcesBefore = sh::Preprocessor::getCacheMisses();
+		unsigned int fallbacksBefore = sh::Preprocessor::getBuiltinFallbacks();
+		unsigned int mismatchesBefore = sh::Preprocessor::getBackendMismatches();
+
+		std::string errors;
+		unsigned int count = 0;
+		{
+			sh::Factory factory (platform);
+			factory.setPreprocessorBackend(sh::PreprocessorBackend_Compare);
+			for (size_t i=0; i<options.mSettings.size(); ++i)
+				factory.setGlobalSetting(options.mSettings[i].first, options.mSettings[i].second);
+
+			factory.setCurrentLanguage(options.mLanguages.front());
+			factory.loadAllFiles();
+
+			std::vector<std::string> materials;
+			factory.listMaterials(materials);
+
+			std::vector<std::string> configurations = getConfigurations(options, factory);
+
+			for (std::vector<sh::Language>::const_iterator langIt = options.mLanguages.begin(); langIt != options.mLanguages.end(); ++langIt)
+			{
+				factory.setCurrentLanguage(*langIt);
+				for (std::vector<std::string>::const_iterator it = materials.begin(); it != materials.end(); ++it)
+				{
+					for (std::vector<std::string>::const_iterator configIt = configurations.begin(); configIt != configurations.end(); ++configIt)
+					{
+						platform->requestMaterial(*it, *configIt);
+						++count;
+
+						if (sh::Preprocessor::getBackendMismatches() != mismatchesBefore)
+						{
+							std::cerr << "Preprocessor output differs for material " << *it << " configuration " << *configIt
+								<< " language " << getLanguageName(*langIt) << ":\n" << factory.getErrorLog() << std::endl;
+							return 1;
+						}
+					}
+				}
+			}
+
+			errors = factory.getErrorLog();
+		}
+
+		std::cout << "Compared " << (sh::Preprocessor::getCacheMisses() - sourcesBefore) << " sources of " << count
+			<< " material configurations, " << (sh::Preprocessor::getBuiltinFallbacks() - fallbacksBefore)
+			<< " not supported by the built-in preprocessor, no differences" << std::endl;
+
+		// errors that both backends agree on are not a failure of this check
+		if (!errors.empty())
+			std::cerr << "Errors:\n" << errors << std::endl;
+		return 0;
+	}
+}
+
+int main (int argc, char** argv)
+{
+	try
+	{
+		std::vector<std::string> args (argv+1, argv+argc);
+		if (!args.empty() && args[0] == "--merge")
+		{
+			if (args.size() < 3)
+			{
+				printUsage();
+				return 1;
+			}
+			return merge(args[1], std::vector<std::string>(args.begin()+2, args.end()));
+		}
+
+		Options options;
+		std::vector<std::string> positional;
+		for (size_t i=0; i<args.size(); ++i)
+		{
+			const std::string& arg = args[i];
+			bool hasValue = i+1 < args.size();
+			if (arg == "--builtin-preprocessor")
+				options.mBuiltinPreprocessor = true;
+			else if (arg == "--compare-preprocessors")
+				options.mComparePreprocessors = true;
+			else if (arg == "--language" && hasValue)
+				options.mLanguages.push_back(sh::tools::parseLanguage(args[++i]));
+			else if (arg == "--configuration" && hasValue)
+				options.mConfigurations.push_back(args[++i]);
+			else if (arg == "--setting" && hasValue)
+				options.mSettings.push_back(sh::tools::parseSetting(args[++i]));
+			else if (arg == "--settings-file" && hasValue)
+				sh::tools::readSettingsFile(args[++i], options.mSettings);
+			else if (arg == "--shard" && hasValue)
+				parseShard(args[++i], options);
+			else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0)
+			{
+				printUsage();
+				return 1;
+			}
+			else
+				positional.push_back(arg);
+		}
+
+		if (positional.size() != (options.mComparePreprocessors ? 1u : 2u))
+		{
+			printUsage();
+			return 1;
+		}
+		options.mBasePath = positional[0];
+		if (!options.mComparePreprocessors)
+			options.mCacheFolder = positional[1];
+
+		if (options.mLanguages.empty())
+		{
+			for (int i=0; i<sh::Language_Count; ++i)
+				options.mLanguages.push_back(static_cast<sh::Language>(i));
+		}
+
+		return options.mComparePreprocessors ? comparePreprocessors(options) : bake(options);
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << "shiny-bake: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,860 @@
+/**
+ * shiny-bench: measures the startup and material request latency of the material system on a headless platform,
+ * and prints the results as JSON.
+ *
+ * Usage:
+ *   shiny-bench [options] <base path>
+ *     --runs <n>                          number of repetitions, every run uses a new Factory (default: 5)
+ *     --materials <n>                     number of materials to request. If the library has fewer materials, clones of them
+ *                                         are created (same permutations, but more material instances) (default: all)
+ *     --language <glsl|glsles|cg|hlsl>   language to generate (default: glsl)
+ *     --configuration <name>              configuration to request, may be repeated (default: all, including "Default")
+ *     --setting <name>=<value>            set a global setting, may be repeated
+ *     --settings-file <file>              read global settings from a file with one <name>=<value> per line
+ *     --builtin-preprocessor              use the built-in preprocessor instead of boost::wave
+ *     --output <file>                     write the results to a file instead of the standard output
+ *     --trace <file>                      write a Chrome trace of the loading and requests of the first run
+ *     --script-snapshot <folder>          read and write the script snapshot in this folder (see Factory::setReadScriptSnapshot),
+ *                                         so that only the first run parses the script files
+ *     --lazy-materials                    create the materials when they are first used (see Factory::setLazyMaterialLoading)
+ *
+ * Measured per run:
+ * - Factory::loadAllFiles
+ * - requesting every material in every configuration, the first time (cold: generates the shaders) and again (warm).
+ *   A request creates all lod levels of the configuration.
+ * - ShaderSet::getInstance for every pass of every material, in the default configuration on a new Factory.
+ *   Calls that had to create the permutation are reported as misses, the others as hits.
+ * - the phase timings and counters of Factory::getStatistics while loading and requesting the materials (summed over all runs)
+ *
+ * The in-memory preprocessor caches are cleared before every run, so that every run is cold.
+ *
+ *   shiny-bench --macros [--layers <n>] [--runs <n>] [--output <file>]
+ *
+ * Expands the @sh* macros of a generated terrain-style shader (a @shForeach block per layer, and the blending of the layers
+ * written out) once with the find/replace loops that ShaderInstance used before MacroExpander, and once with MacroExpander,
+ * with the same stand-ins for the properties and global settings. Fails if the outputs differ, otherwise prints the time
+ * and allocations of both and the speedup. The preprocessor is not run in between.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono/system_clocks.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "../../Main/Factory.hpp"
+#include "../../Main/MacroExpander.hpp"
+#include "../../Main/MaterialInstance.hpp"
+#include "../../Main/Preprocessor.hpp"
+#include "../../Platforms/Null/NullPlatform.hpp"
+
+#include "../Common/Arguments.hpp"
+
+namespace
+{
+	/// number of calls to operator new, on all threads (ScriptLoader::loadAllFiles parses on worker threads)
+	boost::atomic<unsigned long long> sAllocations (0);
+}
+
+#if __cplusplus >= 201103L
+#define SH_BENCH_THROW_BAD_ALLOC
+#define SH_BENCH_NOTHROW noexcept
+#else
+#define SH_BENCH_THROW_BAD_ALLOC throw(std::bad_alloc)
+#define SH_BENCH_NOTHROW throw()
+#endif
+
+void* operator new (std::size_t size) SH_BENCH_THROW_BAD_ALLOC
+{
+	sAllocations.fetch_add(1, boost::memory_order_relaxed);
+	void* p = std::malloc(size ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete (void* p) SH_BENCH_NOTHROW
+{
+	std::free(p);
+}
+
+#if __cplusplus >= 201402L
+void operator delete (void* p, std::size_t) SH_BENCH_NOTHROW
+{
+	std::free(p);
+}
+#endif
+
+namespace
+{
+	struct Options
+	{
+		std::string mBasePath;
+		unsigned int mRuns;
+		unsigned int mMaterialCount; ///< 0 for all
+		sh::Language mLanguage;
+		std::vector<std::string> mConfigurations;
+		std::vector<std::pair<std::string, std::string> > mSettings;
+		bool mBuiltinPreprocessor;
+		std::string mOutput;
+		std::string mTrace;
+		std::string mScriptSnapshotFolder;
+		bool mLazyMaterials;
+		bool mMacros;
+		unsigned int mMacroLayers;
+
+		Options () : mRuns(5), mMaterialCount(0), mLanguage(sh::Language_GLSL), mBuiltinPreprocessor(false), mLazyMaterials(false)
+			, mMacros(false), mMacroLayers(64) {}
+	};
+
+	/// durations (in milliseconds) and allocation counts of the measured operations
+	struct Samples
+	{
+		std::vector<double> mTimes;
+		unsigned long long mAllocations;
+
+		Samples () : mAllocations(0) {}
+	};
+
+	/// Measures a single operation
+	class Measurement
+	{
+	public:
+		Measurement ()
+			: mStart(boost::chrono::steady_clock::now())
+			, mAllocations(sAllocations.load(boost::memory_order_relaxed))
+		{
+		}
+
+		void finish (Samples& samples)
+		{
+			samples.mTimes.push_back(boost::chrono::duration<double, boost::milli>(boost::chrono::steady_clock::now() - mStart).count());
+			samples.mAllocations += sAllocations.load(boost::memory_order_relaxed) - mAllocations;
+		}
+
+	private:
+		boost::chrono::steady_clock::time_point mStart;
+		unsigned long long mAllocations;
+	};
+
+	struct Results
+	{
+		Samples mLoad;
+		std::vector<Samples> mColdRequests; ///< per configuration
+		std::vector<Samples> mWarmRequests; ///< per configuration
+		Samples mInstanceMisses;
+		Samples mInstanceHits;
+		boost::uint64_t mPhaseCounts[sh::StatisticsPhase_Count];
+		boost::uint64_t mPhaseTimes[sh::StatisticsPhase_Count]; ///< nanoseconds
+		boost::uint64_t mCounters[sh::StatisticsCounter_Count];
+		unsigned int mMaterialCount;
+		unsigned int mErrors;
+
+		Results () : mMaterialCount(0), mErrors(0)
+		{
+			std::fill(mPhaseCounts, mPhaseCounts + sh::StatisticsPhase_Count, 0);
+			std::fill(mPhaseTimes, mPhaseTimes + sh::StatisticsPhase_Count, 0);
+			std::fill(mCounters, mCounters + sh::StatisticsCounter_Count, 0);
+		}
+	};
+
+	void printUsage ()
+	{
+		std::cerr << "Usage: shiny-bench [options] <base path>\n"
+			<< "       shiny-bench --macros [--layers <n>] [--runs <n>] [--output <file>]\n"
+			<< "  --runs <n>                          number of repetitions (default: 5)\n"
+			<< "  --materials <n>                     number of materials to request, clones are added if necessary (default: all)\n"
+			<< "  --language <glsl|glsles|cg|hlsl>   language to generate (default: glsl)\n"
+			<< "  --configuration <name>              configuration to request, may be repeated (default: all)\n"
+			<< "  --setting <name>=<value>            set a global setting, may be repeated\n"
+			<< "  --settings-file <file>              read global settings from a file with one <name>=<value> per line\n"
+			<< "  --builtin-preprocessor              use the built-in preprocessor instead of boost::wave\n"
+			<< "  --output <file>                     write the results to a file instead of the standard output\n"
+			<< "  --trace <file>                      write a Chrome trace of the loading and requests of the first run\n"
+			<< "  --script-snapshot <folder>          read and write the script snapshot in this folder\n"
+			<< "  --lazy-materials                    create the materials when they are first used\n"
+			<< "  --macros                            compare the expansion of the @sh* macros with the former find/replace loops\n"
+			<< "  --layers <n>                        number of layers of the shader expanded by --macros (default: 64)" << std::endl;
+	}
+
+	std::string escapeJson (const std::string& str)
+	{
+		std::string result;
+		for (std::string::const_iterator it = str.begin(); it != str.end(); ++it)
+		{
+			if (*it == '"' || *it == '\\')
+				result += '\\';
+			if (static_cast<unsigned char>(*it) < 0x20)
+				result += ' ';
+			else
+				result += *it;
+		}
+		return result;
+	}
+
+	/// @param percentile between 0 and 100, uses the nearest rank
+	double getPercentile (const std::vector<double>& sorted, double percentile)
+	{
+		if (sorted.empty())
+			return 0;
+		size_t rank = static_cast<size_t>(percentile / 100.0 * sorted.size() + 0.5);
+		return sorted[std::min(sorted.size()-1, rank > 0 ? rank-1 : 0)];
+	}
+
+	void writeSamples (std::ostream& stream, const Samples& samples, const std::string& indentation)
+	{
+		std::vector<double> sorted = samples.mTimes;
+		std::sort(sorted.begin(), sorted.end());
+		double total = 0;
+		for (std::vector<double>::const_iterator it = sorted.begin(); it != sorted.end(); ++it)
+			total += *it;
+		double count = sorted.empty() ? 1 : static_cast<double>(sorted.size());
+
+		stream << "{\n"
+			<< indentation << "\t\"count\": " << sorted.size() << ",\n"
+			<< indentation << "\t\"total_ms\": " << total << ",\n"
+			<< indentation << "\t\"mean_ms\": " << total / count << ",\n"
+			<< indentation << "\t\"p50_ms\": " << getPercentile(sorted, 50) << ",\n"
+			<< indentation << "\t\"p90_ms\": " << getPercentile(sorted, 90) << ",\n"
+			<< indentation << "\t\"p99_ms\": " << getPercentile(sorted, 99) << ",\n"
+			<< indentation << "\t\"max_ms\": " << (sorted.empty() ? 0 : sorted.back()) << ",\n"
+			<< indentation << "\t\"per_second\": " << (total > 0 ? sorted.size() * 1000.0 / total : 0) << ",\n"
+			<< indentation << "\t\"allocations\": " << samples.mAllocations << ",\n"
+			<< indentation << "\t\"allocations_per_call\": " << samples.mAllocations / count << "\n"
+			<< indentation << "}";
+	}
+
+	void writeResults (std::ostream& stream, const Options& options, const std::vector<std::string>& configurations, const Results& results)
+	{
+		stream << "{\n"
+			<< "\t\"runs\": " << options.mRuns << ",\n"
+			<< "\t\"materials\": " << results.mMaterialCount << ",\n"
+			<< "\t\"language\": \"" << sh::tools::getLanguageName(options.mLanguage) << "\",\n"
+			<< "\t\"errors\": " << results.mErrors << ",\n"
+			<< "\t\"loadAllFiles\": ";
+		writeSamples(stream, results.mLoad, "\t");
+
+		stream << ",\n\t\"requestMaterial\": {";
+		for (size_t i=0; i<configurations.size(); ++i)
+		{
+			stream << (i ? "," : "") << "\n\t\t\"" << escapeJson(configurations[i]) << "\": {\n\t\t\t\"cold\": ";
+			writeSamples(stream, results.mColdRequests[i], "\t\t\t");
+			stream << ",\n\t\t\t\"warm\": ";
+			writeSamples(stream, results.mWarmRequests[i], "\t\t\t");
+			stream << "\n\t\t}";
+		}
+
+		stream << "\n\t},\n\t\"getInstance\": {\n\t\t\"miss\": ";
+		writeSamples(stream, results.mInstanceMisses, "\t\t");
+		stream << ",\n\t\t\"hit\": ";
+		writeSamples(stream, results.mInstanceHits, "\t\t");
+		stream << "\n\t},\n\t\"statistics\": {";
+		for (int i=0; i<sh::StatisticsPhase_Count; ++i)
+		{
+			sh::StatisticsPhase phase = static_cast<sh::StatisticsPhase>(i);
+			stream << (i ? "," : "") << "\n\t\t\"" << sh::Statistics::getName(phase) << "\": { \"count\": " << results.mPhaseCounts[i]
+				<< ", \"total_ms\": " << results.mPhaseTimes[i] / 1000000.0 << " }";
+		}
+		for (int i=0; i<sh::StatisticsCounter_Count; ++i)
+			stream << ",\n\t\t\"" << sh::Statistics::getName(static_cast<sh::StatisticsCounter>(i)) << "\": " << results.mCounters[i];
+		stream << "\n\t}\n}" << std::endl;
+	}
+
+	/// Create a factory on a headless platform, with the options applied. Does not load the files yet.
+	sh::Factory* createFactory (const Options& options, sh::NullPlatform*& platform)
+	{
+		platform = new sh::NullPlatform(options.mBasePath);
+		platform->getCallLog().setEnabled(false);
+
+		sh::Factory* factory = new sh::Factory(platform);
+		if (options.mBuiltinPreprocessor)
+			factory->setPreprocessorBackend(sh::PreprocessorBackend_Builtin);
+		for (size_t i=0; i<options.mSettings.size(); ++i)
+			factory->setGlobalSetting(options.mSettings[i].first, options.mSettings[i].second);
+		factory->setCurrentLanguage(options.mLanguage);
+		factory->setLazyMaterialLoading(options.mLazyMaterials);
+		if (!options.mScriptSnapshotFolder.empty())
+		{
+			platform->setCacheFolder(options.mScriptSnapshotFolder);
+			factory->setReadScriptSnapshot(true);
+			factory->setWriteScriptSnapshot(true);
+		}
+		return factory;
+	}
+
+	/// @return the names of the materials to request, after creating clones if the library does not have enough materials
+	std::vector<std::string> prepareMaterials (sh::Factory& factory, unsigned int count)
+	{
+		std::vector<std::string> materials;
+		factory.listMaterials(materials);
+		if (count == 0 || materials.empty())
+			return materials;
+
+		std::vector<std::string> result (materials.begin(), materials.begin() + std::min<size_t>(count, materials.size()));
+		for (unsigned int i = result.size(); i < count; ++i)
+		{
+			std::string name = "shiny-bench/" + boost::lexical_cast<std::string>(i);
+			factory.createMaterialInstance(name, materials[i % materials.size()]);
+			result.push_back(name);
+		}
+		return result;
+	}
+
+	/// @param trace file to write a trace to, empty for none
+	void measureRequests (const Options& options, const std::vector<std::string>& configurations, const std::string& trace, Results& results)
+	{
+		sh::NullPlatform* platform;
+		sh::Factory* factory = createFactory(options, platform);
+		if (!trace.empty())
+			factory->startTrace(trace);
+
+		{
+			Measurement measurement;
+			factory->loadAllFiles();
+			measurement.finish(results.mLoad);
+		}
+
+		std::vector<std::string> materials = prepareMaterials(*factory, options.mMaterialCount);
+		results.mMaterialCount = materials.size();
+
+		for (size_t i=0; i<configurations.size(); ++i)
+		{
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				Samples& samples = (pass == 0) ? results.mColdRequests[i] : results.mWarmRequests[i];
+				for (std::vector<std::string>::const_iterator it = materials.begin(); it != materials.end(); ++it)
+				{
+					Measurement measurement;
+					sh::MaterialInstance* material = platform->requestMaterial(*it, configurations[i]);
+					measurement.finish(samples);
+					if (!material && pass == 0)
+						++results.mErrors;
+				}
+			}
+		}
+
+		const sh::Statistics& statistics = factory->getStatistics();
+		for (int i=0; i<sh::StatisticsPhase_Count; ++i)
+		{
+			results.mPhaseCounts[i] += statistics.getCount(static_cast<sh::StatisticsPhase>(i));
+			results.mPhaseTimes[i] += statistics.getTime(static_cast<sh::StatisticsPhase>(i));
+		}
+		for (int i=0; i<sh::StatisticsCounter_Count; ++i)
+			results.mCounters[i] += statistics.getCount(static_cast<sh::StatisticsCounter>(i));
+
+		delete factory;
+	}
+
+	void measureGetInstance (const Options& options, Results& results)
+	{
+		sh::NullPlatform* platform;
+		sh::Factory* factory = createFactory(options, platform);
+		factory->loadAllFiles();
+		std::vector<std::string> materials = prepareMaterials(*factory, options.mMaterialCount);
+
+		// the same steps as MaterialInstance::createForConfiguration, in the default configuration
+		const char* programProperties[] = { "vertex_program", "fragment_program" };
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			for (std::vector<std::string>::const_iterator it = materials.begin(); it != materials.end(); ++it)
+			{
+				sh::MaterialInstance* material = factory->getMaterialInstance(*it);
+				sh::PassVector* passes = material->getParentPasses();
+				for (sh::PassVector::iterator passIt = passes->begin(); passIt != passes->end(); ++passIt)
+				{
+					passIt->setContext(material);
+					passIt->mShaderProperties.setContext(material);
+					for (int i=0; i<2; ++i)
+					{
+						if (!passIt->hasProperty(programProperties[i]))
+							continue;
+						std::string shaderSet = sh::retrieveValue<sh::StringValue>(passIt->getProperty(programProperties[i]), material).get();
+						if (shaderSet.empty())
+							continue;
+
+						try
+						{
+							sh::ShaderSet* set = factory->getShaderSet(shaderSet);
+							size_t programCount = platform->getGpuPrograms().size();
+
+							Samples samples;
+							Measurement measurement;
+							set->getInstance(&passIt->mShaderProperties);
+							measurement.finish(samples);
+
+							Samples& target = (platform->getGpuPrograms().size() != programCount) ? results.mInstanceMisses : results.mInstanceHits;
+							target.mTimes.push_back(samples.mTimes.back());
+							target.mAllocations += samples.mAllocations;
+						}
+						catch (std::exception&)
+						{
+							if (pass == 0)
+								++results.mErrors;
+						}
+					}
+				}
+			}
+		}
+
+		delete factory;
+	}
+
+	// --macros: the find/replace loops that ShaderInstance used to expand the @sh* macros before MacroExpander, and MacroExpander
+
+	/// Stand-in for the properties, global settings and declarations of a shader instance, the same for both implementations
+	struct MacroState
+	{
+		std::map<std::string, std::string> mProperties;
+		std::map<std::string, std::string> mSettings;
+		std::map<int, int> mCounters;
+		std::map<std::string, std::string> mPassthroughs; ///< name -> number of the passthrough
+		std::vector<std::string> mSamplers;
+		std::map<std::string, std::string> mUniforms; ///< auto constants and uniform properties
+	};
+
+	std::string getString (const std::string& arg) { return arg; }
+	std::string getString (const sh::MacroExpander::Argument& arg) { return arg.str(); }
+	int getInt (const std::string& arg) { return boost::lexical_cast<int>(arg); }
+	int getInt (const sh::MacroExpander::Argument& arg) { return boost::lexical_cast<int>(arg.mBegin, arg.size()); }
+
+	const std::string& lookup (const std::map<std::string, std::string>& values, const std::string& name)
+	{
+		std::map<std::string, std::string>::const_iterator it = values.find(name);
+		if (it == values.end())
+			throw std::runtime_error ("unknown property \"" + name + "\"");
+		return it->second;
+	}
+
+	/// @shProperty* and @shGlobalSetting*
+	template <typename Args>
+	std::string getValue (const MacroState& state, const std::string& command, const Args& args)
+	{
+		bool setting = command.compare(0, 15, "shGlobalSetting") == 0;
+		std::string type = command.substr(setting ? 15 : 10);
+		const std::string& value = lookup(setting ? state.mSettings : state.mProperties, getString(args[0]));
+		if (type == "Bool")
+			return (value == "true" || value == "1") ? "1" : "0";
+		else if (type == "Equal")
+			return (args[1] == value) ? "1" : "0";
+		else if (type == "String")
+			return value;
+		throw std::runtime_error ("unknown command \"" + command + "\"");
+	}
+
+	/// the macros that are expanded after preprocessing
+	template <typename Args>
+	std::string getDeclaration (MacroState& state, const std::string& command, const Args& args)
+	{
+		if (command == "shCounter")
+			return boost::lexical_cast<std::string>(state.mCounters[getInt(args[0])]++);
+		else if (command == "shAllocatePassthrough")
+			state.mPassthroughs[getString(args[1])] = boost::lexical_cast<std::string>(state.mPassthroughs.size());
+		else if (command == "shPassthroughAssign")
+			return "passthrough" + lookup(state.mPassthroughs, getString(args[0])) + " = " + getString(args[1]);
+		else if (command == "shPassthroughReceive")
+			return "passthrough" + lookup(state.mPassthroughs, getString(args[0]));
+		else if (command == "shPassthroughVertexOutputs")
+			return ", out float4 passthrough0 : TEXCOORD0, out float4 passthrough1 : TEXCOORD1";
+		else if (command == "shUseSampler")
+			state.mSamplers.push_back(getString(args[0]));
+		else if (command == "shAutoConstant" || command.compare(0, 17, "shUniformProperty") == 0)
+			state.mUniforms[getString(args[0])] = getString(args[1]);
+		else
+			throw std::runtime_error ("unknown command \"" + command + "\"");
+		return std::string();
+	}
+
+	/// the argument splitting of the former ShaderInstance::extractMacroArguments
+	std::vector<std::string> extractArguments (size_t pos, const std::string& source)
+	{
+		size_t start = source.find("(", pos);
+		size_t end = source.find(")", pos);
+		std::string args = source.substr(start+1, end-(start+1));
+		std::vector<std::string> results;
+		boost::algorithm::split(results, args, boost::is_any_of(","));
+		for (std::vector<std::string>::iterator it = results.begin(); it != results.end(); ++it)
+			boost::algorithm::trim(*it);
+		return results;
+	}
+
+	size_t findClosingParenthesis (const std::string& source, size_t open)
+	{
+		size_t end = open;
+		int depth = 1;
+		while (depth > 0)
+		{
+			++end;
+			if (source[end] == '(')
+				++depth;
+			else if (source[end] == ')')
+				--depth;
+		}
+		return end;
+	}
+
+	/// the former ShaderInstance::parse
+	void parseFindReplace (std::string& source, const MacroState& state)
+	{
+		size_t pos = 0;
+		while (true)
+		{
+			pos = source.find("@", pos);
+			if (pos == std::string::npos)
+				break;
+
+			if (source.compare(pos, 11, "@shProperty") == 0 || source.compare(pos, 16, "@shGlobalSetting") == 0)
+			{
+				std::vector<std::string> args = extractArguments(pos, source);
+				size_t start = source.find("(", pos);
+				size_t end = source.find(")", pos);
+				source.replace(pos, (end+1)-pos, getValue(state, source.substr(pos+1, start-(pos+1)), args));
+			}
+			else if (source.compare(pos, 10, "@shForeach") == 0)
+			{
+				size_t blockEnd = source.find("@shEndForeach", pos);
+				size_t start = source.find("(", pos);
+				size_t end = findClosingParenthesis(source, start);
+				std::string arg = source.substr(start+1, end-(start+1));
+				parseFindReplace(arg, state);
+				int num = boost::lexical_cast<int>(arg);
+
+				std::string content = source.substr(end+1, blockEnd - (end+1));
+				std::string replaceStr;
+				for (int i=0; i<num; ++i)
+				{
+					std::string addStr = content;
+					while (true)
+					{
+						size_t pos2 = addStr.find("@shIterator");
+						if (pos2 == std::string::npos)
+							break;
+						size_t open = pos2 + std::string("@shIterator").length();
+						if (addStr[open] == '(')
+						{
+							size_t close = findClosingParenthesis(addStr, open);
+							std::string offset = addStr.substr(open+1, close-(open+1));
+							parseFindReplace(offset, state);
+							addStr.replace(pos2, (close+1)-pos2, boost::lexical_cast<std::string>(i + boost::lexical_cast<int>(offset)));
+						}
+						else
+							addStr.replace(pos2, std::string("@shIterator").length(), boost::lexical_cast<std::string>(i));
+					}
+					replaceStr += addStr;
+				}
+				source.replace(pos, (blockEnd+std::string("@shEndForeach").length())-pos, replaceStr);
+			}
+			else
+				++pos;
+		}
+	}
+
+	/// one of the former loops that expanded the macros after preprocessing, each of them searched from the start of the source
+	void replaceFindReplace (std::string& source, const std::string& macro, MacroState& state)
+	{
+		while (true)
+		{
+			size_t pos = source.find(macro);
+			if (pos == std::string::npos)
+				break;
+
+			std::vector<std::string> args = extractArguments(pos, source);
+			size_t start = source.find("(", pos);
+			size_t end = source.find(")", pos);
+			source.replace(pos, (end+1)-pos, getDeclaration(state, source.substr(pos+1, start-(pos+1)), args));
+		}
+	}
+
+	void expandFindReplace (std::string& source, MacroState& state)
+	{
+		parseFindReplace(source, state);
+
+		const char* macros[] = { "@shCounter", "@shAllocatePassthrough", "@shPassthroughAssign", "@shPassthroughReceive" };
+		for (size_t i=0; i<sizeof(macros)/sizeof(macros[0]); ++i)
+			replaceFindReplace(source, macros[i], state);
+
+		const std::string vertexOutputs = "@shPassthroughVertexOutputs";
+		size_t pos;
+		while ((pos = source.find(vertexOutputs)) != std::string::npos)
+			source.replace(pos, vertexOutputs.size(), getDeclaration(state, vertexOutputs.substr(1), std::vector<std::string>()));
+
+		const char* declarations[] = { "@shAutoConstant", "@shUniformProperty", "@shUseSampler" };
+		for (size_t i=0; i<sizeof(declarations)/sizeof(declarations[0]); ++i)
+			replaceFindReplace(source, declarations[i], state);
+
+		boost::algorithm::replace_all(source, "@", "#");
+	}
+
+	void expandValue (const std::string& command, const sh::MacroExpander::Arguments& args, std::string& result, const MacroState& state)
+	{
+		result += getValue(state, command, args);
+	}
+
+	void expandIterator (const std::string& /*command*/, const sh::MacroExpander::Arguments& args, std::string& result,
+		const int& iteration, const sh::MacroExpander& expander)
+	{
+		int offset = 0;
+		if (!args.empty())
+		{
+			std::string offsetString;
+			expander.expand(args[0].mBegin, args[0].mEnd, offsetString);
+			offset = boost::lexical_cast<int>(offsetString);
+		}
+		result += boost::lexical_cast<std::string>(iteration + offset);
+	}
+
+	/// the same as ShaderInstance::expandForeach
+	void expandForeach (const std::string& /*command*/, const sh::MacroExpander::Arguments& args, const sh::MacroExpander::Argument& content,
+		std::string& result, const sh::MacroExpander& expander)
+	{
+		std::string count;
+		expander.expand(args[0].mBegin, args[0].mEnd, count);
+		int num = boost::lexical_cast<int>(count);
+
+		int iteration = 0;
+		sh::MacroExpander iteratorExpander;
+		iteratorExpander.addMacro("shIterator", boost::bind(&expandIterator, _1, _2, _3, boost::cref(iteration), boost::cref(expander)),
+			sh::MacroExpander::ArgumentList_Optional);
+
+		std::string block, copy;
+		for (; iteration < num; ++iteration)
+		{
+			iteratorExpander.expand(content.mBegin, content.mEnd, copy);
+			block += copy;
+		}
+
+		std::string expanded;
+		expander.expand(block, expanded);
+		result += expanded;
+	}
+
+	void expandDeclaration (const std::string& command, const sh::MacroExpander::Arguments& args, std::string& result, MacroState& state)
+	{
+		result += getDeclaration(state, command, args);
+	}
+
+	void expandMacroExpander (std::string& source, MacroState& state)
+	{
+		sh::MacroExpander expander;
+		expander.addMacro("shProperty", boost::bind(&expandValue, _1, _2, _3, boost::cref(state)));
+		expander.addMacro("shGlobalSetting", boost::bind(&expandValue, _1, _2, _3, boost::cref(state)));
+		expander.addBlockMacro("shForeach", "shEndForeach", boost::bind(&expandForeach, _1, _2, _3, _4, boost::cref(expander)));
+
+		std::string expanded;
+		expander.expand(source, expanded);
+
+		sh::MacroExpander declarations ('#');
+		const char* macros[] = { "shCounter", "shAllocatePassthrough", "shPassthroughAssign", "shPassthroughReceive",
+			"shAutoConstant", "shUniformProperty", "shUseSampler" };
+		for (size_t i=0; i<sizeof(macros)/sizeof(macros[0]); ++i)
+			declarations.addMacro(macros[i], boost::bind(&expandDeclaration, _1, _2, _3, boost::ref(state)));
+		declarations.addMacro("shPassthroughVertexOutputs", boost::bind(&expandDeclaration, _1, _2, _3, boost::ref(state)),
+			sh::MacroExpander::ArgumentList_None);
+		declarations.expand(expanded, source);
+	}
+
+	/// A terrain-style shader: a block per layer generated with @shForeach, and the blending of the layers written out
+	std::string createLayeredShader (unsigned int layers, MacroState& state)
+	{
+		state.mProperties["num_layers"] = boost::lexical_cast<std::string>(layers);
+		state.mSettings["shadows"] = "true";
+		state.mSettings["fog_density"] = "0.0025";
+
+		std::ostringstream source;
+		source << "#include \"core.h\"\n"
+			<< "#define NUM_LAYERS @shPropertyString(num_layers)\n"
+			<< "@shAllocatePassthrough(2, UV)\n"
+			<< "@shAllocatePassthrough(3, worldPos)\n"
+			<< "@shForeach(@shPropertyString(num_layers))\n"
+			<< "shSampler2D(diffuseMap@shIterator) @shUseSampler(diffuseMap@shIterator)\n"
+			<< "#define LAYER@shIterator_NORMAL_MAP @shPropertyBool(use_normal_map_@shIterator)\n"
+			<< "#define LAYER@shIterator_SPECULAR @shPropertyEqual(specular_@shIterator, 1)\n"
+			<< "shUniform(float4, layerScale@shIterator) @shUniformProperty4f(layerScale@shIterator, layer_scale_@shIterator)\n"
+			<< "#define BLEND_MAP@shIterator blendMap@shCounter(1), UV * @shIterator(1)\n"
+			<< "@shEndForeach\n"
+			<< "SH_START_PROGRAM @shPassthroughVertexOutputs\n{\n"
+			<< "\tshUniform(float4x4, wvp) @shAutoConstant(wvp, worldviewproj_matrix)\n"
+			<< "\tfloat2 UV = @shPassthroughReceive(UV);\n";
+		for (unsigned int i=0; i<layers; ++i)
+		{
+			std::string layer = boost::lexical_cast<std::string>(i);
+			state.mProperties["use_normal_map_" + layer] = (i % 2) ? "true" : "false";
+			state.mProperties["specular_" + layer] = (i % 3) ? "1" : "0";
+			state.mProperties["layer_scale_" + layer] = "layer_scale";
+
+			source << "#if @shGlobalSettingBool(shadows) && @shPropertyBool(use_normal_map_" << layer << ")\n"
+				<< "\tfloat3 normal" << layer << " = shSample(normalMap" << layer << ", UV * layerScale" << layer << ".xy).xyz;\n"
+				<< "\tfloat fog" << layer << " = @shPassthroughReceive(worldPos).z * @shGlobalSettingString(fog_density);\n"
+				<< "#endif\n"
+				<< "\t@shPassthroughAssign(UV, uv" << layer << ");\n";
+		}
+		source << "}\n";
+		return source.str();
+	}
+
+	int measureMacros (const Options& options)
+	{
+		MacroState initialState;
+		const std::string source = createLayeredShader(options.mMacroLayers, initialState);
+
+		Samples findReplace, macroExpander;
+		std::string findReplaceResult, macroExpanderResult;
+		for (unsigned int run = 0; run < options.mRuns; ++run)
+		{
+			MacroState findReplaceState = initialState;
+			findReplaceResult = source;
+			Measurement findReplaceMeasurement;
+			expandFindReplace(findReplaceResult, findReplaceState);
+			findReplaceMeasurement.finish(findReplace);
+
+			MacroState macroExpanderState = initialState;
+			macroExpanderResult = source;
+			Measurement macroExpanderMeasurement;
+			expandMacroExpander(macroExpanderResult, macroExpanderState);
+			macroExpanderMeasurement.finish(macroExpander);
+
+			if (findReplaceResult != macroExpanderResult || findReplaceState.mSamplers != macroExpanderState.mSamplers
+					|| findReplaceState.mUniforms != macroExpanderState.mUniforms)
+			{
+				std::cerr << "shiny-bench: the output of MacroExpander differs from the find/replace loops" << std::endl;
+				return 1;
+			}
+		}
+
+		double findReplaceTotal = 0, macroExpanderTotal = 0;
+		for (unsigned int run = 0; run < options.mRuns; ++run)
+		{
+			findReplaceTotal += findReplace.mTimes[run];
+			macroExpanderTotal += macroExpander.mTimes[run];
+		}
+
+		std::ofstream file;
+		if (!options.mOutput.empty())
+			file.open(options.mOutput.c_str());
+		std::ostream& stream = options.mOutput.empty() ? std::cout : file;
+		stream << "{\n"
+			<< "\t\"runs\": " << options.mRuns << ",\n"
+			<< "\t\"layers\": " << options.mMacroLayers << ",\n"
+			<< "\t\"source_bytes\": " << source.size() << ",\n"
+			<< "\t\"output_bytes\": " << macroExpanderResult.size() << ",\n"
+			<< "\t\"find_replace\": ";
+		writeSamples(stream, findReplace, "\t");
+		stream << ",\n\t\"macro_expander\": ";
+		writeSamples(stream, macroExpander, "\t");
+		stream << ",\n\t\"speedup\": " << (macroExpanderTotal > 0 ? findReplaceTotal / macroExpanderTotal : 0) << "\n}" << std::endl;
+		if (!stream)
+			throw std::runtime_error ("unable to write " + options.mOutput);
+		return 0;
+	}
+}
+
+int main (int argc, char** argv)
+{
+	try
+	{
+		Options options;
+		std::vector<std::string> positional;
+		std::vector<std::string> args (argv+1, argv+argc);
+		for (size_t i=0; i<args.size(); ++i)
+		{
+			const std::string& arg = args[i];
+			bool hasValue = i+1 < args.size();
+			if (arg == "--builtin-preprocessor")
+				options.mBuiltinPreprocessor = true;
+			else if (arg == "--lazy-materials")
+				options.mLazyMaterials = true;
+			else if (arg == "--macros")
+				options.mMacros = true;
+			else if (arg == "--layers" && hasValue)
+				options.mMacroLayers = boost::lexical_cast<unsigned int>(args[++i]);
+			else if (arg == "--runs" && hasValue)
+				options.mRuns = boost::lexical_cast<unsigned int>(args[++i]);
+			else if (arg == "--materials" && hasValue)
+				options.mMaterialCount = boost::lexical_cast<unsigned int>(args[++i]);
+			else if (arg == "--language" && hasValue)
+				options.mLanguage = sh::tools::parseLanguage(args[++i]);
+			else if (arg == "--configuration" && hasValue)
+				options.mConfigurations.push_back(args[++i]);
+			else if (arg == "--setting" && hasValue)
+				options.mSettings.push_back(sh::tools::parseSetting(args[++i]));
+			else if (arg == "--settings-file" && hasValue)
+				sh::tools::readSettingsFile(args[++i], options.mSettings);
+			else if (arg == "--output" && hasValue)
+				options.mOutput = args[++i];
+			else if (arg == "--trace" && hasValue)
+				options.mTrace = args[++i];
+			else if (arg == "--script-snapshot" && hasValue)
+				options.mScriptSnapshotFolder = args[++i];
+			else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0)
+			{
+				printUsage();
+				return 1;
+			}
+			else
+				positional.push_back(arg);
+		}
+		if (options.mMacros && positional.empty() && options.mRuns > 0)
+			return measureMacros(options);
+		if (positional.size() != 1 || options.mRuns == 0)
+		{
+			printUsage();
+			return 1;
+		}
+		options.mBasePath = positional[0];
+		if (!options.mScriptSnapshotFolder.empty())
+			boost::filesystem::create_directories(options.mScriptSnapshotFolder);
+
+		std::vector<std::string> configurations = options.mConfigurations;
+		if (configurations.empty())
+		{
+			// the configurations are only known after loading the files
+			sh::NullPlatform* platform;
+			sh::Factory* factory = createFactory(options, platform);
+			factory->loadAllFiles();
+			configurations.push_back(sh::NullPlatform::getDefaultSchemeName());
+			factory->listConfigurationNames(configurations);
+			delete factory;
+		}
+
+		Results results;
+		results.mColdRequests.resize(configurations.size());
+		results.mWarmRequests.resize(configurations.size());
+		for (unsigned int run = 0; run < options.mRuns; ++run)
+		{
+			sh::Preprocessor::clearCache();
+			sh::Preprocessor::clearIncludeCache();
+			measureRequests(options, configurations, run == 0 ? options.mTrace : std::string(), results);
+
+			sh::Preprocessor::clearCache();
+			sh::Preprocessor::clearIncludeCache();
+			measureGetInstance(options, results);
+		}
+		results.mErrors /= options.mRuns;
+
+		if (options.mOutput.empty())
+			writeResults(std::cout, options, configurations, results);
+		else
+		{
+			std::ofstream stream (options.mOutput.c_str());
+			writeResults(stream, options, configurations, results);
+			if (!stream)
+				throw std::runtime_error ("unable to write " + options.mOutput);
+		}
+		return 0;
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << "shiny-bench: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef SH_TOOLS_ARGUMENTS_H
+#define SH_TOOLS_ARGUMENTS_H
+
+#include <fstream>
+#include <string>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "../../Main/Language.hpp"
+
+/// Command line helpers shared by the tools
+namespace sh
+{
+	namespace tools
+	{
+		inline const char* getLanguageName (Language lang)
+		{
+			switch (lang)
+			{
+			case Language_CG: return "cg";
+			case Language_HLSL: return "hlsl";
+			case Language_GLSL: return "glsl";
+			case Language_GLSLES: return "glsles";
+			default: return "none";
+			}
+		}
+
+		/// @note throws if \a name is not one of the names returned by getLanguageName
+		inline Language parseLanguage (const std::string& name)
+		{
+			for (int i=0; i<Language_Count; ++i)
+			{
+				if (name == getLanguageName(static_cast<Language>(i)))
+					return static_cast<Language>(i);
+			}
+			throw std::runtime_error ("unknown language \"" + name + "\"");
+		}
+
+		/// Split a global setting of the form name=value.
+		/// @note throws if there is no '='
+		inline std::pair<std::string, std::string> parseSetting (const std::string& setting)
+		{
+			size_t pos = setting.find('=');
+			if (pos == std::string::npos)
+				throw std::runtime_error ("invalid setting \"" + setting + "\", expected <name>=<value>");
+			return std::make_pair(setting.substr(0, pos), setting.substr(pos+1));
+		}
+
+		/// Read global settings from a file with one name=value pair per line. Empty lines and lines starting with '#' are skipped.
+		/// @note throws if the file can't be read or a line is invalid
+		inline void readSettingsFile (const std::string& path, std::vector<std::pair<std::string, std::string> >& out)
+		{
+			std::ifstream file (path.c_str());
+			if (!file.is_open())
+				throw std::runtime_error ("unable to read settings file " + path);
+
+			std::string line;
+			while (std::getline(file, line))
+			{
+				if (!line.empty() && line[line.size()-1] == '\r')
+					line.erase(line.size()-1);
+				if (line.empty() || line[0] == '#')
+					continue;
+				out.push_back(parseSetting(line));
+			}
+		}
+	}
+}
+
+#endif
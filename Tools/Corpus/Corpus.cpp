@@ -0,0 +1,433 @@
+/**
+ * shiny-corpus: generates a synthetic material library (materials, shader sets, shaders, configurations and lod configurations)
+ * of configurable size, for scaling tests with shiny-bench and shiny-bake.
+ *
+ * Usage:
+ *   shiny-corpus [options] <output path>
+ *     --materials <n>           number of materials, not counting the parent materials (default: 1000)
+ *     --materials-per-file <n>  number of materials in every .mat file (default: 250)
+ *     --depth <n>               number of parents of every material, at least 1 (default: 3)
+ *     --properties <n>          number of shader properties per pass (default: 8)
+ *     --foreach <n>             number of @shForeach loops in every shader (default: 1)
+ *     --settings <n>            number of global settings that every shader set uses (default: 4)
+ *     --global-settings <n>     total number of global settings (default: 16)
+ *     --fanout <n>              number of different values of every shader property and global setting (default: 4).
+ *                               A shader set has up to fanout^properties permutations per configuration.
+ *     --shader-sets <n>         number of vertex/fragment shader set pairs (default: 8)
+ *     --configurations <n>      number of configurations (default: 2)
+ *     --lods <n>                number of lod configurations (default: 2)
+ *     --seed <n>                seed of the random generator, the output only depends on the options (default: 1)
+ *     --core-header <file>      core.h to copy next to the shaders (default: Extra/core.h of the source tree)
+ *
+ * The default values of the global settings are written to globalSettings.txt in the output path, pass it to the
+ * other tools with --settings-file.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace
+{
+	struct Options
+	{
+		std::string mOutputPath;
+		unsigned int mMaterials;
+		unsigned int mMaterialsPerFile;
+		unsigned int mDepth;
+		unsigned int mProperties;
+		unsigned int mForeach;
+		unsigned int mSettings;
+		unsigned int mGlobalSettings;
+		unsigned int mFanout;
+		unsigned int mShaderSets;
+		unsigned int mConfigurations;
+		unsigned int mLods;
+		unsigned int mSeed;
+		std::string mCoreHeader;
+
+		Options ()
+			: mMaterials(1000), mMaterialsPerFile(250), mDepth(3), mProperties(8), mForeach(1), mSettings(4), mGlobalSettings(16)
+			, mFanout(4), mShaderSets(8), mConfigurations(2), mLods(2), mSeed(1)
+#ifdef SHINY_CORE_HEADER
+			, mCoreHeader(SHINY_CORE_HEADER)
+#endif
+		{
+		}
+	};
+
+	/// Small deterministic random generator (64 bit LCG), so that the output is the same on all platforms
+	class Random
+	{
+	public:
+		Random (unsigned int seed) : mState(seed * 6364136223846793005ULL + 1442695040888963407ULL) {}
+
+		/// @return a number in [0, max)
+		unsigned int next (unsigned int max)
+		{
+			mState = mState * 6364136223846793005ULL + 1442695040888963407ULL;
+			return max ? static_cast<unsigned int>((mState >> 33) % max) : 0;
+		}
+
+	private:
+		boost::uint64_t mState;
+	};
+
+	void printUsage ()
+	{
+		std::cerr << "Usage: shiny-corpus [options] <output path>\n"
+			<< "  --materials <n>           number of materials, not counting the parent materials (default: 1000)\n"
+			<< "  --materials-per-file <n>  number of materials in every .mat file (default: 250)\n"
+			<< "  --depth <n>               number of parents of every material, at least 1 (default: 3)\n"
+			<< "  --properties <n>          number of shader properties per pass (default: 8)\n"
+			<< "  --foreach <n>             number of @shForeach loops in every shader (default: 1)\n"
+			<< "  --settings <n>            number of global settings that every shader set uses (default: 4)\n"
+			<< "  --global-settings <n>     total number of global settings (default: 16)\n"
+			<< "  --fanout <n>              number of different values of every shader property and global setting (default: 4)\n"
+			<< "  --shader-sets <n>         number of vertex/fragment shader set pairs (default: 8)\n"
+			<< "  --configurations <n>      number of configurations (default: 2)\n"
+			<< "  --lods <n>                number of lod configurations (default: 2)\n"
+			<< "  --seed <n>                seed of the random generator (default: 1)\n"
+			<< "  --core-header <file>      core.h to copy next to the shaders (default: Extra/core.h of the source tree)" << std::endl;
+	}
+
+	std::string toString (unsigned int value)
+	{
+		return boost::lexical_cast<std::string>(value);
+	}
+
+	std::string getSettingName (unsigned int index)
+	{
+		return "setting_" + toString(index);
+	}
+
+	std::string getPropertyName (unsigned int index)
+	{
+		return "prop_" + toString(index);
+	}
+
+	std::string getShaderName (unsigned int shaderSet)
+	{
+		return "corpus_" + toString(shaderSet);
+	}
+
+	/// Name of a parent material, level 0 is the root that defines the pass
+	std::string getParentName (unsigned int shaderSet, unsigned int level)
+	{
+		return "_" + getShaderName(shaderSet) + "_" + toString(level);
+	}
+
+	void writeFile (const boost::filesystem::path& path, const std::string& content)
+	{
+		std::ofstream file (path.string().c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		file << content;
+		if (!file)
+			throw std::runtime_error ("unable to write " + path.string());
+	}
+
+	/// @return \a count different numbers in [0, max)
+	std::vector<unsigned int> pickDistinct (unsigned int count, unsigned int max, Random& random)
+	{
+		std::vector<unsigned int> result;
+		count = std::min(count, max);
+		while (result.size() < count)
+		{
+			unsigned int value = random.next(max);
+			if (std::find(result.begin(), result.end(), value) == result.end())
+				result.push_back(value);
+		}
+		return result;
+	}
+
+	std::string generateShader (const Options& options, const std::vector<unsigned int>& settings)
+	{
+		std::stringstream stream;
+		stream << "#include \"core.h\"\n"
+			<< "\n"
+			<< "#ifdef SH_VERTEX_SHADER\n"
+			<< "\n"
+			<< "    SH_BEGIN_PROGRAM\n"
+			<< "        shUniform(float4x4, wvp) @shAutoConstant(wvp, worldviewproj_matrix)\n"
+			<< "        shVertexInput(float2, uv0)\n"
+			<< "        shOutput(float2, UV)\n"
+			<< "    SH_START_PROGRAM\n"
+			<< "    {\n"
+			<< "        shOutputPosition = shMatrixMult(wvp, shInputPosition);\n"
+			<< "        UV = uv0;\n"
+			<< "    }\n"
+			<< "\n"
+			<< "#else\n"
+			<< "\n"
+			<< "    SH_BEGIN_PROGRAM\n"
+			<< "        shSampler2D(diffuseMap)\n"
+			<< "        shInput(float2, UV)\n"
+			<< "        shUniform(float4, materialDiffuse) @shUniformProperty4f(materialDiffuse, diffuse)\n"
+			<< "    SH_START_PROGRAM\n"
+			<< "    {\n"
+			<< "        shOutputColour(0) = shSample(diffuseMap, UV) * materialDiffuse;\n";
+
+		for (unsigned int i=0; i<options.mProperties; ++i)
+		{
+			stream << "#if @shPropertyEqual(" << getPropertyName(i) << ", 0)\n"
+				<< "        shOutputColour(0).xyz *= 0.5;\n"
+				<< "#else\n"
+				<< "        shOutputColour(0).xyz *= float(@shPropertyString(" << getPropertyName(i) << ")) * 0.25;\n"
+				<< "#endif\n";
+		}
+
+		for (size_t i=0; i<settings.size(); ++i)
+		{
+			stream << "#if @shGlobalSettingString(" << getSettingName(settings[i]) << ") > 0\n"
+				<< "        shOutputColour(0).xyz += float3(0.1, 0.1, 0.1);\n"
+				<< "#endif\n";
+		}
+
+		for (unsigned int i=0; i<options.mForeach; ++i)
+		{
+			if (settings.empty())
+				stream << "        @shForeach(" << options.mFanout << ")\n";
+			else
+				stream << "        @shForeach(@shGlobalSettingString(" << getSettingName(settings[i % settings.size()]) << "))\n";
+			stream << "        shOutputColour(0).xyz *= 0.9 + float(@shIterator) * 0.01;\n"
+				<< "        @shEndForeach\n";
+		}
+
+		stream << "    }\n"
+			<< "\n"
+			<< "#endif\n";
+		return stream.str();
+	}
+
+	void generateShaders (const Options& options, const boost::filesystem::path& shaderPath, Random& random)
+	{
+		std::stringstream shaderSets;
+		for (unsigned int i=0; i<options.mShaderSets; ++i)
+		{
+			std::string name = getShaderName(i);
+			shaderSets << "shader_set " << name << "_vertex\n"
+				<< "{\n"
+				<< "    source shaders/" << name << ".shader\n"
+				<< "    type vertex\n"
+				<< "    profiles_cg vs_2_0 arbvp1\n"
+				<< "    profiles_hlsl vs_2_0\n"
+				<< "}\n"
+				<< "\n"
+				<< "shader_set " << name << "_fragment\n"
+				<< "{\n"
+				<< "    source shaders/" << name << ".shader\n"
+				<< "    type fragment\n"
+				<< "    profiles_cg ps_2_x ps_2_0 ps arbfp1\n"
+				<< "    profiles_hlsl ps_2_0\n"
+				<< "}\n"
+				<< "\n";
+
+			writeFile(shaderPath / (name + ".shader"), generateShader(options, pickDistinct(options.mSettings, options.mGlobalSettings, random)));
+		}
+		writeFile(shaderPath / "corpus.shaderset", shaderSets.str());
+
+		if (options.mCoreHeader.empty())
+			throw std::runtime_error ("no core.h specified, use --core-header");
+		boost::filesystem::path coreHeader = shaderPath / "core.h";
+		boost::filesystem::remove(coreHeader);
+		boost::filesystem::copy_file(options.mCoreHeader, coreHeader);
+	}
+
+	std::string generateParents (const Options& options, unsigned int shaderSet, Random& random)
+	{
+		std::stringstream stream;
+		std::string name = getShaderName(shaderSet);
+
+		// the root material defines the pass and the default values
+		stream << "material " << getParentName(shaderSet, 0) << "\n"
+			<< "{\n"
+			<< "    diffuseMap black.png\n"
+			<< "    diffuse 1.0 1.0 1.0 1.0\n";
+		for (unsigned int i=0; i<options.mProperties; ++i)
+			stream << "    " << getPropertyName(i) << " 0\n";
+		if (options.mLods)
+		{
+			stream << "    lod_values";
+			for (unsigned int i=1; i<=options.mLods; ++i)
+				stream << " " << i * 100;
+			stream << "\n";
+		}
+		stream << "\n"
+			<< "    pass\n"
+			<< "    {\n"
+			<< "        vertex_program " << name << "_vertex\n"
+			<< "        fragment_program " << name << "_fragment\n"
+			<< "\n"
+			<< "        shader_properties\n"
+			<< "        {\n"
+			<< "            diffuse $diffuse\n";
+		for (unsigned int i=0; i<options.mProperties; ++i)
+			stream << "            " << getPropertyName(i) << " $" << getPropertyName(i) << "\n";
+		stream << "        }\n"
+			<< "\n"
+			<< "        texture_unit diffuseMap\n"
+			<< "        {\n"
+			<< "            direct_texture $diffuseMap\n"
+			<< "            create_in_ffp true\n"
+			<< "        }\n"
+			<< "    }\n"
+			<< "}\n"
+			<< "\n";
+
+		// every level below overrides one default value
+		for (unsigned int level=1; level<options.mDepth; ++level)
+		{
+			stream << "material " << getParentName(shaderSet, level) << "\n"
+				<< "{\n"
+				<< "    parent " << getParentName(shaderSet, level-1) << "\n";
+			if (options.mProperties)
+				stream << "    " << getPropertyName(random.next(options.mProperties)) << " " << random.next(options.mFanout) << "\n";
+			stream << "}\n"
+				<< "\n";
+		}
+		return stream.str();
+	}
+
+	std::string generateMaterial (const Options& options, unsigned int index, Random& random)
+	{
+		std::stringstream stream;
+		unsigned int shaderSet = index % options.mShaderSets;
+		stream << "material corpus_material_" << index << "\n"
+			<< "{\n"
+			<< "    parent " << getParentName(shaderSet, options.mDepth-1) << "\n";
+		stream << "    diffuseMap texture_" << index % 64 << ".png\n";
+		for (unsigned int i=0; i<options.mProperties; ++i)
+			stream << "    " << getPropertyName(i) << " " << random.next(options.mFanout) << "\n";
+		stream << "}\n"
+			<< "\n";
+		return stream.str();
+	}
+
+	void generateMaterials (const Options& options, const boost::filesystem::path& materialPath, Random& random)
+	{
+		std::stringstream parents;
+		for (unsigned int i=0; i<options.mShaderSets; ++i)
+			parents << generateParents(options, i, random);
+		writeFile(materialPath / "corpus_parents.mat", parents.str());
+
+		for (unsigned int first=0; first<options.mMaterials; first += options.mMaterialsPerFile)
+		{
+			std::stringstream stream;
+			for (unsigned int i=first; i<std::min(options.mMaterials, first + options.mMaterialsPerFile); ++i)
+				stream << generateMaterial(options, i, random);
+			writeFile(materialPath / ("corpus_" + toString(first / options.mMaterialsPerFile) + ".mat"), stream.str());
+		}
+	}
+
+	void generateConfigurations (const Options& options, const boost::filesystem::path& outputPath,
+		const boost::filesystem::path& materialPath, Random& random)
+	{
+		std::stringstream settings;
+		settings << "# default values of the global settings, generated by shiny-corpus\n";
+		for (unsigned int i=0; i<options.mGlobalSettings; ++i)
+			settings << getSettingName(i) << "=" << random.next(options.mFanout) << "\n";
+		writeFile(outputPath / "globalSettings.txt", settings.str());
+
+		if (options.mGlobalSettings == 0)
+			return;
+
+		std::stringstream configurations;
+		for (unsigned int i=0; i<options.mConfigurations; ++i)
+		{
+			configurations << "configuration corpus_configuration_" << i << "\n"
+				<< "{\n";
+			std::vector<unsigned int> overrides = pickDistinct(2, options.mGlobalSettings, random);
+			for (size_t j=0; j<overrides.size(); ++j)
+				configurations << "    " << getSettingName(overrides[j]) << " " << random.next(options.mFanout) << "\n";
+			configurations << "}\n"
+				<< "\n";
+		}
+		writeFile(materialPath / "corpus.configuration", configurations.str());
+
+		// every lower lod disables one more setting
+		std::stringstream lods;
+		for (unsigned int i=1; i<=options.mLods; ++i)
+		{
+			lods << "lod_configuration " << i << "\n"
+				<< "{\n";
+			for (unsigned int j=0; j<std::min(i, options.mGlobalSettings); ++j)
+				lods << "    " << getSettingName(j) << " 0\n";
+			lods << "}\n"
+				<< "\n";
+		}
+		writeFile(materialPath / "corpus.lod", lods.str());
+	}
+}
+
+int main (int argc, char** argv)
+{
+	try
+	{
+		Options options;
+		std::vector<std::string> positional;
+		std::vector<std::string> args (argv+1, argv+argc);
+		for (size_t i=0; i<args.size(); ++i)
+		{
+			const std::string& arg = args[i];
+			bool hasValue = i+1 < args.size();
+			unsigned int* value = NULL;
+			if (arg == "--materials") value = &options.mMaterials;
+			else if (arg == "--materials-per-file") value = &options.mMaterialsPerFile;
+			else if (arg == "--depth") value = &options.mDepth;
+			else if (arg == "--properties") value = &options.mProperties;
+			else if (arg == "--foreach") value = &options.mForeach;
+			else if (arg == "--settings") value = &options.mSettings;
+			else if (arg == "--global-settings") value = &options.mGlobalSettings;
+			else if (arg == "--fanout") value = &options.mFanout;
+			else if (arg == "--shader-sets") value = &options.mShaderSets;
+			else if (arg == "--configurations") value = &options.mConfigurations;
+			else if (arg == "--lods") value = &options.mLods;
+			else if (arg == "--seed") value = &options.mSeed;
+
+			if (value && hasValue)
+				*value = boost::lexical_cast<unsigned int>(args[++i]);
+			else if (arg == "--core-header" && hasValue)
+				options.mCoreHeader = args[++i];
+			else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0)
+			{
+				printUsage();
+				return 1;
+			}
+			else
+				positional.push_back(arg);
+		}
+		if (positional.size() != 1 || options.mMaterialsPerFile == 0 || options.mShaderSets == 0 || options.mFanout == 0
+			|| options.mDepth == 0)
+		{
+			printUsage();
+			return 1;
+		}
+		options.mOutputPath = positional[0];
+
+		boost::filesystem::path outputPath (options.mOutputPath);
+		boost::filesystem::path materialPath = outputPath / "materials";
+		boost::filesystem::path shaderPath = outputPath / "shaders";
+		boost::filesystem::create_directories(materialPath);
+		boost::filesystem::create_directories(shaderPath);
+
+		Random random (options.mSeed);
+		generateShaders(options, shaderPath, random);
+		generateMaterials(options, materialPath, random);
+		generateConfigurations(options, outputPath, materialPath, random);
+
+		std::cout << "Generated " << options.mMaterials << " materials into " << options.mOutputPath
+			<< ", pass --settings-file " << (outputPath / "globalSettings.txt").string() << " to the other tools" << std::endl;
+		return 0;
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << "shiny-corpus: " << e.what() << std::endl;
+		return 1;
+	}
+}